@@ -0,0 +1,492 @@
+/**
+ * Pipelined frame capture for the DLC300 camera using the asynchronous libusb API.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "AsyncCapture.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <chrono>
+
+
+AsyncCapture::AsyncCapture(DLC300& cam, FramePool& pool, int numFramesInFlight, int numDataTransfers) :
+		cam_(cam),
+		pool_(pool),
+		num_frames_in_flight_(std::max(1, std::min(numFramesInFlight, int(MAX_FRAMES_IN_FLIGHT)))),
+		num_data_transfers_(std::max(1, std::min(numDataTransfers, int(MAX_DATA_TRANSFERS)))),
+		oldest_(0),
+		device_lost_(false),
+		running_(false),
+		event_thread_should_run_(false)
+{
+
+}
+
+
+AsyncCapture::~AsyncCapture()
+{
+	stop();
+}
+
+
+int AsyncCapture::start()
+{
+	if (running_)
+	{
+		return 0;
+	}
+
+	if (!cam_.isPresent())
+	{
+		printf("AsyncCapture: No camera present\n");
+		return -1;
+	}
+
+	slots_.resize(num_frames_in_flight_);
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		Slot& slot = slots_[i];
+
+		memset(slot.data, 0, sizeof(slot.data));
+		slot.owner = this;
+		slot.num_data = 0;
+		slot.pending = 0;
+		slot.failed = true;
+
+		slot.header = libusb_alloc_transfer(0);
+		slot.status = libusb_alloc_transfer(0);
+		slot.trailer = libusb_alloc_transfer(0);
+
+		bool allocation_failed = !slot.header || !slot.status || !slot.trailer;
+
+		for (int j = 0; j < num_data_transfers_; j++)
+		{
+			slot.data[j] = libusb_alloc_transfer(0);
+			allocation_failed |= !slot.data[j];
+		}
+
+		if (allocation_failed)
+		{
+			printf("AsyncCapture: libusb_alloc_transfer failed\n");
+			stop();
+			return -1;
+		}
+	}
+
+	event_thread_should_run_ = true;
+	event_thread_ = std::thread(&AsyncCapture::eventLoop, this);
+
+	running_ = true;
+	oldest_ = 0;
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		if (submitSlot(slots_[i]) < 0)
+		{
+			stop();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+void AsyncCapture::stop()
+{
+	if (running_)
+	{
+		running_ = false;
+		cancelAll();
+		waitUntilIdle();
+	}
+
+	if (event_thread_.joinable())
+	{
+		event_thread_should_run_ = false;
+		event_thread_.join();
+	}
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		Slot& slot = slots_[i];
+
+		libusb_free_transfer(slot.header);
+		libusb_free_transfer(slot.status);
+		libusb_free_transfer(slot.trailer);
+
+		for (int j = 0; j < num_data_transfers_; j++)
+		{
+			libusb_free_transfer(slot.data[j]);
+		}
+	}
+
+	slots_.clear();
+}
+
+
+/**
+ * Queues the header and all IN transfers needed for one frame, using the current camera settings.
+ */
+int AsyncCapture::submitSlot(Slot& slot)
+{
+	// Outside the lock, since this may wait for a consumer to release a frame
+	if (!slot.frame)
+	{
+		slot.frame = pool_.acquire(1000);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!slot.frame)
+	{
+		printf("AsyncCapture: No free frame in the pool\n");
+		slot.failed = true;
+		return -1;
+	}
+
+	libusb_device_handle* devh = cam_.getDeviceHandle();
+
+	if (devh == 0)
+	{
+		printf("AsyncCapture: No valid USB device handle!\n");
+		slot.failed = true;
+		return -1;
+	}
+
+	// Parameters changed since the previous request take effect from this frame on
+	cam_.applyParameters();
+
+	slot.width = cam_.getWidth();
+	slot.height = cam_.getHeight();
+	slot.frame_size = cam_.getFrameSize();
+	slot.failed = false;
+	slot.bytes = 0;
+	slot.sequence = cam_.nextSequence();
+
+	if (slot.frame_size > slot.frame->capacity)
+	{
+		printf("AsyncCapture: Frame buffer too small (%d < %d)\n", slot.frame->capacity, slot.frame_size);
+		slot.failed = true;
+		return -1;
+	}
+
+	cam_.buildHeader(slot.header_buf, sizeof(slot.header_buf));
+
+	libusb_fill_bulk_transfer(slot.header, devh, DLC300::ENDPOINT_OUT,
+			slot.header_buf, sizeof(slot.header_buf), transferCallback, &slot, 4000);
+
+	// A short packet ends the status transfer, as it does in DLC300::getFrame()
+	libusb_fill_bulk_transfer(slot.status, devh, DLC300::ENDPOINT_IN,
+			slot.status_buf, sizeof(slot.status_buf), transferCallback, &slot, 0);
+
+	// Split the image into chunks being a multiple of the 512 byte max packet size
+	int chunk = (slot.frame_size / num_data_transfers_ + 511) & ~511;
+	slot.num_data = 0;
+
+	for (int offset = 0; offset < slot.frame_size; offset += chunk)
+	{
+		int length = std::min(chunk, slot.frame_size - offset);
+
+		libusb_fill_bulk_transfer(slot.data[slot.num_data], devh, DLC300::ENDPOINT_IN,
+				slot.frame->data + offset, length, transferCallback, &slot, 0);
+
+		slot.num_data++;
+	}
+
+	libusb_fill_bulk_transfer(slot.trailer, devh, DLC300::ENDPOINT_IN,
+			slot.trailer_buf, sizeof(slot.trailer_buf), transferCallback, &slot, 0);
+
+	libusb_transfer* order[MAX_DATA_TRANSFERS + 3];
+	int num_transfers = 0;
+
+	order[num_transfers++] = slot.header;
+	order[num_transfers++] = slot.status;
+
+	for (int i = 0; i < slot.num_data; i++)
+	{
+		order[num_transfers++] = slot.data[i];
+	}
+
+	if (cam_.hasTrailer())
+	{
+		order[num_transfers++] = slot.trailer;
+	}
+
+	for (int i = 0; i < num_transfers; i++)
+	{
+		int rc = libusb_submit_transfer(order[i]);
+
+		if (rc != 0)
+		{
+			printf("AsyncCapture: libusb_submit_transfer failed (%d)\n", rc);
+			slot.failed = true;
+			return -1;
+		}
+
+		slot.pending++;
+	}
+
+	return 0;
+}
+
+
+void AsyncCapture::cancelAll()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		Slot& slot = slots_[i];
+
+		if (slot.pending == 0)
+		{
+			continue;
+		}
+
+		// Cancelling a transfer which already completed is harmless (LIBUSB_ERROR_NOT_FOUND)
+		libusb_cancel_transfer(slot.header);
+		libusb_cancel_transfer(slot.status);
+
+		for (int j = 0; j < slot.num_data; j++)
+		{
+			libusb_cancel_transfer(slot.data[j]);
+		}
+
+		libusb_cancel_transfer(slot.trailer);
+	}
+}
+
+
+void AsyncCapture::waitUntilIdle()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	bool idle = completed_.wait_for(lock, std::chrono::milliseconds(5000), [this]() {
+		for (size_t i = 0; i < slots_.size(); i++)
+		{
+			if (slots_[i].pending != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	});
+
+	if (!idle)
+	{
+		printf("AsyncCapture: Transfers did not complete after being cancelled\n");
+	}
+}
+
+
+/**
+ * Throws away every frame in flight, and queues new requests for all slots.
+ * Used whenever the IN stream no longer can be trusted to be aligned with the slots.
+ */
+int AsyncCapture::restart()
+{
+	cancelAll();
+	waitUntilIdle();
+
+	oldest_ = 0;
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		slots_[i].failed = true;
+	}
+
+	// The camera was unplugged (and maybe back already), so it has to be opened again. While it
+	// stays away, each call waits for hotplug to report it (or for one more attempt after the
+	// backoff), instead of failing right away and being called again in a tight loop.
+	if (device_lost_.exchange(false) || !cam_.isPresent())
+	{
+		if (cam_.reconnect() != 0 && !cam_.waitUntilPresent(DLC300::REOPEN_BACKOFF_MAX_MS))
+		{
+			device_lost_ = true;
+			return -1;
+		}
+	}
+	else
+	{
+		cam_.getStats().recordRestart();
+
+		// Whatever arrives for the cancelled transfers would otherwise end up in the new ones
+		cam_.drain();
+	}
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		if (submitSlot(slots_[i]) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+FrameRef AsyncCapture::getFrame(int timeout_ms)
+{
+	if (!running_)
+	{
+		return FrameRef();
+	}
+
+	Slot& slot = slots_[oldest_];
+
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+
+		bool completed = completed_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+				[&slot]() { return slot.pending == 0; });
+
+		if (!completed)
+		{
+			lock.unlock();
+			printf("AsyncCapture: Timeout waiting for frame\n");
+			restart();
+			return FrameRef();
+		}
+	}
+
+	if (slot.failed)
+	{
+		// Nothing to say while waiting for an unplugged camera to return
+		if (!device_lost_)
+		{
+			printf("AsyncCapture: We are not in sync!\n");
+		}
+
+		restart();
+		return FrameRef();
+	}
+
+	// Hand out the buffer the data was transferred into. The slot gets a new one from the pool.
+	FrameRef frame = slot.frame;
+	slot.frame.reset();
+
+	frame->width = slot.width;
+	frame->height = slot.height;
+	frame->size = slot.width * slot.height;
+
+	FrameMetadata& meta = frame->meta;
+
+	meta.sequence = slot.sequence;
+	meta.header_sent_ns = slot.header_sent_ns;
+	meta.last_byte_ns = slot.last_byte_ns;
+	DLC300::describeHeader(slot.header_buf, meta);
+
+	meta.status_length = DLC300::STATUS_SIZE;
+	memcpy(meta.status, slot.status_buf, DLC300::STATUS_SIZE);
+
+	// At 800x600 the trailer is the end of the image data
+	const unsigned char* trailer = frame->size < slot.frame_size ? frame->data + frame->size : slot.trailer_buf;
+
+	meta.trailer_length = DLC300::TRAILER_SIZE;
+	memcpy(meta.trailer, trailer, DLC300::TRAILER_SIZE);
+
+	// The header is sent while earlier frames are still arriving, so the camera can only start
+	// on this one after the previous frame's last byte
+	CaptureStats::Clock::time_point requested = std::max(slot.header_sent, previous_last_byte_);
+	previous_last_byte_ = slot.last_byte;
+
+	cam_.getStats().recordFrame(requested, slot.first_byte, slot.last_byte, slot.bytes);
+
+	// Reuse the slot for the frame after the newest one in flight. When that fails, the slot is
+	// marked failed, and the stream is restarted once getFrame() gets to it.
+	if (submitSlot(slot) < 0)
+	{
+		slot.failed = true;
+	}
+
+	oldest_ = (oldest_ + 1) % slots_.size();
+
+	return frame;
+}
+
+
+void AsyncCapture::eventLoop()
+{
+	while (event_thread_should_run_)
+	{
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(cam_.getContext(), &tv, NULL);
+	}
+}
+
+
+void LIBUSB_CALL AsyncCapture::transferCallback(libusb_transfer* transfer)
+{
+	Slot* slot = static_cast<Slot*>(transfer->user_data);
+	AsyncCapture* self = slot->owner;
+
+	std::lock_guard<std::mutex> lock(self->mutex_);
+
+	int expected = transfer->length;
+
+	if (transfer == slot->status)
+	{
+		expected = DLC300::STATUS_SIZE;
+	}
+	else if (transfer == slot->trailer)
+	{
+		expected = DLC300::TRAILER_SIZE;
+	}
+
+	CaptureStats::Clock::time_point now = CaptureStats::Clock::now();
+	CaptureStats& stats = self->cam_.getStats();
+
+	if (transfer == slot->header)
+	{
+		slot->header_sent = now;
+		slot->header_sent_ns = monotonicNanoseconds();
+	}
+	else
+	{
+		slot->bytes += transfer->actual_length;
+	}
+
+	if (transfer == slot->status)
+	{
+		slot->first_byte = now;
+	}
+
+	if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
+	{
+		self->device_lost_ = true;
+	}
+
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED || transfer->actual_length != expected)
+	{
+		slot->failed = true;
+
+		if (transfer == slot->status && transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		{
+			stats.recordSyncLoss();
+		}
+		else if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		{
+			stats.recordShortTransfer();
+		}
+	}
+
+	slot->pending--;
+
+	if (slot->pending == 0)
+	{
+		slot->last_byte = now;
+		slot->last_byte_ns = monotonicNanoseconds();
+		self->completed_.notify_all();
+	}
+}
@@ -0,0 +1,136 @@
+/**
+ * Pipelined frame capture for the DLC300 camera using the asynchronous libusb API.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef ASYNCCAPTURE_H_
+#define ASYNCCAPTURE_H_
+
+#include "DLC300.h"
+#include "FramePool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Keeps several frames worth of bulk transfers queued on the camera, so the bus never sits idle
+ * between the header, status, image and trailer phases of a frame, or between two frames.
+ *
+ * Each frame in flight owns one "slot", consisting of the OUT transfer carrying the header,
+ * and the IN transfers for the status packet, the image data (split into several transfers)
+ * and the trailer. Since all IN transfers are queued on the same endpoint, they complete in
+ * the order they were submitted. The header for the next frame is therefore already queued
+ * while the current frame is still arriving.
+ *
+ * The image data is transferred straight into buffers from a FramePool, and handed to the
+ * caller in place. When the pool was set up with DLC300DeviceMemory, no copy of the image
+ * is made anywhere between the USB controller and the consumer.
+ *
+ * An internal thread handles libusb events. The blocking DLC300::getFrame() must not be
+ * used while an AsyncCapture is running on the same camera.
+ */
+class AsyncCapture {
+public:
+	enum {
+		MAX_FRAMES_IN_FLIGHT = 8,
+		MAX_DATA_TRANSFERS = 16
+	};
+
+	/**
+	 * @param pool Provides the buffers frames are captured into. Must outlive this object, and
+	 *             have room for numFramesInFlight frames besides those held by consumers.
+	 * @param numFramesInFlight Number of frames requested from the camera ahead of the consumer
+	 * @param numDataTransfers Number of bulk transfers the image data of each frame is split into
+	 */
+	AsyncCapture(DLC300& cam, FramePool& pool, int numFramesInFlight = 2, int numDataTransfers = 4);
+	~AsyncCapture();
+
+	int start(); ///< Allocates transfers, starts the event thread and queues the first frames
+	void stop(); ///< Cancels all outstanding transfers and stops the event thread
+
+	bool isRunning() { return running_; }
+
+	/**
+	 * Waits for the oldest frame in flight, and requests a new frame in its place.
+	 *
+	 * The returned frame has its width and height set to the resolution it was requested with
+	 * (frames already in flight when the resolution changes still use the old resolution).
+	 *
+	 * @return an empty handle on failure (the pipeline is restarted on failure)
+	 */
+	FrameRef getFrame(int timeout_ms = 4000);
+
+private:
+	struct Slot {
+		AsyncCapture* owner;
+
+		libusb_transfer* header;
+		libusb_transfer* status;
+		libusb_transfer* data[MAX_DATA_TRANSFERS];
+		libusb_transfer* trailer;
+		int num_data;
+
+		unsigned char header_buf[DLC300::HEADER_SIZE];
+		unsigned char status_buf[512];
+		unsigned char trailer_buf[512];
+
+		FrameRef frame; ///< The image data is transferred directly into this frame
+
+		int frame_size;
+		int width;
+		int height;
+
+		uint64_t sequence;
+		uint64_t header_sent_ns; ///< CLOCK_MONOTONIC, see FrameMetadata
+		uint64_t last_byte_ns;
+
+		CaptureStats::Clock::time_point header_sent;
+		CaptureStats::Clock::time_point first_byte;
+		CaptureStats::Clock::time_point last_byte;
+		unsigned long bytes;
+
+		int pending;  ///< Number of submitted transfers not yet completed
+		bool failed;  ///< Any transfer was short, cancelled or failed, or the slot was never submitted
+	};
+
+	DLC300& cam_;
+	FramePool& pool_;
+	int num_frames_in_flight_;
+	int num_data_transfers_;
+
+	std::vector<Slot> slots_;
+	int oldest_; ///< Index of the slot submitted first, i.e. the next one to be delivered
+	CaptureStats::Clock::time_point previous_last_byte_; ///< Of the frame delivered last, see getFrame()
+
+	std::mutex mutex_;
+	std::condition_variable completed_;
+
+	std::atomic<bool> device_lost_; ///< A transfer failed because the camera was disconnected
+
+	std::thread event_thread_;
+	std::atomic<bool> running_;
+	std::atomic<bool> event_thread_should_run_;
+
+	int submitSlot(Slot& slot);
+	void cancelAll();
+	void waitUntilIdle();
+	int restart();
+
+	void eventLoop();
+
+	static void LIBUSB_CALL transferCallback(libusb_transfer* transfer);
+
+	AsyncCapture(const AsyncCapture&);
+	AsyncCapture& operator=(const AsyncCapture&);
+};
+
+
+#endif /* ASYNCCAPTURE_H_ */
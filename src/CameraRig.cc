@@ -0,0 +1,184 @@
+/**
+ * Concurrent capture from several DLC300 cameras.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "CameraRig.h"
+#include "AsyncCapture.h"
+#include "CaptureThread.h"
+#include "DLC300.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+
+CameraRig::CameraRig(const std::vector<std::string>& selectors, int numAsyncFrames, bool useHugePages) :
+		num_async_frames_(numAsyncFrames),
+		use_huge_pages_(useHugePages),
+		should_run_(false)
+{
+	for (size_t i = 0; i < selectors.size(); i++)
+	{
+		Pipeline* pipeline = new Pipeline();
+
+		pipeline->selector = selectors[i];
+		pipeline->cam = new DLC300(selectors[i]);
+		pipeline->memory = new DLC300DeviceMemory(*pipeline->cam);
+		pipeline->pool = 0;
+		pipeline->async = 0;
+		pipeline->capture = 0;
+		pipeline->frames = 0;
+		pipeline->bytes = 0;
+
+		pipelines_.push_back(pipeline);
+	}
+}
+
+
+CameraRig::~CameraRig()
+{
+	for (size_t i = 0; i < pipelines_.size(); i++)
+	{
+		stop(pipelines_[i]);
+
+		delete pipelines_[i]->memory;
+		delete pipelines_[i]->cam;
+		delete pipelines_[i];
+	}
+}
+
+
+DLC300& CameraRig::getCamera(int index)
+{
+	return *pipelines_[index]->cam;
+}
+
+
+int CameraRig::start(Pipeline* pipeline)
+{
+	if (!pipeline->cam->isPresent())
+	{
+		printf("Camera %s is not present\n", pipeline->selector.c_str());
+		return -1;
+	}
+
+	const int queue_depth = 2;
+
+	pipeline->pool = new FramePool(queue_depth + num_async_frames_ + 2,
+			DLC300::MAX_FRAME_SIZE + DLC300::TRAILER_SIZE, use_huge_pages_, pipeline->memory);
+
+	if (num_async_frames_ > 0)
+	{
+		pipeline->async = new AsyncCapture(*pipeline->cam, *pipeline->pool, num_async_frames_);
+
+		if (pipeline->async->start() < 0)
+		{
+			printf("Could not start asynchronous capture on camera %s\n", pipeline->selector.c_str());
+			return -1;
+		}
+	}
+
+	pipeline->capture = new CaptureThread(*pipeline->cam, pipeline->async, *pipeline->pool,
+			queue_depth, SpscQueue<Frame*>::NEWEST_WINS);
+
+	pipeline->capture->start();
+	pipeline->consumer = std::thread(&CameraRig::consume, this, pipeline);
+
+	return 0;
+}
+
+
+void CameraRig::stop(Pipeline* pipeline)
+{
+	if (pipeline->consumer.joinable())
+	{
+		pipeline->consumer.join();
+	}
+
+	delete pipeline->capture;
+	delete pipeline->async;
+	delete pipeline->pool;
+
+	pipeline->capture = 0;
+	pipeline->async = 0;
+	pipeline->pool = 0;
+}
+
+
+void CameraRig::consume(Pipeline* pipeline)
+{
+	while (should_run_)
+	{
+		FrameRef frame = pipeline->capture->getFrame(100);
+
+		if (frame)
+		{
+			pipeline->frames++;
+			pipeline->bytes += frame->size;
+		}
+	}
+}
+
+
+int CameraRig::run(int seconds)
+{
+	should_run_ = true;
+
+	for (size_t i = 0; i < pipelines_.size(); i++)
+	{
+		pipelines_[i]->frames = 0;
+		pipelines_[i]->bytes = 0;
+
+		if (start(pipelines_[i]) < 0)
+		{
+			should_run_ = false;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	for (int s = 0; s < seconds && should_run_; s++)
+	{
+		std::this_thread::sleep_until(start_time + std::chrono::seconds(s + 1));
+
+		unsigned long total_frames = 0;
+		unsigned long long total_bytes = 0;
+
+		for (size_t i = 0; i < pipelines_.size(); i++)
+		{
+			Pipeline* pipeline = pipelines_[i];
+
+			unsigned long frames = pipeline->frames;
+			unsigned long long bytes = pipeline->bytes;
+
+			printf("%s: %.1f fps, %.1f MB/s, %lu dropped | ", pipeline->selector.c_str(),
+					frames / double(s + 1), bytes / (1e6 * (s + 1)), pipeline->capture->getDroppedFrames());
+
+			total_frames += frames;
+			total_bytes += bytes;
+		}
+
+		printf("total: %.1f fps, %.1f MB/s\n", total_frames / double(s + 1), total_bytes / (1e6 * (s + 1)));
+	}
+
+	should_run_ = false;
+
+	int rc = 0;
+
+	for (size_t i = 0; i < pipelines_.size(); i++)
+	{
+		if (pipelines_[i]->frames == 0)
+		{
+			rc = -1;
+		}
+
+		stop(pipelines_[i]);
+	}
+
+	return rc;
+}
@@ -0,0 +1,79 @@
+/**
+ * Concurrent capture from several DLC300 cameras.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef CAMERARIG_H_
+#define CAMERARIG_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AsyncCapture;
+class CaptureThread;
+class DLC300;
+class DLC300DeviceMemory;
+class FramePool;
+
+
+/**
+ * Owns one complete capture pipeline per camera: a DLC300 with its own libusb context,
+ * a frame pool, an optional AsyncCapture, a CaptureThread and a consumer thread.
+ * The pipelines share nothing, so every camera captures at its own pace.
+ */
+class CameraRig {
+public:
+	/**
+	 * @param selectors Location or serial number of each camera to use (see DLC300::DeviceInfo)
+	 * @param numAsyncFrames Frames in flight per camera when using AsyncCapture, or 0 to use blocking capture
+	 */
+	CameraRig(const std::vector<std::string>& selectors, int numAsyncFrames, bool useHugePages);
+	~CameraRig();
+
+	int getNumCameras() { return int(pipelines_.size()); }
+
+	/** For applying settings before run() */
+	DLC300& getCamera(int index);
+
+	/**
+	 * Captures from all cameras concurrently for the given number of seconds,
+	 * printing per camera and aggregate throughput once per second.
+	 * @return 0 if at least one frame was captured from every camera
+	 */
+	int run(int seconds);
+
+private:
+	struct Pipeline {
+		std::string selector;
+		DLC300* cam;
+		DLC300DeviceMemory* memory;
+		FramePool* pool;
+		AsyncCapture* async;
+		CaptureThread* capture;
+
+		std::thread consumer;
+		std::atomic<unsigned long> frames;
+		std::atomic<unsigned long long> bytes;
+	};
+
+	std::vector<Pipeline*> pipelines_;
+	int num_async_frames_;
+	bool use_huge_pages_;
+	std::atomic<bool> should_run_;
+
+	int start(Pipeline* pipeline);
+	void stop(Pipeline* pipeline);
+	void consume(Pipeline* pipeline);
+
+	CameraRig(const CameraRig&);
+	CameraRig& operator=(const CameraRig&);
+};
+
+
+#endif /* CAMERARIG_H_ */
@@ -0,0 +1,185 @@
+/**
+ * Counters and latency histograms for the USB transfers of each captured frame.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "CaptureStats.h"
+
+
+void LatencyHistogram::add(uint64_t us)
+{
+	int bucket = 0;
+
+	while (bucket < NUM_BUCKETS - 1 && (uint64_t(1) << bucket) <= us)
+	{
+		bucket++;
+	}
+
+	buckets_[bucket]++;
+	count_++;
+	sum_ += us;
+
+	uint64_t max = max_;
+	while (us > max && !max_.compare_exchange_weak(max, us))
+	{
+	}
+}
+
+
+void LatencyHistogram::reset()
+{
+	for (int i = 0; i < NUM_BUCKETS; i++)
+	{
+		buckets_[i] = 0;
+	}
+
+	count_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+
+uint64_t LatencyHistogram::getMean()
+{
+	unsigned long count = count_;
+	return count ? sum_ / count : 0;
+}
+
+
+uint64_t LatencyHistogram::getPercentile(double fraction)
+{
+	unsigned long count = count_;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	unsigned long wanted = (unsigned long)(fraction * count + 0.5);
+	unsigned long seen = 0;
+
+	for (int i = 0; i < NUM_BUCKETS; i++)
+	{
+		seen += buckets_[i];
+
+		if (seen >= wanted)
+		{
+			return uint64_t(1) << i;
+		}
+	}
+
+	return max_;
+}
+
+
+CaptureStats::CaptureStats() :
+		dump_interval_ms_(0)
+{
+	reset();
+}
+
+
+void CaptureStats::reset()
+{
+	frames_ = 0;
+	bytes_ = 0;
+	short_transfers_ = 0;
+	sync_losses_ = 0;
+	restarts_ = 0;
+	transfer_time_us_ = 0;
+
+	request_to_first_.reset();
+	first_to_last_.reset();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	reset_time_ = Clock::now();
+	last_dump_ = reset_time_;
+}
+
+
+static uint64_t microseconds(CaptureStats::Clock::duration d)
+{
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	return us > 0 ? us : 0;
+}
+
+
+void CaptureStats::recordFrame(Clock::time_point requested, Clock::time_point first_byte,
+		Clock::time_point last_byte, unsigned long bytes)
+{
+	uint64_t transfer_us = microseconds(last_byte - first_byte);
+
+	request_to_first_.add(microseconds(first_byte - requested));
+	first_to_last_.add(transfer_us);
+
+	transfer_time_us_ += transfer_us;
+	bytes_ += bytes;
+	frames_++;
+
+	int interval_ms = dump_interval_ms_;
+
+	if (interval_ms > 0)
+	{
+		bool should_dump;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			should_dump = last_byte - last_dump_ >= std::chrono::milliseconds(interval_ms);
+
+			if (should_dump)
+			{
+				last_dump_ = last_byte;
+			}
+		}
+
+		if (should_dump)
+		{
+			print(stdout);
+		}
+	}
+}
+
+
+double CaptureStats::getTransferRate()
+{
+	uint64_t us = transfer_time_us_;
+	return us ? bytes_ * 1e6 / us : 0;
+}
+
+
+double CaptureStats::getThroughput()
+{
+	Clock::time_point reset_time;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		reset_time = reset_time_;
+	}
+
+	uint64_t us = microseconds(Clock::now() - reset_time);
+	return us ? bytes_ * 1e6 / us : 0;
+}
+
+
+void CaptureStats::print(FILE* out)
+{
+	fprintf(out, "frames=%lu, %.1f MB/s (%.1f MB/s while transferring), short transfers=%lu, sync losses=%lu, restarts=%lu\n",
+			getFrames(), getThroughput() / 1e6, getTransferRate() / 1e6,
+			getShortTransfers(), getSyncLosses(), getRestarts());
+
+	fprintf(out, "  request->first byte: mean=%llu us, p50<%llu us, p99<%llu us, max=%llu us (from the header, or the previous frame's last byte if later)\n",
+			(unsigned long long)request_to_first_.getMean(),
+			(unsigned long long)request_to_first_.getPercentile(0.5),
+			(unsigned long long)request_to_first_.getPercentile(0.99),
+			(unsigned long long)request_to_first_.getMax());
+
+	fprintf(out, "  first->last byte:    mean=%llu us, p50<%llu us, p99<%llu us, max=%llu us\n",
+			(unsigned long long)first_to_last_.getMean(),
+			(unsigned long long)first_to_last_.getPercentile(0.5),
+			(unsigned long long)first_to_last_.getPercentile(0.99),
+			(unsigned long long)first_to_last_.getMax());
+}
@@ -0,0 +1,118 @@
+/**
+ * Counters and latency histograms for the USB transfers of each captured frame.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef CAPTURESTATS_H_
+#define CAPTURESTATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+
+/**
+ * Histogram of durations with power of two sized buckets (bucket i holds durations
+ * below 2^i microseconds), which is cheap enough to update for every frame.
+ */
+class LatencyHistogram {
+public:
+	enum { NUM_BUCKETS = 24 }; ///< The last bucket holds everything from 8.4 seconds and up
+
+	LatencyHistogram() { reset(); }
+
+	void add(uint64_t us);
+	void reset();
+
+	unsigned long getCount() { return count_; }
+	uint64_t getMean();
+	uint64_t getMax() { return max_; }
+
+	/** @return upper bound (in microseconds) of the bucket holding the given fraction (0..1) of all samples */
+	uint64_t getPercentile(double fraction);
+
+private:
+	std::atomic<unsigned long> buckets_[NUM_BUCKETS];
+	std::atomic<unsigned long> count_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+
+/**
+ * Where the time of each frame goes. Updated by the capture path (DLC300 or AsyncCapture),
+ * and safe to query from any thread.
+ */
+class CaptureStats {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	CaptureStats();
+
+	/**
+	 * @param requested When the camera could start on the frame: when the header requesting it
+	 *        was written, or, with requests pipelined (AsyncCapture), when the last byte of the
+	 *        previous frame arrived, if that was later
+	 * @param first_byte When the first packet (the status) of the frame arrived
+	 * @param last_byte When the last packet of the frame arrived
+	 * @param bytes Number of bytes received for the frame
+	 */
+	void recordFrame(Clock::time_point requested, Clock::time_point first_byte,
+			Clock::time_point last_byte, unsigned long bytes);
+
+	void recordShortTransfer() { short_transfers_++; }
+	void recordSyncLoss() { sync_losses_++; }
+	void recordRestart() { restarts_++; }
+
+	unsigned long getFrames() { return frames_; }
+	unsigned long long getBytes() { return bytes_; }
+	unsigned long getShortTransfers() { return short_transfers_; }
+	unsigned long getSyncLosses() { return sync_losses_; }
+	unsigned long getRestarts() { return restarts_; }
+
+	LatencyHistogram& getRequestToFirstByte() { return request_to_first_; }
+	LatencyHistogram& getFirstToLastByte() { return first_to_last_; }
+
+	/** @return average number of bytes per second received while the frames were arriving */
+	double getTransferRate();
+
+	/** @return number of bytes per second received since the statistics were reset */
+	double getThroughput();
+
+	void reset();
+
+	void print(FILE* out);
+
+	/**
+	 * Makes recordFrame() print the statistics (to stdout) at most once per interval_ms.
+	 * Zero disables printing.
+	 */
+	void setDumpInterval(int interval_ms) { dump_interval_ms_ = interval_ms; }
+
+private:
+	std::atomic<unsigned long> frames_;
+	std::atomic<unsigned long long> bytes_;
+	std::atomic<unsigned long> short_transfers_;
+	std::atomic<unsigned long> sync_losses_;
+	std::atomic<unsigned long> restarts_;
+
+	LatencyHistogram request_to_first_;
+	LatencyHistogram first_to_last_;
+
+	std::atomic<uint64_t> transfer_time_us_; ///< Sum of first to last byte time of all frames
+
+	std::mutex mutex_; ///< Protects the time points below
+	Clock::time_point reset_time_;
+	Clock::time_point last_dump_;
+	std::atomic<int> dump_interval_ms_;
+};
+
+
+#endif /* CAPTURESTATS_H_ */
@@ -0,0 +1,178 @@
+/**
+ * Captures frames from the DLC300 camera in a thread of its own.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "CaptureThread.h"
+#include "AsyncCapture.h"
+#include "ImageKernels.h"
+
+#include <stdio.h>
+
+
+CaptureThread::CaptureThread(DLC300& cam, AsyncCapture* async, FramePool& pool, int queueDepth,
+		SpscQueue<Frame*>::OverflowPolicy policy) :
+		cam_(cam),
+		async_(async),
+		pool_(pool),
+		layout_(FrameView::INTERLEAVED),
+		filled_(queueDepth, policy),
+		should_run_(false),
+		captured_(0),
+		failed_(0)
+{
+
+}
+
+
+CaptureThread::~CaptureThread()
+{
+	stop();
+	drainQueue();
+}
+
+
+void CaptureThread::start()
+{
+	if (!thread_.joinable())
+	{
+		should_run_ = true;
+		thread_ = std::thread(&CaptureThread::run, this);
+	}
+}
+
+
+void CaptureThread::stop()
+{
+	if (thread_.joinable())
+	{
+		should_run_ = false;
+		filled_.close();
+		thread_.join();
+	}
+}
+
+
+/** Hands frames nobody is going to consume back to the pool */
+void CaptureThread::drainQueue()
+{
+	Frame* frame;
+
+	while (filled_.tryPop(frame))
+	{
+		FrameRef(frame).reset();
+	}
+}
+
+
+FrameRef CaptureThread::getFrame(int timeout_ms)
+{
+	Frame* frame = 0;
+
+	if (filled_.pop(frame, timeout_ms))
+	{
+		return FrameRef(frame);
+	}
+
+	return FrameRef();
+}
+
+
+/** @return the next frame from the camera, or an empty handle on failure */
+FrameRef CaptureThread::captureFrame()
+{
+	if (async_)
+	{
+		// Delivered in place, in the buffer the USB transfers wrote into
+		return async_->getFrame();
+	}
+
+	// Waits when the consumers hold on to every frame in the pool (the sensor stalls)
+	FrameRef frame = pool_.acquire(100);
+
+	if (!frame)
+	{
+		return frame;
+	}
+
+	// New camera parameters take effect in getFrame(), so the resolution is known only afterwards.
+	// getFrame() fails if the new frame size exceeds the buffer.
+	if (cam_.getFrame(frame->data, frame->capacity, &frame->meta) != 0)
+	{
+		return FrameRef();
+	}
+
+	frame->width = cam_.getWidth();
+	frame->height = cam_.getHeight();
+	frame->size = frame->width * frame->height;
+
+	return frame;
+}
+
+
+/** @return a copy of frame split into color planes, or an empty handle if the pool ran dry */
+FrameRef CaptureThread::toPlanar(const FrameRef& frame)
+{
+	FrameRef planar = pool_.acquire(100);
+
+	if (!planar)
+	{
+		return planar;
+	}
+
+	ImageKernels::deinterleaveBayer(frame->data, frame->width, frame->height, planar->data);
+
+	planar->width = frame->width;
+	planar->height = frame->height;
+	planar->size = frame->size;
+	planar->layout = FrameView::PLANAR;
+	planar->meta = frame->meta;
+
+	return planar;
+}
+
+
+void CaptureThread::run()
+{
+	while (should_run_)
+	{
+		FrameRef frame = captureFrame();
+
+		if (frame && layout_ == FrameView::PLANAR)
+		{
+			// The interleaved frame goes back to the pool (or the USB transfers) right away
+			frame = toPlanar(frame);
+		}
+
+		if (!frame)
+		{
+			failed_++;
+
+			// DLC300::getFrame() returns right away while waiting to reopen the camera
+			if (!cam_.isPresent())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(DLC300::REOPEN_BACKOFF_MIN_MS));
+			}
+			continue;
+		}
+
+		captured_++;
+
+		Frame* evicted = 0;
+
+		if (!filled_.push(frame.get(), evicted))
+		{
+			break; // closed by stop()
+		}
+
+		// The queue owns the reference now
+		frame.detach();
+
+		// A frame dropped to make room goes back to the pool
+		FrameRef(evicted).reset();
+	}
+}
@@ -0,0 +1,87 @@
+/**
+ * Captures frames from the DLC300 camera in a thread of its own.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef CAPTURETHREAD_H_
+#define CAPTURETHREAD_H_
+
+#include "DLC300.h"
+#include "FramePool.h"
+#include "SpscQueue.h"
+
+#include <atomic>
+#include <thread>
+
+class AsyncCapture;
+
+
+/**
+ * Keeps the camera busy in a separate thread, and hands finished frames to one consumer
+ * through a bounded SpscQueue, so slow drawing or snapshot saving never delays the next frame.
+ *
+ * Frames are taken from a FramePool, and go back to it when the consumer (and whoever else
+ * it shared the frame with) drops the last FrameRef to it.
+ */
+class CaptureThread {
+public:
+	/**
+	 * @param async When not NULL, frames are captured through this (already started) AsyncCapture
+	 *              instead of the blocking DLC300::getFrame()
+	 * @param queueDepth Number of finished frames which may wait for the consumer
+	 * @param policy What to do when the consumer falls behind (see SpscQueue)
+	 */
+	CaptureThread(DLC300& cam, AsyncCapture* async, FramePool& pool, int queueDepth,
+			SpscQueue<Frame*>::OverflowPolicy policy);
+	~CaptureThread();
+
+	/**
+	 * FrameView::PLANAR makes the capture thread split each frame into color planes, right
+	 * after it arrived (while it is still in the cache), into a second frame from the pool.
+	 * Everything reading frames then gets contiguous planes to work on. Call before start().
+	 */
+	void setLayout(FrameView::Layout layout) { layout_ = layout; }
+
+	void start();
+	void stop();
+
+	/**
+	 * Waits for the oldest captured frame not yet consumed.
+	 * @return an empty handle on timeout
+	 */
+	FrameRef getFrame(int timeout_ms);
+
+	int getQueueDepth() { return filled_.size(); }
+	unsigned long getDroppedFrames() { return filled_.getDropCount(); }
+	unsigned long getCapturedFrames() { return captured_; }
+	unsigned long getFailedFrames() { return failed_; }
+
+private:
+	DLC300& cam_;
+	AsyncCapture* async_;
+	FramePool& pool_;
+	FrameView::Layout layout_;
+
+	SpscQueue<Frame*> filled_; ///< Captured frames waiting for the consumer. Each holds one reference.
+
+	std::thread thread_;
+	std::atomic<bool> should_run_;
+
+	std::atomic<unsigned long> captured_;
+	std::atomic<unsigned long> failed_;
+
+	void run();
+	FrameRef captureFrame();
+	FrameRef toPlanar(const FrameRef& frame);
+	void drainQueue();
+
+	CaptureThread(const CaptureThread&);
+	CaptureThread& operator=(const CaptureThread&);
+};
+
+
+#endif /* CAPTURETHREAD_H_ */
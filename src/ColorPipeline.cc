@@ -0,0 +1,568 @@
+/**
+ * Color processing of converted frames: digital gain, color correction matrix and gamma.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "ColorPipeline.h"
+#include "CpuFeatures.h"
+#include "SimdHelpers.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+
+template <class T>
+static T coerce(const T& value, const T& min, const T& max)
+{
+	return value < min ? min : value > max ? max : value;
+}
+
+
+ColorPipeline::ColorPipeline() :
+	gamma_(1.0),
+	is_dirty_(true),
+	is_identity_(true),
+	is_diagonal_(true)
+{
+	static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+	for (int c = 0; c < 3; c++)
+	{
+		gains_[c] = 1.0;
+	}
+
+	memcpy(matrix_, identity, sizeof(matrix_));
+}
+
+
+void ColorPipeline::setDigitalGains(double red, double green, double blue)
+{
+	gains_[0] = red;
+	gains_[1] = green;
+	gains_[2] = blue;
+	is_dirty_ = true;
+}
+
+
+void ColorPipeline::setColorMatrix(const double matrix[9])
+{
+	memcpy(matrix_, matrix, sizeof(matrix_));
+	is_dirty_ = true;
+}
+
+
+void ColorPipeline::setGamma(double gamma)
+{
+	gamma_ = gamma;
+	is_dirty_ = true;
+}
+
+
+bool ColorPipeline::isIdentity()
+{
+	prepare();
+	return is_identity_;
+}
+
+
+void ColorPipeline::prepare()
+{
+	if (!is_dirty_)
+	{
+		return;
+	}
+
+	is_dirty_ = false;
+
+	// The color correction matrix with the digital gains folded in
+	double m[3][3];
+
+	is_diagonal_ = true;
+
+	for (int out = 0; out < 3; out++)
+	{
+		for (int in = 0; in < 3; in++)
+		{
+			m[out][in] = matrix_[3*out + in] * gains_[in];
+
+			if (out != in && m[out][in] != 0)
+			{
+				is_diagonal_ = false;
+			}
+		}
+	}
+
+	for (int v = 0; v <= LINEAR_MAX; v++)
+	{
+		double linear = std::min(double(v) / LINEAR_ONE, 1.0);
+		tone_lut_[v] = lround(255 * pow(linear, 1.0 / gamma_));
+	}
+
+	for (int out = 0; out < 3; out++)
+	{
+		for (int v = 0; v < 256; v++)
+		{
+			double linear = m[out][out] * v * LINEAR_ONE / 255;
+			channel_lut_[out][v] = tone_lut_[lround(coerce(linear, 0.0, double(LINEAR_MAX)))];
+		}
+	}
+
+	// As many fraction bits as the largest coefficient leaves room for in 16 bits. Beyond a gain
+	// of 512 (with no fraction bits left) the coefficients are capped, as everything clips anyway.
+	double largest = 0;
+
+	for (int out = 0; out < 3; out++)
+	{
+		for (int in = 0; in < 3; in++)
+		{
+			largest = std::max(largest, fabs(m[out][in]) * LINEAR_ONE / 255);
+		}
+	}
+
+	coefficient_shift_ = MAX_COEFFICIENT_SHIFT;
+
+	while (coefficient_shift_ > 0 && largest * (1 << coefficient_shift_) > INT16_MAX)
+	{
+		coefficient_shift_--;
+	}
+
+	for (int out = 0; out < 3; out++)
+	{
+		for (int in = 0; in < 3; in++)
+		{
+			double k = m[out][in] * LINEAR_ONE / 255 * (1 << coefficient_shift_);
+			coefficients_[out][in] = lround(coerce<double>(k, -INT16_MAX, INT16_MAX));
+		}
+
+		coefficients_[out][3] = coefficient_shift_ ? 1 << (coefficient_shift_ - 1) : 0;
+	}
+
+	is_identity_ = is_diagonal_;
+
+	for (int c = 0; c < 3 && is_identity_; c++)
+	{
+		for (int v = 0; v < 256 && is_identity_; v++)
+		{
+			is_identity_ = channel_lut_[c][v] == v;
+		}
+	}
+}
+
+
+//
+// Matrix kernels. Each output channel c of a pixel is
+//
+//   tone[clamp((k[c][0]*r + k[c][1]*g + k[c][2]*b + k[c][3]) >> shift, 0, LINEAR_MAX)]
+//
+// with k and shift as in ColorPipeline::coefficients_ and coefficient_shift_. Every version computes
+// exactly that, so they all give the same output. The SIMD versions compute the linear values of a
+// group of pixels with _mm_madd_epi16(), which multiplies pairs of 16 bit values and adds each pair,
+// so the pixels go in as (red, green) and (blue, 1) pairs, the latter picking up the rounding.
+//
+// Each kernel processes the pixels [x, end) of a row.
+//
+
+typedef ImageKernels::PixelFormat32 PixelFormat32;
+
+
+static inline uint8_t applyMatrix(const int16_t* k, int shift, const uint8_t* tone, int r, int g, int b)
+{
+	int linear = (k[0]*r + k[1]*g + k[2]*b + k[3]) >> shift;
+	return tone[coerce<int>(linear, 0, ColorPipeline::LINEAR_MAX)];
+}
+
+
+static void matrixRGB24_generic(const int16_t (*k)[4], int shift, const uint8_t* tone, uint8_t* rgb, int x, int end)
+{
+	for (uint8_t* p = rgb + 3*x; x < end; x++, p += 3)
+	{
+		int r = p[0];
+		int g = p[1];
+		int b = p[2];
+
+		for (int c = 0; c < 3; c++)
+		{
+			p[c] = applyMatrix(k[c], shift, tone, r, g, b);
+		}
+	}
+}
+
+
+static void matrixRGB32_generic(const int16_t (*k)[4], int shift, const uint8_t* tone, uint32_t* pixels, int x, int end,
+		const PixelFormat32& f)
+{
+	// Copies, as the compiler can not tell that storing the pixels leaves f alone
+	const int r_shift = f.r_shift;
+	const int g_shift = f.g_shift;
+	const int b_shift = f.b_shift;
+
+	const uint32_t keep = ~((0xFFu << r_shift) | (0xFFu << g_shift) | (0xFFu << b_shift));
+
+	for (; x < end; x++)
+	{
+		uint32_t p = pixels[x];
+
+		int r = (p >> r_shift) & 0xFF;
+		int g = (p >> g_shift) & 0xFF;
+		int b = (p >> b_shift) & 0xFF;
+
+		pixels[x] = (p & keep) |
+				(uint32_t(applyMatrix(k[0], shift, tone, r, g, b)) << r_shift) |
+				(uint32_t(applyMatrix(k[1], shift, tone, r, g, b)) << g_shift) |
+				(uint32_t(applyMatrix(k[2], shift, tone, r, g, b)) << b_shift);
+	}
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/** The coefficients and bit positions, broadcast for the SSE2 kernels */
+struct Matrix_sse2 {
+	__m128i k_rg[3]; ///< k[c][0] | k[c][1] << 16 in each 32 bit lane
+	__m128i k_b1[3]; ///< k[c][2] | k[c][3] << 16 in each 32 bit lane
+	__m128i shift;
+	__m128i channel_shifts[3]; ///< Of red, green and blue in a 32 bit pixel
+
+	Matrix_sse2(const int16_t (*k)[4], int shift, int r_shift, int g_shift, int b_shift)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int32_t pair[2];
+			memcpy(pair, k[c], sizeof(pair));
+			k_rg[c] = _mm_set1_epi32(pair[0]);
+			k_b1[c] = _mm_set1_epi32(pair[1]);
+		}
+
+		this->shift = _mm_cvtsi32_si128(shift);
+		channel_shifts[0] = _mm_cvtsi32_si128(r_shift);
+		channel_shifts[1] = _mm_cvtsi32_si128(g_shift);
+		channel_shifts[2] = _mm_cvtsi32_si128(b_shift);
+	}
+
+	/**
+	 * Linear values of 8 pixels, 32 bits each with the channels where channel_shifts says.
+	 * @param linear Set to the values of each output channel, clamped to [0, LINEAR_MAX]
+	 */
+	void apply(__m128i p0, __m128i p1, int16_t (*linear)[8]) const
+	{
+		__m128i rg0, b10, rg1, b11;
+		toPairs(p0, rg0, b10);
+		toPairs(p1, rg1, b11);
+
+		for (int c = 0; c < 3; c++)
+		{
+			__m128i lo = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(rg0, k_rg[c]), _mm_madd_epi16(b10, k_b1[c])), shift);
+			__m128i hi = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(rg1, k_rg[c]), _mm_madd_epi16(b11, k_b1[c])), shift);
+
+			// Saturating to 16 bits first does not change what clamps to LINEAR_MAX
+			__m128i v = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128()),
+					_mm_set1_epi16(ColorPipeline::LINEAR_MAX));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(linear[c]), v);
+		}
+	}
+
+	void toPairs(__m128i p, __m128i& rg, __m128i& b1) const
+	{
+		const __m128i low_byte = _mm_set1_epi32(0xFF);
+
+		__m128i r = _mm_and_si128(_mm_srl_epi32(p, channel_shifts[0]), low_byte);
+		__m128i g = _mm_and_si128(_mm_srl_epi32(p, channel_shifts[1]), low_byte);
+		__m128i b = _mm_and_si128(_mm_srl_epi32(p, channel_shifts[2]), low_byte);
+
+		rg = _mm_or_si128(r, _mm_slli_epi32(g, 16));
+		b1 = _mm_or_si128(b, _mm_set1_epi32(1 << 16));
+	}
+};
+
+
+/** 4 pixels of packed RGB (12 bytes at p) into 32 bit lanes of 0x00BBGGRR */
+static inline __m128i loadRGB24_sse2(const uint8_t* p)
+{
+	__m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), load32_sse2(p + 8));
+
+	// Move the upper 6 bytes to the upper 64 bit half (the opposite of compactRGB24_sse2())...
+	const __m128i low_6_bytes = _mm_set_epi32(0, 0, 0x0000FFFF, 0xFFFFFFFF);
+	__m128i u = _mm_or_si128(_mm_and_si128(v, low_6_bytes), _mm_andnot_si128(low_6_bytes, _mm_slli_si128(v, 2)));
+
+	// ...and pixel 1 and 3 up by one byte, within each half
+	const __m128i even_pixels = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+	const __m128i odd_pixels = _mm_set_epi32(0x00FFFFFF, 0, 0x00FFFFFF, 0);
+	return _mm_or_si128(_mm_and_si128(u, even_pixels), _mm_and_si128(_mm_slli_epi64(u, 8), odd_pixels));
+}
+
+
+/** Same as matrixRGB24_generic(), 8 pixels per iteration */
+static void matrixRGB24_sse2(const int16_t (*k)[4], int shift, const uint8_t* tone, uint8_t* rgb, int x, int end)
+{
+	const Matrix_sse2 m(k, shift, 0, 8, 16);
+	int16_t linear[3][8];
+
+	for (; x + 8 <= end; x += 8)
+	{
+		uint8_t* p = rgb + 3*x;
+
+		m.apply(loadRGB24_sse2(p), loadRGB24_sse2(p + 12), linear);
+
+		for (int i = 0; i < 8; i++, p += 3)
+		{
+			p[0] = tone[linear[0][i]];
+			p[1] = tone[linear[1][i]];
+			p[2] = tone[linear[2][i]];
+		}
+	}
+
+	matrixRGB24_generic(k, shift, tone, rgb, x, end);
+}
+
+
+/** Same as matrixRGB32_generic(), 8 pixels per iteration */
+static void matrixRGB32_sse2(const int16_t (*k)[4], int shift, const uint8_t* tone, uint32_t* pixels, int x, int end,
+		const PixelFormat32& f)
+{
+	const int r_shift = f.r_shift;
+	const int g_shift = f.g_shift;
+	const int b_shift = f.b_shift;
+
+	const Matrix_sse2 m(k, shift, r_shift, g_shift, b_shift);
+	const uint32_t keep = ~((0xFFu << r_shift) | (0xFFu << g_shift) | (0xFFu << b_shift));
+	int16_t linear[3][8];
+
+	for (; x + 8 <= end; x += 8)
+	{
+		uint32_t* p = pixels + x;
+
+		m.apply(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4)), linear);
+
+		for (int i = 0; i < 8; i++)
+		{
+			p[i] = (p[i] & keep) |
+					(uint32_t(tone[linear[0][i]]) << r_shift) |
+					(uint32_t(tone[linear[1][i]]) << g_shift) |
+					(uint32_t(tone[linear[2][i]]) << b_shift);
+		}
+	}
+
+	matrixRGB32_generic(k, shift, tone, pixels, x, end, f);
+}
+
+
+/** Same as Matrix_sse2, for 16 pixels at a time */
+struct Matrix_avx2 {
+	__m256i k_rg[3];
+	__m256i k_b1[3];
+	__m128i shift;
+	__m128i channel_shifts[3];
+
+	__attribute__((target("avx2")))
+	Matrix_avx2(const int16_t (*k)[4], int shift, int r_shift, int g_shift, int b_shift)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int32_t pair[2];
+			memcpy(pair, k[c], sizeof(pair));
+			k_rg[c] = _mm256_set1_epi32(pair[0]);
+			k_b1[c] = _mm256_set1_epi32(pair[1]);
+		}
+
+		this->shift = _mm_cvtsi32_si128(shift);
+		channel_shifts[0] = _mm_cvtsi32_si128(r_shift);
+		channel_shifts[1] = _mm_cvtsi32_si128(g_shift);
+		channel_shifts[2] = _mm_cvtsi32_si128(b_shift);
+	}
+
+	__attribute__((target("avx2")))
+	void apply(__m256i p0, __m256i p1, int16_t (*linear)[16]) const
+	{
+		__m256i rg0, b10, rg1, b11;
+		toPairs(p0, rg0, b10);
+		toPairs(p1, rg1, b11);
+
+		for (int c = 0; c < 3; c++)
+		{
+			__m256i lo = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg0, k_rg[c]), _mm256_madd_epi16(b10, k_b1[c])), shift);
+			__m256i hi = _mm256_sra_epi32(_mm256_add_epi32(_mm256_madd_epi16(rg1, k_rg[c]), _mm256_madd_epi16(b11, k_b1[c])), shift);
+
+			// _mm256_packs_epi32() packs within each 128 bit lane, the permute puts the pixels back in order
+			__m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+			v = _mm256_min_epi16(_mm256_max_epi16(v, _mm256_setzero_si256()), _mm256_set1_epi16(ColorPipeline::LINEAR_MAX));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(linear[c]), v);
+		}
+	}
+
+	__attribute__((target("avx2")))
+	void toPairs(__m256i p, __m256i& rg, __m256i& b1) const
+	{
+		const __m256i low_byte = _mm256_set1_epi32(0xFF);
+
+		__m256i r = _mm256_and_si256(_mm256_srl_epi32(p, channel_shifts[0]), low_byte);
+		__m256i g = _mm256_and_si256(_mm256_srl_epi32(p, channel_shifts[1]), low_byte);
+		__m256i b = _mm256_and_si256(_mm256_srl_epi32(p, channel_shifts[2]), low_byte);
+
+		rg = _mm256_or_si256(r, _mm256_slli_epi32(g, 16));
+		b1 = _mm256_or_si256(b, _mm256_set1_epi32(1 << 16));
+	}
+};
+
+
+/** 8 pixels of packed RGB (24 bytes at p) into 32 bit lanes of 0x00BBGGRR */
+__attribute__((target("avx2")))
+static inline __m256i loadRGB24_avx2(const uint8_t* p)
+{
+	// Bytes 0-15 in the low lane and 8-23 in the high lane, so neither load reads past the 24 bytes
+	__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), 1);
+
+	const __m256i expand = _mm256_setr_epi8(
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15, -1);
+
+	return _mm256_shuffle_epi8(v, expand);
+}
+
+
+/** Same as matrixRGB24_generic(), 16 pixels per iteration */
+__attribute__((target("avx2")))
+static void matrixRGB24_avx2(const int16_t (*k)[4], int shift, const uint8_t* tone, uint8_t* rgb, int x, int end)
+{
+	const Matrix_avx2 m(k, shift, 0, 8, 16);
+	int16_t linear[3][16];
+
+	for (; x + 16 <= end; x += 16)
+	{
+		uint8_t* p = rgb + 3*x;
+
+		m.apply(loadRGB24_avx2(p), loadRGB24_avx2(p + 24), linear);
+
+		for (int i = 0; i < 16; i++, p += 3)
+		{
+			p[0] = tone[linear[0][i]];
+			p[1] = tone[linear[1][i]];
+			p[2] = tone[linear[2][i]];
+		}
+	}
+
+	matrixRGB24_sse2(k, shift, tone, rgb, x, end);
+}
+
+
+/** Same as matrixRGB32_generic(), 16 pixels per iteration */
+__attribute__((target("avx2")))
+static void matrixRGB32_avx2(const int16_t (*k)[4], int shift, const uint8_t* tone, uint32_t* pixels, int x, int end,
+		const PixelFormat32& f)
+{
+	const int r_shift = f.r_shift;
+	const int g_shift = f.g_shift;
+	const int b_shift = f.b_shift;
+
+	const Matrix_avx2 m(k, shift, r_shift, g_shift, b_shift);
+	const uint32_t keep = ~((0xFFu << r_shift) | (0xFFu << g_shift) | (0xFFu << b_shift));
+	int16_t linear[3][16];
+
+	for (; x + 16 <= end; x += 16)
+	{
+		uint32_t* p = pixels + x;
+
+		m.apply(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 8)), linear);
+
+		for (int i = 0; i < 16; i++)
+		{
+			p[i] = (p[i] & keep) |
+					(uint32_t(tone[linear[0][i]]) << r_shift) |
+					(uint32_t(tone[linear[1][i]]) << g_shift) |
+					(uint32_t(tone[linear[2][i]]) << b_shift);
+		}
+	}
+
+	matrixRGB32_sse2(k, shift, tone, pixels, x, end, f);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+/** The kernels of one instruction set */
+struct Kernels {
+	const char* name;
+	void (*matrixRGB24)(const int16_t (*k)[4], int shift, const uint8_t* tone, uint8_t* rgb, int x, int end);
+	void (*matrixRGB32)(const int16_t (*k)[4], int shift, const uint8_t* tone, uint32_t* pixels, int x, int end,
+			const PixelFormat32& f);
+};
+
+
+static Kernels selectKernels()
+{
+#ifdef HAVE_X86_KERNELS
+	const CpuFeatures::Level level = CpuFeatures::getLevel();
+
+	// No AVX-512 kernels: the tone lookups, which stay scalar, take most of the time already with AVX2
+	if (level >= CpuFeatures::AVX2)
+	{
+		Kernels avx2 = { "avx2", matrixRGB24_avx2, matrixRGB32_avx2 };
+		return avx2;
+	}
+
+	if (level >= CpuFeatures::SSE2)
+	{
+		Kernels sse2 = { "sse2", matrixRGB24_sse2, matrixRGB32_sse2 };
+		return sse2;
+	}
+#endif
+
+	Kernels scalar = { "scalar", matrixRGB24_generic, matrixRGB32_generic };
+	return scalar;
+}
+
+
+static const Kernels kernels = selectKernels();
+
+
+void ColorPipeline::applyRGB24(uint8_t* rgb, int pixels) const
+{
+	if (is_diagonal_)
+	{
+		// The same lookup for every byte, just with the table depending on its position
+		for (int i = 0; i < pixels; i++, rgb += 3)
+		{
+			rgb[0] = channel_lut_[0][rgb[0]];
+			rgb[1] = channel_lut_[1][rgb[1]];
+			rgb[2] = channel_lut_[2][rgb[2]];
+		}
+		return;
+	}
+
+	kernels.matrixRGB24(coefficients_, coefficient_shift_, tone_lut_, rgb, 0, pixels);
+}
+
+
+void ColorPipeline::applyRGB32(uint32_t* pixels, int count, const ImageKernels::PixelFormat32& f) const
+{
+	if (is_diagonal_)
+	{
+		const int r_shift = f.r_shift;
+		const int g_shift = f.g_shift;
+		const int b_shift = f.b_shift;
+
+		const uint32_t keep = ~((0xFFu << r_shift) | (0xFFu << g_shift) | (0xFFu << b_shift));
+
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t p = pixels[i];
+
+			pixels[i] = (p & keep) |
+					(uint32_t(channel_lut_[0][uint8_t(p >> r_shift)]) << r_shift) |
+					(uint32_t(channel_lut_[1][uint8_t(p >> g_shift)]) << g_shift) |
+					(uint32_t(channel_lut_[2][uint8_t(p >> b_shift)]) << b_shift);
+		}
+		return;
+	}
+
+	kernels.matrixRGB32(coefficients_, coefficient_shift_, tone_lut_, pixels, 0, count, f);
+}
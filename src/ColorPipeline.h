@@ -0,0 +1,93 @@
+/**
+ * Color processing of converted frames: digital gain, color correction matrix and gamma.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef COLORPIPELINE_H_
+#define COLORPIPELINE_H_
+
+#include <stdint.h>
+
+#include "ImageKernels.h"
+
+
+/**
+ * Turns raw sensor RGB into something nicer to look at:
+ *
+ *   out = tone(M * (gain * in))
+ *
+ * where gain is a per channel digital gain (on top of the camera's analog gains), M a 3x3 color
+ * correction matrix, and tone a gamma curve. The parameters are compiled into lookup tables the
+ * first time they are used after a change, and the conversions (ImageKernels, Demosaic) apply
+ * them to each row right after producing it, while the row is still in the cache. The matrix is
+ * applied in 16 bit fixed point, several pixels at a time (with SSE2 or AVX2, see CpuFeatures),
+ * and only the tone curve is looked up pixel by pixel.
+ *
+ * With the default parameters the pipeline does nothing, and the conversions skip it.
+ *
+ * @note Not thread safe. Change parameters from the thread running the conversions.
+ */
+class ColorPipeline {
+public:
+	/**
+	 * 1.0 in the linear domain between the matrix and the tone curve. 14 bits, since a gamma
+	 * curve is steep near black and anything coarser shows up as steps in the shadows.
+	 */
+	enum { LINEAR_ONE = 255*64, LINEAR_MAX = (1 << 14) - 1 };
+
+	ColorPipeline();
+
+	void setDigitalGains(double red, double green, double blue);
+
+	/** Row major, applied to column vectors (R, G, B) */
+	void setColorMatrix(const double matrix[9]);
+
+	/** Display gamma, i.e. out = in^(1/gamma). 1 leaves the values linear. */
+	void setGamma(double gamma);
+
+	/** @return true if the current parameters leave every value unchanged */
+	bool isIdentity();
+
+	/** Rebuilds the tables, if the parameters changed since the last time */
+	void prepare();
+
+	//
+	// Only valid after prepare(), and safe to call from several threads at once
+	//
+
+	/** Processes pixels of packed RGB (3 bytes each), in place */
+	void applyRGB24(uint8_t* rgb, int pixels) const;
+
+	/** Processes 32 bit pixels laid out as format says, in place */
+	void applyRGB32(uint32_t* pixels, int count, const ImageKernels::PixelFormat32& format) const;
+
+private:
+	double gains_[3];
+	double matrix_[9];
+	double gamma_;
+
+	bool is_dirty_;
+	bool is_identity_;
+	bool is_diagonal_; ///< M * diag(gain) has no cross terms, so each channel is one table lookup
+
+	/** The coefficients are scaled by up to 2^MAX_COEFFICIENT_SHIFT, as far as they fit in 16 bits */
+	enum { MAX_COEFFICIENT_SHIFT = 8 };
+
+	uint8_t channel_lut_[3][256]; ///< Whole pipeline per channel, when is_diagonal_
+
+	/**
+	 * M * diag(gain) in the linear domain, scaled by 2^coefficient_shift_. For each output channel
+	 * the coefficients of red, green and blue, and the rounding (which multiplies 1).
+	 */
+	int16_t coefficients_[3][4];
+	int coefficient_shift_;
+
+	uint8_t tone_lut_[LINEAR_MAX + 1];
+};
+
+
+#endif /* COLORPIPELINE_H_ */
@@ -0,0 +1,107 @@
+/**
+ * Which instruction sets the image kernels may use.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "CpuFeatures.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+namespace CpuFeatures {
+
+
+const char* const OVERRIDE_VARIABLE = "DLC300_KERNELS";
+
+
+static const char* const LEVEL_NAMES[NUM_LEVELS] = { "scalar", "sse2", "avx2", "avx512" };
+
+
+Level detectLevel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	// Also checks that the operating system saves the wider registers
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+	{
+		return AVX512;
+	}
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return AVX2;
+	}
+
+	if (__builtin_cpu_supports("sse2"))
+	{
+		return SSE2;
+	}
+#endif
+
+	return SCALAR;
+}
+
+
+static Level chooseLevel()
+{
+	Level detected = detectLevel();
+
+	const char* name = getenv(OVERRIDE_VARIABLE);
+
+	if (!name || !*name)
+	{
+		return detected;
+	}
+
+	Level requested;
+
+	if (!parseLevel(name, requested))
+	{
+		printf("Unknown %s=%s (expected scalar, sse2, avx2 or avx512), using %s\n", OVERRIDE_VARIABLE, name,
+				getLevelName(detected));
+		return detected;
+	}
+
+	if (requested > detected)
+	{
+		printf("%s=%s is not supported by this CPU, using %s\n", OVERRIDE_VARIABLE, name, getLevelName(detected));
+		return detected;
+	}
+
+	return requested;
+}
+
+
+Level getLevel()
+{
+	static const Level level = chooseLevel();
+	return level;
+}
+
+
+const char* getLevelName(Level level)
+{
+	return level >= 0 && level < NUM_LEVELS ? LEVEL_NAMES[level] : "unknown";
+}
+
+
+bool parseLevel(const std::string& name, Level& level)
+{
+	for (int i = 0; i < NUM_LEVELS; i++)
+	{
+		if (name == LEVEL_NAMES[i])
+		{
+			level = Level(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+} // CpuFeatures
@@ -0,0 +1,57 @@
+/**
+ * Which instruction sets the image kernels may use.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef CPUFEATURES_H_
+#define CPUFEATURES_H_
+
+#include <string>
+
+
+/**
+ * The program is built for the baseline of its architecture, so it runs on any machine, and
+ * each kernel module (ImageKernels, Demosaic, FrameStatistics, SummedAreaTable, ColorPipeline)
+ * also has versions for newer instruction sets. All of them pick the versions for the level found here.
+ * A module without kernels for a level uses those of the next lower level it has.
+ */
+namespace CpuFeatures {
+
+
+/** In increasing order, each level including everything below it */
+enum Level {
+	SCALAR, ///< Portable C++, whatever the compiler makes of it
+	SSE2,
+	AVX2,
+	AVX512, ///< AVX-512 F and BW
+	NUM_LEVELS
+};
+
+
+/** Name of the environment variable which limits the level, e.g. DLC300_KERNELS=sse2 */
+extern const char* const OVERRIDE_VARIABLE;
+
+/**
+ * @return the level the kernels use: the best one the CPU (and operating system) supports,
+ *         or the level named by OVERRIDE_VARIABLE if that is lower. Decided at the first call.
+ */
+Level getLevel();
+
+/** @return the best level the CPU supports, ignoring OVERRIDE_VARIABLE */
+Level detectLevel();
+
+/** @return "scalar", "sse2", "avx2" or "avx512" */
+const char* getLevelName(Level level);
+
+/** @return false if name is not one of those getLevelName() returns */
+bool parseLevel(const std::string& name, Level& level);
+
+
+} // CpuFeatures
+
+
+#endif /* CPUFEATURES_H_ */
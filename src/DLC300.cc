@@ -11,8 +11,12 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
-#include <unistd.h> //for sleep
-#include <stdlib.h> //for exit
+
+#include <algorithm>
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000102)
+#define HAVE_LIBUSB_HOTPLUG
+#endif
 
 /*
  * These 15 registers are sent from the bridge chip to the image sensor for each frame we capture.
@@ -242,22 +246,156 @@ struct DlcMsgStruct
 
 
 /**
- * Opens a device with a VID:PID matching our camera
+ * @return bus number and port path of dev, such as "8-2.1.3"
+ */
+std::string DLC300::getLocation(libusb_device* dev)
+{
+	uint8_t ports[8];
+	int num_ports = libusb_get_port_numbers(dev, ports, sizeof(ports));
+
+	char location[64];
+	int pos = snprintf(location, sizeof(location), "%d", int(libusb_get_bus_number(dev)));
+
+	for (int i = 0; i < num_ports; i++)
+	{
+		pos += snprintf(location + pos, sizeof(location) - pos, "%c%d", i == 0 ? '-' : '.', int(ports[i]));
+	}
+
+	return location;
+}
+
+
+static std::string readSerial(libusb_device_handle* devh, const libusb_device_descriptor& desc)
+{
+	unsigned char serial[128] = { 0 };
+
+	if (desc.iSerialNumber == 0 ||
+			libusb_get_string_descriptor_ascii(devh, desc.iSerialNumber, serial, sizeof(serial)) < 0)
+	{
+		return "";
+	}
+
+	return reinterpret_cast<char*>(serial);
+}
+
+
+static bool isCamera(libusb_device* dev, libusb_device_descriptor& desc)
+{
+	return libusb_get_device_descriptor(dev, &desc) == 0 &&
+			desc.idVendor == DLC300::VID && desc.idProduct == DLC300::PID;
+}
+
+
+std::vector<DLC300::DeviceInfo> DLC300::listDevices()
+{
+	std::vector<DeviceInfo> devices;
+
+	libusb_context* ctx;
+
+	if (libusb_init(&ctx) < 0)
+	{
+		printf("Could not initialize libusb!\n");
+		return devices;
+	}
+
+	libusb_device** list;
+	ssize_t num_devices = libusb_get_device_list(ctx, &list);
+
+	for (ssize_t i = 0; i < num_devices; i++)
+	{
+		libusb_device_descriptor desc;
+
+		if (!isCamera(list[i], desc))
+		{
+			continue;
+		}
+
+		DeviceInfo info;
+		info.bus = libusb_get_bus_number(list[i]);
+		info.location = getLocation(list[i]);
+
+		libusb_device_handle* devh;
+
+		if (libusb_open(list[i], &devh) == 0)
+		{
+			info.serial = readSerial(devh, desc);
+			libusb_close(devh);
+		}
+
+		devices.push_back(info);
+	}
+
+	if (num_devices >= 0)
+	{
+		libusb_free_device_list(list, 1);
+	}
+
+	libusb_exit(ctx);
+
+	return devices;
+}
+
+
+/**
+ * Opens the device with a VID:PID matching our camera, which also matches selector_ (if set)
  */
 int DLC300::openDevice()
 {
-	devh_ = libusb_open_device_with_vid_pid(NULL, VID, PID);
+	libusb_device** list;
+	ssize_t num_devices = libusb_get_device_list(ctx_, &list);
+	bool selected_is_busy = false;
 
-	if (!devh_) {
-		printf("libusb_open_device_with_vid_pid failed\n");
-		return -1;
+	for (ssize_t i = 0; i < num_devices && !devh_ && !selected_is_busy; i++)
+	{
+		libusb_device_descriptor desc;
+
+		if (!isCamera(list[i], desc))
+		{
+			continue;
+		}
+
+		bool location_matches = selector_.empty() || getLocation(list[i]) == selector_;
+
+		if (libusb_open(list[i], &devh_) != 0)
+		{
+			devh_ = 0;
+			continue;
+		}
+
+		if (!location_matches && readSerial(devh_, desc) != selector_)
+		{
+			libusb_close(devh_);
+			devh_ = 0;
+			continue;
+		}
+
+		// Probably used by another process. Try the next camera (unless asked for this one).
+		if (libusb_claim_interface(devh_, 0) < 0)
+		{
+			printf("usb_claim_interface error (%s)\n", getLocation(list[i]).c_str());
+			libusb_close(devh_);
+			devh_ = 0;
+			selected_is_busy = !selector_.empty();
+			continue;
+		}
+
+		device_ = list[i];
 	}
 
-	if (libusb_claim_interface(devh_, 0) < 0)
+	if (num_devices >= 0)
 	{
-		printf("usb_claim_interface error\n");
-		libusb_close(devh_);
-		devh_ = 0;
+		libusb_free_device_list(list, 1);
+	}
+
+	if (!devh_)
+	{
+		if (selected_is_busy) {
+			printf("DLC300 camera %s is in use (by another process?)\n", selector_.c_str());
+		} else if (selector_.empty()) {
+			printf("No usable DLC300 camera found\n");
+		} else {
+			printf("No usable DLC300 camera %s found\n", selector_.c_str());
+		}
 		return -1;
 	}
 
@@ -268,13 +406,43 @@ void DLC300::closeDevice()
 {
 	if (devh_)
 	{
+		device_ = 0;
 		libusb_release_interface(devh_, 0);
-		libusb_close(devh_);
+
+		std::lock_guard<std::mutex> lock(device_memory_mutex_);
+
+		// Device memory is freed through the handle it came from, so that one stays open until then
+		if (countDeviceMemory(devh_) > 0)
+		{
+			retired_handles_.push_back(devh_);
+		}
+		else
+		{
+			libusb_close(devh_);
+		}
+
 		devh_ = 0;
 	}
 }
 
 
+/** @return number of buffers allocated from handle by allocateDeviceMemory(). Call with device_memory_mutex_ locked */
+int DLC300::countDeviceMemory(libusb_device_handle* handle)
+{
+	int count = 0;
+
+	for (std::map<unsigned char*, libusb_device_handle*>::iterator it = device_memory_.begin(); it != device_memory_.end(); ++it)
+	{
+		if (it->second == handle)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+
 int DLC300::getWidth()
 {
 	return w_;
@@ -287,44 +455,94 @@ int DLC300::getHeight()
 }
 
 
-int DLC300::setResolution(resolutionEnum res)
+int DLC300::getFrameSize()
 {
-	res_ = res;
+	//
+	// For unknown reasons, the 800x600 pixel mode had to be handled differently
+	// (the trailer arrives as part of the image data instead of as a separate packet)
+	//
+	if (applied_.resolution == RESOLUTION_800x600)
+	{
+		return w_*h_ + TRAILER_SIZE;
+	}
+
+	return w_*h_;
+}
 
+
+bool DLC300::hasTrailer()
+{
+	return applied_.resolution != RESOLUTION_800x600;
+}
+
+
+void DLC300::getDimensions(resolutionEnum res, int& w, int& h)
+{
 	switch(res)
 	{
 	case RESOLUTION_640x480:
-		w_ = 640;
-		h_ = 480;
+		w = 640;
+		h = 480;
 		break;
 	case RESOLUTION_800x600:
-		w_ = 800;
-		h_ = 600;
+		w = 800;
+		h = 600;
 		break;
 	case RESOLUTION_1024x768:
-		w_ = 1024;
-		h_ = 768;
+		w = 1024;
+		h = 768;
 		break;
 	case RESOLUTION_1280x1024:
-		w_ = 1280;
-		h_ = 1024;
+		w = 1280;
+		h = 1024;
 		break;
 	case RESOLUTION_1600x1200:
-		w_ = 1600;
-		h_ = 1200;
+		w = 1600;
+		h = 1200;
 		break;
 	case RESOLUTION_2048x1536:
-		w_ = 2048;
-		h_ = 1536;
+		w = 2048;
+		h = 1536;
 		break;
 	case RESOLUTION_UNDEFINED:
-		assert(0);
+		w = 0;
+		h = 0;
+		break;
 	}
+}
+
+
+DLC300::Parameters DLC300::getDefaultParameters()
+{
+	Parameters parameters;
+
+	memset(&parameters, 0, sizeof(parameters));
+	parameters.resolution = RESOLUTION_UNDEFINED;
+	parameters.exposure = 75;
+	parameters.red_gain = 0x2C;
+	parameters.green_gain = 0x2C;
+	parameters.blue_gain = 0x2C;
+
+	return parameters;
+}
+
+
+int DLC300::setResolution(resolutionEnum res)
+{
+	assert(res != RESOLUTION_UNDEFINED);
+
+	parameters_.update([res](Parameters& p) { p.resolution = res; });
 
 	return 0;
 }
 
 
+DLC300::resolutionEnum DLC300::getResolution()
+{
+	return getParameters().resolution;
+}
+
+
 /**
  * Sets camera exposure
  * @note valid range is 1 to 369
@@ -333,7 +551,7 @@ int DLC300::setExposure(int exposure)
 {
 	if (exposure > 0 && exposure < 370)
 	{
-		exposure_ = exposure;
+		parameters_.update([exposure](Parameters& p) { p.exposure = exposure; });
 		return 0;
 	} else {
 		return -1;
@@ -347,9 +565,11 @@ int DLC300::setExposure(int exposure)
  */
 void DLC300::setGains(int R, int G, int B)
 {
-	red_gain_ 	= R;
-	green_gain_	= G;
-	blue_gain_ 	= B;
+	parameters_.update([R, G, B](Parameters& p) {
+		p.red_gain 		= R;
+		p.green_gain	= G;
+		p.blue_gain 	= B;
+	});
 }
 
 /**
@@ -358,52 +578,168 @@ void DLC300::setGains(int R, int G, int B)
  */
 void DLC300::setOffsets(int8_t R, int8_t G, int8_t B)
 {
-	red_offset_		= R;
-	green_offset_	= G;
-	blue_offset_	= B;
+	parameters_.update([R, G, B](Parameters& p) {
+		p.red_offset	= R;
+		p.green_offset	= G;
+		p.blue_offset	= B;
+	});
+}
+
+
+/**
+ * Sets the top-left corner of the crop region used in resolutions below 2048x1536
+ * (unless the region is centered, see setShouldCenterLowResolution())
+ */
+void DLC300::setCropStart(int x, int y)
+{
+	parameters_.update([x, y](Parameters& p) {
+		p.crop_x = x;
+		p.crop_y = y;
+	});
+}
+
+
+void DLC300::setShouldCenterLowResolution(bool doCenter)
+{
+	parameters_.update([doCenter](Parameters& p) { p.center_low_resolution = doCenter; });
+}
+
+
+void DLC300::setParameters(const Parameters& parameters)
+{
+	parameters_.publish(parameters);
+}
+
+
+DLC300::Parameters DLC300::getParameters()
+{
+	Parameters parameters;
+	parameters_.read(parameters);
+	return parameters;
+}
+
+
+/**
+ * Makes the most recently set parameters take effect, rebuilding the header only if they changed.
+ *
+ * Called at frame boundaries by the thread capturing frames (getFrame() does it itself), so every
+ * transfer of a frame uses the same parameters, and nothing else touches the parameters in effect.
+ * @return true if the parameters changed
+ */
+bool DLC300::applyParameters()
+{
+	if (parameters_.getVersion() == applied_version_)
+	{
+		return false;
+	}
+
+	applied_version_ = parameters_.read(applied_);
+
+	getDimensions(applied_.resolution, w_, h_);
+
+	if (applied_.resolution != RESOLUTION_UNDEFINED)
+	{
+		buildHeader(applied_, header_);
+	}
+
+	return true;
 }
 
 
 bool DLC300::isPresent()
 {
-	return devh_ != 0;
+	return transport_->isPresent();
 }
 
-DLC300::DLC300() :
+DLC300::DLC300(const std::string& selector) :
+		ctx_(0),
 		devh_(0),
+		selector_(selector),
+		usb_transport_(*this),
+		transport_(&usb_transport_),
+		parameters_(getDefaultParameters()),
+		applied_(getDefaultParameters()),
+		applied_version_(~uint64_t(0)),
 		w_(0),
 		h_(0),
-		res_(RESOLUTION_UNDEFINED),
-		exposure_(75),
-		red_gain_(0x2C),
-		green_gain_(0x2C),
-		blue_gain_(0x2C),
-		red_offset_(0),
-		green_offset_(0),
-		blue_offset_(0),
-		should_center_low_resolution_(false),
-		debug_level_(1)
-{
-	int r = libusb_init(NULL);
+		sequence_(0),
+		debug_level_(1),
+		state_(STATE_STREAMING),
+		reopen_backoff_ms_(REOPEN_BACKOFF_MIN_MS),
+		has_hotplug_(false),
+		hotplug_handle_(0),
+		hotplug_should_run_(false),
+		listener_(0),
+		device_(0),
+		arrived_(false),
+		left_(false)
+{
+	memset(header_, 0, sizeof(header_));
+
+	int r = libusb_init(&ctx_);
 
 	if (r < 0)
 	{
+		ctx_ = 0;
 		printf("Could not initialize libusb!\n");
 	}
 	else
 	{
+		// Before opening, so a camera connected right after a failed attempt is not missed
+		startHotplug();
+
 		if (openDevice() < 0)
 		{
 			printf("Could not find and open a DLC300 camera\n");
+			state_ = STATE_DISCONNECTED;
 			return;
 		}
 	}
 }
 
+/**
+ * Uses transport for all transfers instead of opening a camera, e.g. to replay a recording.
+ */
+DLC300::DLC300(UsbTransport* transport) :
+		ctx_(0),
+		devh_(0),
+		usb_transport_(*this),
+		transport_(transport),
+		parameters_(getDefaultParameters()),
+		applied_(getDefaultParameters()),
+		applied_version_(~uint64_t(0)),
+		w_(0),
+		h_(0),
+		sequence_(0),
+		debug_level_(1),
+		state_(STATE_STREAMING),
+		reopen_backoff_ms_(REOPEN_BACKOFF_MIN_MS),
+		has_hotplug_(false),
+		hotplug_handle_(0),
+		hotplug_should_run_(false),
+		listener_(0),
+		device_(0),
+		arrived_(false),
+		left_(false)
+{
+	memset(header_, 0, sizeof(header_));
+}
+
 DLC300::~DLC300()
 {
+	stopHotplug();
 	closeDevice();
-	libusb_exit(NULL);
+
+	// Only left if device memory outlived the camera, which is then leaked
+	for (size_t i = 0; i < retired_handles_.size(); i++)
+	{
+		libusb_close(retired_handles_[i]);
+	}
+
+	if (ctx_)
+	{
+		libusb_exit(ctx_);
+	}
 }
 
 
@@ -471,17 +807,41 @@ void DLC300::read64(int warn_when_this_differ)
 
 
 
-int DLC300::sendHeader()
+/**
+ * Fills data with the header requesting one frame using the parameters in effect (see applyParameters()).
+ * @param length size of data. Must be at least HEADER_SIZE bytes.
+ * @return number of bytes written, or -1 if data is too small
+ */
+int DLC300::buildHeader(unsigned char* data, int length)
+{
+	if (length < int(sizeof(header_)))
+	{
+		return -1;
+	}
+
+	memcpy(data, header_, sizeof(header_));
+
+	return sizeof(header_);
+}
+
+
+/**
+ * Fills the HEADER_SIZE bytes at data with the header requesting one frame using parameters.
+ */
+void DLC300::buildHeader(const Parameters& parameters, unsigned char* data)
 {
 	DlcMsgStruct dlcMsg;
 
+	static_assert(sizeof(dlcMsg) == HEADER_SIZE, "DlcMsgStruct does not match the header size");
+
 	memset(&dlcMsg, 0, sizeof(dlcMsg));
 	dlcMsg.fillDefaults();
-	dlcMsg.setResolution(res_);
-	dlcMsg.setExposure(exposure_);
-	dlcMsg.setGains(red_gain_, green_gain_, blue_gain_);
+	dlcMsg.setResolution(parameters.resolution);
+	dlcMsg.setExposure(parameters.exposure);
+	dlcMsg.setGains(parameters.red_gain, parameters.green_gain, parameters.blue_gain);
+	dlcMsg.setOffsets(parameters.red_offset, parameters.green_offset, parameters.blue_offset);
 
-	if (should_center_low_resolution_)
+	if (parameters.center_low_resolution)
 	{
 		int full_w = 2048;
 		int full_h = 1536;
@@ -494,26 +854,62 @@ int DLC300::sendHeader()
 
 		dlcMsg.setCropStart(free_x/2, free_y/2);
 	}
-	
+	else
+	{
+		dlcMsg.setCropStart(parameters.crop_x, parameters.crop_y);
+	}
+
+	memcpy(data, &dlcMsg, sizeof(dlcMsg));
+}
+
+
+/**
+ * Fills in the camera settings of meta (resolution, crop, exposure, gains and offsets)
+ * from a HEADER_SIZE byte header, as built by buildHeader().
+ */
+void DLC300::describeHeader(const unsigned char* header, FrameMetadata& meta)
+{
+	DlcMsgStruct dlcMsg;
+
+	memcpy(&dlcMsg, header, sizeof(dlcMsg));
+
+	meta.width  = (dlcMsg.row_size_msb << 8) + dlcMsg.row_size_lsb;
+	meta.height = (dlcMsg.col_size_msb << 8) + dlcMsg.col_size_lsb;
+	meta.crop_x = (dlcMsg.col_start_msb << 8) + dlcMsg.col_start_lsb;
+	meta.crop_y = (dlcMsg.row_start_msb << 8) + dlcMsg.row_start_lsb;
+
+	meta.exposure = (dlcMsg.exposure_msb << 8) + dlcMsg.exposure_lsb;
+
+	meta.red_gain   = dlcMsg.red_gain;
+	meta.green_gain = dlcMsg.green_gain;
+	meta.blue_gain  = dlcMsg.blue_gain;
+
+	meta.red_offset   = dlcMsg.red_offset;
+	meta.green_offset = dlcMsg.green_offset;
+	meta.blue_offset  = dlcMsg.blue_offset;
+}
+
+
+int DLC300::sendHeader()
+{
 	int dummy;
 
-	return this->write((unsigned char*)&dlcMsg, sizeof(dlcMsg), dummy);
+	return this->write(header_, sizeof(header_), dummy);
 }
 
 int DLC300::write(unsigned char* data, int length, int& numTransfered)
 {
-	if (devh_ == 0)
+	if (!transport_->isPresent())
 	{
-		printf("No valid USB device handle!\n");
-		exit(1);
+		numTransfered = 0;
+		return LIBUSB_ERROR_NO_DEVICE;
 	}
 
-	const int endpoint = 2;
-	const int timeout = 4000; // ms
+	const int endpoint = ENDPOINT_OUT;
 
 	int transferred = 0;
 
-	int rc = libusb_bulk_transfer(devh_, endpoint, data, length, &transferred, timeout);
+	int rc = transport_->bulkTransfer(endpoint, data, length, transferred, TRANSFER_TIMEOUT_MS);
 
 	numTransfered = transferred;
 
@@ -526,14 +922,14 @@ int DLC300::write(unsigned char* data, int length, int& numTransfered)
 
 	if (rc!=0)
 	{
-		printf("Error 3: (%d)", rc);
-		return -1;
+		printf("Error 3: (%d)\n", rc);
+		return rc;
 	}
 
 	if (transferred != length)
 	{
-		printf("Error 4: (%d)", transferred);
-		return -1;
+		printf("Error 4: (%d)\n", transferred);
+		return LIBUSB_ERROR_IO;
 	}
 
 	return 0;
@@ -542,21 +938,22 @@ int DLC300::write(unsigned char* data, int length, int& numTransfered)
 /**
  * @param warn_when_this_differ Number of expected bytes in the transfer. When received length differ from this,
  *        print an error message. (you can set it to the default of -1 to decrease the amount of console output)
+ * @return 0 or a libusb error code (LIBUSB_ERROR_NO_DEVICE when there is no camera to read from)
  */
-int DLC300::read(unsigned char* data, int length, int& numTransfered, int warn_when_this_differ)
+int DLC300::read(unsigned char* data, int length, int& numTransfered, int warn_when_this_differ,
+		unsigned int timeout_ms)
 {
-	if (devh_ == 0)
+	if (!transport_->isPresent())
 	{
-		printf("No valid USB device handle!\n");
-		exit(1);
+		numTransfered = 0;
+		return LIBUSB_ERROR_NO_DEVICE;
 	}
 
-	const int endpoint = 0x86;
-	const int timeout = 4000; // ms
+	const int endpoint = ENDPOINT_IN;
 
 	int transferred = 0;
 
-	int rc = libusb_bulk_transfer(devh_, endpoint, data, length, &transferred, timeout);
+	int rc = transport_->bulkTransfer(endpoint, data, length, transferred, timeout_ms);
 
 	if (warn_when_this_differ == -1)
 		warn_when_this_differ = length;
@@ -580,54 +977,512 @@ int DLC300::read(unsigned char* data, int length, int& numTransfered, int warn_w
 	return rc;
 }
 
-int DLC300::restartDevice()
+/**
+ * Closes and opens the camera again. Attempts following a failed one are delayed by a backoff
+ * starting at REOPEN_BACKOFF_MIN_MS, doubling up to REOPEN_BACKOFF_MAX_MS. Calls made before the
+ * backoff has passed fail immediately.
+ * @return 0 if the camera is open again, or LIBUSB_ERROR_NO_DEVICE
+ */
+int DLC300::reopenDevice()
 {
-	printf("Trying to restart LIBUSB. closing\n");
+	// There is no device to reopen when replaying a recording
+	if (!ctx_)
+	{
+		state_ = STATE_DISCONNECTED;
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	// A camera reported by hotplug is tried right away
+	bool arrived = arrived_.exchange(false);
+
+	if (state_ == STATE_DISCONNECTED && now < next_reopen_ && !arrived)
+	{
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+
+	stats_.recordRestart();
+
+	if (debug_level_ > 0) {
+		printf("Reopening camera\n");
+	}
+
 	closeDevice();
-	sleep(1);
-	printf("opening\n");
-	return openDevice();
+	left_ = false;
+
+	if (openDevice() == 0)
+	{
+		state_ = STATE_STREAMING;
+		reopen_backoff_ms_ = REOPEN_BACKOFF_MIN_MS;
+
+		std::lock_guard<std::mutex> lock(device_memory_mutex_);
+		int stale = int(device_memory_.size()) - countDeviceMemory(devh_);
+
+		if (stale > 0)
+		{
+			printf("DLC300: %d frame buffers are device memory of the previous connection, so frames are copied into them again\n",
+					stale);
+		}
+
+		return 0;
+	}
+
+	state_ = STATE_DISCONNECTED;
+	next_reopen_ = now + std::chrono::milliseconds(reopen_backoff_ms_);
+	reopen_backoff_ms_ = std::min(2 * reopen_backoff_ms_, int(REOPEN_BACKOFF_MAX_MS));
+
+	return LIBUSB_ERROR_NO_DEVICE;
+}
+
+
+/**
+ * Opens the camera again after it was lost, for capture paths not using getFrame() (such as AsyncCapture).
+ * This happens right away if hotplug reported a camera being connected, otherwise subject to the
+ * same backoff as getFrame() uses.
+ * @return 0 if the camera is open again, or LIBUSB_ERROR_NO_DEVICE
+ */
+int DLC300::reconnect()
+{
+	if (state_ != STATE_DISCONNECTED)
+	{
+		state_ = STATE_REOPENING;
+	}
+
+	return reopenDevice();
+}
+
+
+/**
+ * Waits for the camera to be connected, e.g. when it was not plugged in when this object was
+ * created, and opens it. Only polls (once per REOPEN_BACKOFF_MAX_MS) if hotplug is not supported.
+ * Must not be called while another thread captures frames.
+ *
+ * @param timeout_ms Negative to wait forever
+ * @return true if the camera is present
+ */
+bool DLC300::waitUntilPresent(int timeout_ms)
+{
+	std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+	while (ctx_ && !isPresent())
+	{
+		std::chrono::steady_clock::time_point wake_up =
+				std::chrono::steady_clock::now() + std::chrono::milliseconds(REOPEN_BACKOFF_MAX_MS);
+
+		if (timeout_ms >= 0 && wake_up > deadline)
+		{
+			wake_up = deadline;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(hotplug_mutex_);
+
+			hotplug_arrival_.wait_until(lock, wake_up, [this]() { return arrived_.load(); });
+		}
+
+		if (arrived_ || !has_hotplug_)
+		{
+			state_ = STATE_REOPENING;
+			reopenDevice();
+		}
+
+		if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline)
+		{
+			break;
+		}
+	}
+
+	return isPresent();
+}
+
+
+/**
+ * Asks libusb to report cameras being connected and disconnected. The events are handled by a
+ * thread of our own (AsyncCapture handles events in the same context, which libusb allows).
+ */
+void DLC300::startHotplug()
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		return;
+	}
+
+	libusb_hotplug_callback_handle handle;
+
+	int rc = libusb_hotplug_register_callback(ctx_,
+			libusb_hotplug_event(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+			libusb_hotplug_flag(0), VID, PID, LIBUSB_HOTPLUG_MATCH_ANY, hotplugCallback, this, &handle);
+
+	if (rc != LIBUSB_SUCCESS)
+	{
+		printf("Could not register for hotplug events (%d)\n", rc);
+		return;
+	}
+
+	hotplug_handle_ = handle;
+	has_hotplug_ = true;
+	hotplug_should_run_ = true;
+	hotplug_thread_ = std::thread(&DLC300::hotplugLoop, this);
+#endif
+}
+
+
+void DLC300::stopHotplug()
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	if (!has_hotplug_)
+	{
+		return;
+	}
+
+	hotplug_should_run_ = false;
+	libusb_hotplug_deregister_callback(ctx_, hotplug_handle_);
+	hotplug_thread_.join();
+
+	has_hotplug_ = false;
+#endif
+}
+
+
+void DLC300::hotplugLoop()
+{
+	while (hotplug_should_run_)
+	{
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(ctx_, &tv, NULL);
+	}
+}
+
+
+/**
+ * Only records what happened. Opening and closing is left to the thread capturing frames.
+ */
+int LIBUSB_CALL DLC300::hotplugCallback(libusb_context* /*ctx*/, libusb_device* dev,
+		libusb_hotplug_event event, void* user_data)
+{
+#ifdef HAVE_LIBUSB_HOTPLUG
+	DLC300* self = static_cast<DLC300*>(user_data);
+	HotplugListener* listener = self->listener_;
+
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+	{
+		{
+			std::lock_guard<std::mutex> lock(self->hotplug_mutex_);
+			self->arrived_ = true;
+		}
+
+		self->hotplug_arrival_.notify_all();
+
+		if (listener)
+		{
+			listener->cameraArrived(*self, getLocation(dev));
+		}
+	}
+	else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT && dev == self->device_)
+	{
+		self->left_ = true;
+
+		if (listener)
+		{
+			listener->cameraLeft(*self, getLocation(dev));
+		}
+	}
+#endif
+	return 0; // Keep the callback registered
+}
+
+
+/**
+ * Reads and throws away whatever the camera still has queued on the IN endpoint (such as the rest
+ * of a frame we lost track of), until nothing arrives for DRAIN_TIMEOUT_MS or DRAIN_BUDGET_MS has passed.
+ * @return number of bytes thrown away
+ */
+long DLC300::drain()
+{
+	unsigned char scratch[0x4000];
+	long drained = 0;
+
+	std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_BUDGET_MS);
+
+	while (transport_->isPresent() && std::chrono::steady_clock::now() < deadline)
+	{
+		int transferred = 0;
+		int rc = transport_->bulkTransfer(ENDPOINT_IN, scratch, sizeof(scratch), transferred, DRAIN_TIMEOUT_MS);
+
+		drained += transferred;
+
+		if (rc == LIBUSB_ERROR_PIPE && devh_)
+		{
+			libusb_clear_halt(devh_, ENDPOINT_IN);
+		}
+		else if (rc != 0)
+		{
+			break; // Typically LIBUSB_ERROR_TIMEOUT, meaning there is nothing more to drain
+		}
+	}
+
+	if (debug_level_ > 0) {
+		printf("Drained %ld stale bytes\n", drained);
+	}
+
+	return drained;
 }
 
-int DLC300::getFrame(unsigned char* buffer, int bufferSize)
+
+/**
+ * One attempt at capturing a frame: sends the header, and reads the status, the image data and the trailer.
+ * @param meta Filled in on success, unless NULL
+ * @return 0 on success, or a libusb error code. LIBUSB_ERROR_IO means the status packet or the
+ *         image data had an unexpected length, i.e. we are no longer in sync with the camera.
+ */
+int DLC300::captureFrame(unsigned char* buffer, FrameMetadata* meta)
 {
-	sendHeader();
+	const int frameSize = getFrameSize();
+	const uint64_t sequence = nextSequence();
+
+	int rc = sendHeader();
+
+	if (rc != 0)
+	{
+		return rc;
+	}
+
+	CaptureStats::Clock::time_point header_sent = CaptureStats::Clock::now();
+	uint64_t header_sent_ns = monotonicNanoseconds();
 
 	//read512(64); // We expect 64 bytes (but requested 512)
 	int numTransferred = 0;
 
 	//WARNING: this is a deviation from the requests sent by the windows software,
 	//but it seems to work bette
-	this->read(buffer, bufferSize, numTransferred);
+	rc = this->read(buffer, frameSize, numTransferred, STATUS_SIZE);
+
+	CaptureStats::Clock::time_point first_byte = CaptureStats::Clock::now();
+	unsigned long bytes = numTransferred;
+
+	if (rc != 0)
+	{
+		return rc;
+	}
 
-	if (numTransferred != 64)
+	if (numTransferred != STATUS_SIZE)
 	{
-		for (int i = 0; i < 20; i++)
+		stats_.recordSyncLoss();
+
+		if (debug_level_ > 0) {
 			printf("We are not in sync!\n");
+		}
+		return LIBUSB_ERROR_IO;
+	}
+
+	// The image data is read into the same buffer
+	if (meta)
+	{
+		memcpy(meta->status, buffer, STATUS_SIZE);
+		meta->status_length = STATUS_SIZE;
 	}
 
+	rc = this->read(buffer, frameSize, numTransferred); // expects all bytes
 
-	int rc = this->read(buffer, bufferSize, numTransferred); // expects all bytes
+	bytes += numTransferred;
 
-	if (rc == LIBUSB_ERROR_NO_DEVICE)
+	if (numTransferred != frameSize)
 	{
-		restartDevice();
-		return -1;
+		stats_.recordShortTransfer();
+		return rc != 0 ? rc : LIBUSB_ERROR_IO;
 	}
 
-	if (res_ != RESOLUTION_800x600)
+	if (hasTrailer())
 	{
-		read512(256); // we expect 256 bytes (but requested 512)
+		unsigned char trailer[0x200];
+
+		rc = this->read(trailer, sizeof(trailer), numTransferred, TRAILER_SIZE); // we expect 256 bytes (but requested 512)
+
+		if (debug_level_ > 1) {
+			printData(trailer, numTransferred, sizeof(trailer));
+		}
+
+		// The image itself is complete, but the next status packet can not be trusted
+		if (rc != 0 || numTransferred != TRAILER_SIZE)
+		{
+			stats_.recordShortTransfer();
+			state_ = STATE_DRAINING;
+		}
+
+		if (meta)
+		{
+			meta->trailer_length = std::min(numTransferred, int(TRAILER_SIZE));
+			memcpy(meta->trailer, trailer, meta->trailer_length);
+		}
+
+		bytes += numTransferred;
+	}
+	else if (meta)
+	{
+		meta->trailer_length = TRAILER_SIZE;
+		memcpy(meta->trailer, buffer + frameSize - TRAILER_SIZE, TRAILER_SIZE);
+	}
+
+	stats_.recordFrame(header_sent, first_byte, CaptureStats::Clock::now(), bytes);
+
+	if (meta)
+	{
+		meta->sequence = sequence;
+		meta->header_sent_ns = header_sent_ns;
+		meta->last_byte_ns = monotonicNanoseconds();
+		describeHeader(header_, *meta);
 	}
 
 	return 0;
 }
 
-void DLC300::setShouldCenterLowResolution(bool doCenter)
+
+/**
+ * Captures one frame into buffer, recovering from lost synchronisation on the way:
+ *
+ *   STATE_STREAMING  -- frame lost -->     STATE_DRAINING (stale IN data is thrown away, see drain())
+ *   STATE_DRAINING   -- drained -->        STATE_RESENDING (the header is sent again)
+ *   STATE_RESENDING  -- frame lost -->     STATE_REOPENING (the device is closed and opened again)
+ *   STATE_REOPENING  -- open failed -->    STATE_DISCONNECTED (opening is retried with backoff, see reopenDevice())
+ *
+ * A captured frame, or a successful reopen, goes back to STATE_STREAMING. Each call takes at most
+ * one step of each kind, and a timeout is returned to the caller right away, so a lost frame costs
+ * milliseconds rather than seconds.
+ *
+ * Parameters set since the previous frame take effect first, so the number of bytes written to
+ * buffer is getFrameSize() after the call. meta (unless NULL) is filled in when a frame was captured.
+ *
+ * @return 0 on success, otherwise the libusb error code of the last failed attempt.
+ *         LIBUSB_ERROR_NO_DEVICE when the camera is gone (and could not be reopened yet).
+ *         LIBUSB_ERROR_INVALID_PARAM when no resolution is set, or the frame does not fit in bufferSize.
+ */
+int DLC300::getFrame(unsigned char* buffer, int bufferSize, FrameMetadata* meta)
+{
+	// Hotplug reported the camera gone, so there is no point in waiting for transfers to fail
+	if (left_.exchange(false) && devh_)
+	{
+		closeDevice();
+		state_ = STATE_DISCONNECTED;
+		next_reopen_ = std::chrono::steady_clock::now();
+	}
+
+	applyParameters();
+
+	if (applied_.resolution == RESOLUTION_UNDEFINED || getFrameSize() > bufferSize)
+	{
+		return LIBUSB_ERROR_INVALID_PARAM;
+	}
+
+	int rc = LIBUSB_ERROR_OTHER;
+
+	for (int attempt = 0; attempt < 3; attempt++)
+	{
+		if (state_ == STATE_DRAINING)
+		{
+			drain();
+			state_ = STATE_RESENDING;
+		}
+		else if (state_ == STATE_REOPENING || state_ == STATE_DISCONNECTED)
+		{
+			rc = reopenDevice();
+
+			if (rc != 0)
+			{
+				return rc;
+			}
+		}
+
+		rc = captureFrame(buffer, meta);
+
+		if (rc == 0)
+		{
+			if (state_ == STATE_RESENDING)
+			{
+				state_ = STATE_STREAMING;
+			}
+			return 0;
+		}
+
+		if (rc == LIBUSB_ERROR_NO_DEVICE || state_ == STATE_RESENDING)
+		{
+			state_ = STATE_REOPENING;
+		}
+		else
+		{
+			state_ = STATE_DRAINING;
+		}
+
+		if (rc == LIBUSB_ERROR_TIMEOUT)
+		{
+			break;
+		}
+	}
+
+	return rc;
+}
+
+unsigned char* DLC300::allocateDeviceMemory(size_t size)
 {
-	should_center_low_resolution_ = doCenter;
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+	if (devh_)
+	{
+		unsigned char* memory = libusb_dev_mem_alloc(devh_, size);
+
+		if (memory)
+		{
+			std::lock_guard<std::mutex> lock(device_memory_mutex_);
+			device_memory_[memory] = devh_;
+		}
+
+		return memory;
+	}
+#endif
+	return 0;
 }
 
+
+void DLC300::freeDeviceMemory(unsigned char* memory, size_t size)
+{
+	std::lock_guard<std::mutex> lock(device_memory_mutex_);
+
+	std::map<unsigned char*, libusb_device_handle*>::iterator it = device_memory_.find(memory);
+
+	if (it == device_memory_.end())
+	{
+		return;
+	}
+
+	libusb_device_handle* handle = it->second;
+	device_memory_.erase(it);
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+	libusb_dev_mem_free(handle, memory, size);
+#endif
+
+	std::vector<libusb_device_handle*>::iterator retired = std::find(retired_handles_.begin(), retired_handles_.end(), handle);
+
+	if (retired != retired_handles_.end() && countDeviceMemory(handle) == 0)
+	{
+		retired_handles_.erase(retired);
+		libusb_close(handle);
+	}
+}
+
+
+/**
+ * Routes all transfers made by read() and write() through transport.
+ * Passing NULL goes back to talking to the camera directly.
+ */
+void DLC300::setTransport(UsbTransport* transport)
+{
+	transport_ = transport ? transport : &usb_transport_;
+}
+
+
 int DLC300::setDebugLevel(int newDebugLevel)
 {
 	int oldDebugLevel = debug_level_;
@@ -12,6 +12,21 @@
 
 #include <libusb-1.0/libusb.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureStats.h"
+#include "FrameMetadata.h"
+#include "FramePool.h"
+#include "Mailbox.h"
+#include "UsbTransport.h"
+
 /**
  * This class exposes all settings available in the windows program.
  */
@@ -36,46 +51,183 @@ public:
 		PID = 0x0076  ///< Product ID of this USB device
 	};
 
+	enum {
+		ENDPOINT_OUT = 0x02, ///< Bulk endpoint receiving the DlcMsgStruct header
+		ENDPOINT_IN  = 0x86  ///< Bulk endpoint delivering status, image data and trailer
+	};
+
+	enum {
+		HEADER_SIZE  = 64,  ///< Size of the header sent before each frame
+		STATUS_SIZE  = 64,  ///< Size of the status packet preceding each frame
+		TRAILER_SIZE = 256, ///< Size of the packet following each frame
+		MAX_FRAME_SIZE = 2048*1536 ///< Largest number of bytes getFrameSize() will return
+	};
+
+	enum {
+		TRANSFER_TIMEOUT_MS = 4000,  ///< Timeout of the transfers making up a frame
+		DRAIN_TIMEOUT_MS = 20,       ///< The IN endpoint is considered empty after this long without data
+		DRAIN_BUDGET_MS = 100,       ///< Longest time drain() keeps reading
+		REOPEN_BACKOFF_MIN_MS = 10,  ///< Delay before retrying to open a camera which could not be opened
+		REOPEN_BACKOFF_MAX_MS = 1000 ///< Limit for the doubling of that delay
+	};
+
+	/** Where getFrame() is in recovering from a lost frame (see getFrame()) */
+	enum recoveryStateEnum {
+		STATE_STREAMING,   ///< In sync with the camera
+		STATE_DRAINING,    ///< Stale data has to be thrown away before the next frame is requested
+		STATE_RESENDING,   ///< Drained, and requesting a frame again
+		STATE_REOPENING,   ///< The device has to be closed and opened again
+		STATE_DISCONNECTED ///< Reopening failed, and is retried with backoff
+	};
+
+	/** Everything sent to the camera in the header requesting each frame */
+	struct Parameters {
+		resolutionEnum resolution;
+		uint16_t exposure;
+		int red_gain;
+		int green_gain;
+		int blue_gain;
+		int8_t red_offset;
+		int8_t green_offset;
+		int8_t blue_offset;
+		bool center_low_resolution; ///< Center the crop region, instead of starting it at crop_x, crop_y
+		int crop_x; ///< Left column of the crop region used in resolutions below 2048x1536
+		int crop_y; ///< Top row of the crop region used in resolutions below 2048x1536
+	};
+
+	/**
+	 * Receives the hotplug events of a DLC300. Called from its hotplug thread, so implementations
+	 * must return quickly and not call back into the DLC300.
+	 */
+	class HotplugListener {
+	public:
+		virtual ~HotplugListener() {}
+
+		/** A camera (not necessarily the one selected) was connected at location */
+		virtual void cameraArrived(DLC300& cam, const std::string& location) = 0;
+
+		/** The camera cam had open was disconnected (cam reopens it once it is back) */
+		virtual void cameraLeft(DLC300& cam, const std::string& location) = 0;
+	};
+
+	/** Identifies one connected camera */
+	struct DeviceInfo {
+		int bus;
+		std::string location; ///< Bus and port path, such as "8-2.1.3" (as printed by dmesg)
+		std::string serial;   ///< Empty when the device could not be opened to read it
+	};
+
 private:
 
+	libusb_context *ctx_;
 	libusb_device_handle *devh_;
 
+	std::string selector_; ///< location or serial of the camera to open, or empty for the first one
+
+	LibusbTransport usb_transport_; ///< Transfers to and from the camera opened by this object
+	UsbTransport* transport_;       ///< Used by read() and write()
+
+	Mailbox<Parameters> parameters_; ///< Latest parameters published by the setters (from any thread)
+
+	//
+	// The parameters in effect, only touched by the thread capturing frames (see applyParameters())
+	//
+	Parameters applied_;
+	uint64_t applied_version_;
+	unsigned char header_[HEADER_SIZE]; ///< Requests a frame using applied_
 	int w_;
 	int h_;
 
-	resolutionEnum res_;
-	uint16_t exposure_;
-	int red_gain_;
-	int green_gain_;
-	int blue_gain_;
-	int red_offset_;
-	int green_offset_;
-	int blue_offset_;
+	uint64_t sequence_; ///< Sequence number of the next frame requested
 
-	bool should_center_low_resolution_;
 	int debug_level_;
 
+	CaptureStats stats_;
+
+	recoveryStateEnum state_;
+	int reopen_backoff_ms_;
+	std::chrono::steady_clock::time_point next_reopen_; ///< No reopening attempts before this in STATE_DISCONNECTED
+
+	//
+	// Hotplug events (see startHotplug())
+	//
+	bool has_hotplug_;
+	int hotplug_handle_; ///< libusb_hotplug_callback_handle
+	std::atomic<bool> hotplug_should_run_;
+	std::thread hotplug_thread_;
+	std::atomic<HotplugListener*> listener_;
+	std::atomic<libusb_device*> device_; ///< The device devh_ belongs to, for recognising its removal
+	std::atomic<bool> arrived_;          ///< A camera was connected since the last reopen attempt
+	std::atomic<bool> left_;             ///< The open camera was disconnected
+	std::mutex hotplug_mutex_;
+	std::condition_variable hotplug_arrival_;
+
+	//
+	// Memory from allocateDeviceMemory(), which belongs to the handle it was allocated from
+	//
+	std::mutex device_memory_mutex_;
+	std::map<unsigned char*, libusb_device_handle*> device_memory_; ///< The handle of each buffer allocated
+	std::vector<libusb_device_handle*> retired_handles_; ///< Closed by closeDevice(), kept until their memory is freed
+
+	static Parameters getDefaultParameters();
+
 	int openDevice();
 	void closeDevice();
 
-	int restartDevice();
+	int reopenDevice();
+
+	int countDeviceMemory(libusb_device_handle* handle);
+
+	void startHotplug();
+	void stopHotplug();
+	void hotplugLoop();
+	static int LIBUSB_CALL hotplugCallback(libusb_context* ctx, libusb_device* dev,
+			libusb_hotplug_event event, void* user_data);
+
+	int captureFrame(unsigned char* buffer, FrameMetadata* meta);
 
 public:
 
-	DLC300();
+	/**
+	 * Opens a camera in a libusb context of its own, so several cameras can be used concurrently.
+	 * @param selector Location (see DeviceInfo) or serial number of the camera to open.
+	 *                 The first camera found is used when empty.
+	 */
+	DLC300(const std::string& selector = "");
+	explicit DLC300(UsbTransport* transport);
 	~DLC300();
 
-	int getWidth();
-	int getHeight();
+	/** @return every connected camera with a matching VID:PID */
+	static std::vector<DeviceInfo> listDevices();
+
+	static std::string getLocation(libusb_device* dev);
 
+	int getWidth();  ///< @return width of frames captured with the parameters in effect
+	int getHeight(); ///< @return height of frames captured with the parameters in effect
+
+	/** Sets w and h to the size of frames captured in resolution res */
+	static void getDimensions(resolutionEnum res, int& w, int& h);
+
+	//
+	// Control API. Safe to call from any thread while capturing. Changes take effect
+	// from the next frame captured (see applyParameters()).
+	//
 	int setResolution(resolutionEnum res);
-	resolutionEnum getResolution() { return res_; }
+	resolutionEnum getResolution(); ///< @return the most recently set resolution
 	int setExposure(int exposure);
 
 	void setGains(int R, int G, int B);
 	void setOffsets(int8_t R, int8_t G, int8_t B);
+	void setCropStart(int x, int y);
+	void setShouldCenterLowResolution(bool doCenter);
 
-	bool isPresent(); ///< @return true if camera present when the class was constructed
+	void setParameters(const Parameters& parameters); ///< Sets all parameters at once
+	Parameters getParameters(); ///< @return the most recently set parameters
+
+	bool applyParameters();
+	const Parameters& getAppliedParameters() { return applied_; } ///< For the capturing thread only
+
+	bool isPresent(); ///< @return true if the camera (or the transport replacing it) is usable
 
 	void printData(unsigned char* data, int length, int requestLength);
 
@@ -83,17 +235,68 @@ public:
 	void read256(int warn_when_this_differ = -1);
 	void read512(int warn_when_this_differ = -1);
 
+	int getFrameSize(); ///< @return number of bytes to request from the IN endpoint for one frame
+	bool hasTrailer(); ///< @return true if a separate TRAILER_SIZE packet follows the image data
+
+	int buildHeader(unsigned char* data, int length);
+	static void buildHeader(const Parameters& parameters, unsigned char* data);
+	static void describeHeader(const unsigned char* header, FrameMetadata& meta);
+
+	uint64_t nextSequence() { return sequence_++; } ///< For the capturing thread only (see FrameMetadata::sequence)
+
 	int sendHeader();
 
+	libusb_device_handle* getDeviceHandle() { return devh_; }
+	libusb_context* getContext() { return ctx_; }
+
+	void setTransport(UsbTransport* transport);
+	UsbTransport& getLibusbTransport() { return usb_transport_; } ///< For wrapping in a RecordingTransport
+
 	int write(unsigned char* data, int length, int& numTransfered);
 
-	int read(unsigned char* data, int length, int& numTransfered, int warn_when_this_differ = -1);
+	int read(unsigned char* data, int length, int& numTransfered, int warn_when_this_differ = -1,
+			unsigned int timeout_ms = TRANSFER_TIMEOUT_MS);
 
-	int getFrame(unsigned char* buffer, int bufferSize);
+	int getFrame(unsigned char* buffer, int bufferSize, FrameMetadata* meta = 0);
 
-	void setShouldCenterLowResolution(bool doCenter);
+	long drain();
+
+	recoveryStateEnum getRecoveryState() { return state_; }
+
+	int reconnect();
+	bool waitUntilPresent(int timeout_ms);
+
+	bool hasHotplug() { return has_hotplug_; } ///< @return true if connects and disconnects are reported by libusb
+	void setHotplugListener(HotplugListener* listener) { listener_ = listener; }
 
 	int setDebugLevel(int newDebugLevel);
+
+	CaptureStats& getStats() { return stats_; } ///< Transfer statistics of all frames captured so far
+
+	/**
+	 * Allocates memory the kernel can transfer USB data into without copying it (Linux only).
+	 * Only transfers on the connection it was allocated from avoid the copy, so after the camera
+	 * was reopened, frames are copied into it again.
+	 * @return NULL if not supported by libusb or the kernel, or if the usbfs memory limit is reached
+	 */
+	unsigned char* allocateDeviceMemory(size_t size);
+	void freeDeviceMemory(unsigned char* memory, size_t size);
+};
+
+
+/**
+ * Allocates frame buffers from memory mapped from usbfs (libusb_dev_mem_alloc), which the kernel
+ * transfers into directly, instead of copying through its own bounce buffers.
+ *
+ * @note The total amount of such memory is limited by /sys/module/usbcore/parameters/usbfs_memory_mb
+ */
+class DLC300DeviceMemory : public FrameMemoryAllocator {
+	DLC300& cam_;
+public:
+	DLC300DeviceMemory(DLC300& cam) : cam_(cam) {}
+
+	unsigned char* allocate(size_t size) { return cam_.allocateDeviceMemory(size); }
+	void free(unsigned char* memory, size_t size) { cam_.freeDeviceMemory(memory, size); }
 };
 
 
@@ -0,0 +1,1056 @@
+/**
+ * Full resolution demosaicing of raw bayer frames.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "Demosaic.h"
+#include "ColorPipeline.h"
+#include "CpuFeatures.h"
+#include "ImageKernels.h"
+#include "SimdHelpers.h"
+#include "WorkerPool.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+
+namespace Demosaic {
+
+
+/** Smaller bands cost more in waking up threads than they gain */
+enum { MIN_ROWS_PER_BAND = 32 };
+
+
+/** @return index of the row or column i, mirrored into 0..n-1 */
+static inline int mirror(int i, int n)
+{
+	if (i < 0)
+	{
+		return -i;
+	}
+
+	if (i >= n)
+	{
+		return 2*(n - 1) - i;
+	}
+
+	return i;
+}
+
+
+/** (v + half) / 2^shift, rounded towards minus infinity like the vector code, and clamped to 0..255 */
+static inline uint8_t roundClamp(int v, int shift)
+{
+	v = (v + (1 << (shift - 1))) >> shift;
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+
+//
+// All algorithms compute, for each pixel, the same kinds of values:
+//   c     the pixel itself
+//   plus  green at a red or blue pixel
+//   cross blue at a red pixel, or red at a blue pixel
+//   hor   the color found to the left and right of a green pixel
+//   ver   the color found above and below a green pixel
+// and then pick among them depending on the bayer phase (RGGB). Even rows hold R and G1,
+// odd rows G2 and B.
+//
+
+static inline void storePhase(uint8_t* p, int x, bool odd_row,
+		uint8_t c, uint8_t plus, uint8_t cross, uint8_t hor, uint8_t ver)
+{
+	switch ((x&1) + 2*odd_row)
+	{
+	case 0: // Red pixel
+		p[0] = c;
+		p[1] = plus;
+		p[2] = cross;
+		break;
+	case 1: // Green1 pixel
+		p[0] = hor;
+		p[1] = c;
+		p[2] = ver;
+		break;
+	case 2: // Green2 pixel
+		p[0] = ver;
+		p[1] = c;
+		p[2] = hor;
+		break;
+	case 3: // Blue pixel
+		p[0] = cross;
+		p[1] = plus;
+		p[2] = c;
+		break;
+	}
+}
+
+
+/** @return true if x on a row of this kind is a green pixel */
+static inline bool isGreen(int x, bool odd_row)
+{
+	return (x & 1) != odd_row;
+}
+
+
+//
+// Bilinear: each missing color is the mean of its nearest 2 or 4 neighbors of that color.
+//
+
+static void bilinearRow_scalar(const uint8_t* up, const uint8_t* cur, const uint8_t* down,
+		int width, bool odd_row, int x, int end, uint8_t* dst)
+{
+	for (; x < end; x++)
+	{
+		int l = mirror(x - 1, width);
+		int r = mirror(x + 1, width);
+
+		uint8_t plus  = (up[x] + down[x] + cur[l] + cur[r] + 2) / 4;
+		uint8_t cross = (up[l] + up[r] + down[l] + down[r] + 2) / 4;
+		uint8_t hor   = (cur[l] + cur[r] + 1) / 2;
+		uint8_t ver   = (up[x] + down[x] + 1) / 2;
+
+		storePhase(dst + 3*x, x, odd_row, cur[x], plus, cross, hor, ver);
+	}
+}
+
+
+//
+// Malvar-He-Cutler: bilinear, corrected by the laplacian of the pixel's own color, which
+// removes most of the color fringes at edges. The 5x5 filters are scaled by 16 here:
+//
+//   plus  =  8 C + 4 (N + S + W + E) - 2 (NN + SS + WW + EE)
+//   cross = 12 C + 4 (NW + NE + SW + SE) - 3 (NN + SS + WW + EE)
+//   hor   = 10 C + 8 (W + E) - 2 (WW + EE) - 2 (NW + NE + SW + SE) + (NN + SS)
+//   ver   = 10 C + 8 (N + S) - 2 (NN + SS) - 2 (NW + NE + SW + SE) + (WW + EE)
+//
+// Every intermediate value fits in 16 bits, which is what the vector versions use.
+//
+
+/** rows[0..4] are the rows y-2..y+2 */
+static void malvarRow_scalar(const uint8_t* const* rows, int width, bool odd_row, int x, int end, uint8_t* dst)
+{
+	const uint8_t* r0 = rows[0];
+	const uint8_t* r1 = rows[1];
+	const uint8_t* r2 = rows[2];
+	const uint8_t* r3 = rows[3];
+	const uint8_t* r4 = rows[4];
+
+	for (; x < end; x++)
+	{
+		int l  = mirror(x - 1, width);
+		int r  = mirror(x + 1, width);
+		int ll = mirror(x - 2, width);
+		int rr = mirror(x + 2, width);
+
+		int c = r2[x];
+		int ns = r1[x] + r3[x];
+		int we = r2[l] + r2[r];
+		int far_v = r0[x] + r4[x];
+		int far_h = r2[ll] + r2[rr];
+		int diag = r1[l] + r1[r] + r3[l] + r3[r];
+
+		uint8_t plus  = roundClamp(8*c + 4*(ns + we) - 2*(far_v + far_h), 4);
+		uint8_t cross = roundClamp(12*c + 4*diag - 3*(far_v + far_h), 4);
+		uint8_t hor   = roundClamp(10*c + 8*we - 2*far_h - 2*diag + far_v, 4);
+		uint8_t ver   = roundClamp(10*c + 8*ns - 2*far_v - 2*diag + far_h, 4);
+
+		storePhase(dst + 3*x, x, odd_row, c, plus, cross, hor, ver);
+	}
+}
+
+
+//
+// Edge directed (Hamilton-Adams): green is interpolated along the direction (horizontal or
+// vertical) with the smallest gradient, corrected by the laplacian of the pixel's own color.
+// Red and blue are then interpolated as differences to the full green plane, which changes
+// slowly even across edges. At red and blue pixels, the diagonal with the smallest gradient is used.
+//
+//   dH = |W - E| + |2 C - WW - EE|          gH = (2 (W + E) + 2 C - WW - EE) / 4
+//   dV = |N - S| + |2 C - NN - SS|          gV = (2 (N + S) + 2 C - NN - SS) / 4
+//
+// Both directions are averaged when the gradients are equal.
+//
+
+/** Green plane row, rows[0..4] are the bayer rows y-2..y+2 */
+static void edgeGreenRow_scalar(const uint8_t* const* rows, int width, bool odd_row, int x, int end, uint8_t* green)
+{
+	const uint8_t* r0 = rows[0];
+	const uint8_t* r1 = rows[1];
+	const uint8_t* r2 = rows[2];
+	const uint8_t* r3 = rows[3];
+	const uint8_t* r4 = rows[4];
+
+	for (; x < end; x++)
+	{
+		int c = r2[x];
+
+		if (isGreen(x, odd_row))
+		{
+			green[x] = c;
+			continue;
+		}
+
+		int l  = mirror(x - 1, width);
+		int r  = mirror(x + 1, width);
+		int ll = mirror(x - 2, width);
+		int rr = mirror(x + 2, width);
+
+		int lap_h = 2*c - r2[ll] - r2[rr];
+		int lap_v = 2*c - r0[x] - r4[x];
+
+		int dh = abs(r2[l] - r2[r]) + abs(lap_h);
+		int dv = abs(r1[x] - r3[x]) + abs(lap_v);
+
+		int gh = 2*(r2[l] + r2[r]) + lap_h;
+		int gv = 2*(r1[x] + r3[x]) + lap_v;
+
+		green[x] = dh < dv ? roundClamp(gh, 2) : dv < dh ? roundClamp(gv, 2) : roundClamp(gh + gv, 3);
+	}
+}
+
+
+/** bayer[0..2] and green[0..2] are the rows y-1..y+1 */
+static void edgeColorRow_scalar(const uint8_t* const* bayer, const uint8_t* const* green, int width, bool odd_row,
+		int x, int end, uint8_t* dst)
+{
+	const uint8_t* b0 = bayer[0];
+	const uint8_t* b1 = bayer[1];
+	const uint8_t* b2 = bayer[2];
+	const uint8_t* g0 = green[0];
+	const uint8_t* g1 = green[1];
+	const uint8_t* g2 = green[2];
+
+	for (; x < end; x++)
+	{
+		int l = mirror(x - 1, width);
+		int r = mirror(x + 1, width);
+
+		int g = 2*g1[x];
+
+		int hor = g + b1[l] + b1[r] - g1[l] - g1[r];
+		int ver = g + b0[x] + b2[x] - g0[x] - g2[x];
+
+		// Along the NW-SE and the NE-SW diagonals
+		int o1 = g + b0[l] + b2[r] - g0[l] - g2[r];
+		int o2 = g + b0[r] + b2[l] - g0[r] - g2[l];
+		int d1 = abs(b0[l] - b2[r]) + abs(g - g0[l] - g2[r]);
+		int d2 = abs(b0[r] - b2[l]) + abs(g - g0[r] - g2[l]);
+
+		uint8_t cross = d1 < d2 ? roundClamp(o1, 1) : d2 < d1 ? roundClamp(o2, 1) : roundClamp(o1 + o2, 2);
+
+		storePhase(dst + 3*x, x, odd_row, b1[x], g1[x], cross, roundClamp(hor, 1), roundClamp(ver, 1));
+	}
+}
+
+
+static void bilinearRow_generic(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	bilinearRow_scalar(rows[0], rows[1], rows[2], width, odd_row, 0, width, dst);
+}
+
+
+static void malvarRow_generic(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	malvarRow_scalar(rows, width, odd_row, 0, width, dst);
+}
+
+
+static void edgeGreenRow_generic(const uint8_t* const* rows, int width, bool odd_row, uint8_t* green)
+{
+	edgeGreenRow_scalar(rows, width, odd_row, 0, width, green);
+}
+
+
+static void edgeColorRow_generic(const uint8_t* const* bayer, const uint8_t* const* green, int width, bool odd_row,
+		uint8_t* dst)
+{
+	edgeColorRow_scalar(bayer, green, width, odd_row, 0, width, dst);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+//
+// SSE2 versions, 16 pixels per iteration, computing every candidate value for all of them.
+// The outermost columns (and the tail) are done by the scalar code, and each iteration
+// writes 4 bytes beyond its pixels, so the loops stop while those are still within the row.
+//
+
+static inline void storePhases_sse2(bool odd_row, __m128i c, __m128i plus, __m128i cross, __m128i hor, __m128i ver,
+		uint8_t* dst)
+{
+	const __m128i even = _mm_set1_epi16(0x00FF); // Bytes at even x
+
+	if (!odd_row)
+	{
+		storeRGB24_sse2(select_sse2(even, c, hor), select_sse2(even, plus, c), select_sse2(even, cross, ver), dst);
+	}
+	else
+	{
+		storeRGB24_sse2(select_sse2(even, ver, cross), select_sse2(even, c, plus), select_sse2(even, hor, c), dst);
+	}
+}
+
+
+static void bilinearRow_sse2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	const uint8_t* up = rows[0];
+	const uint8_t* cur = rows[1];
+	const uint8_t* down = rows[2];
+
+	bilinearRow_scalar(up, cur, down, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 18 <= width; x += 16)
+	{
+		__m128i c  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x));
+		__m128i l  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x - 1));
+		__m128i r  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + x + 1));
+		__m128i u  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x));
+		__m128i ul = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x - 1));
+		__m128i ur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + x + 1));
+		__m128i d  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x));
+		__m128i dl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x - 1));
+		__m128i dr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(down + x + 1));
+
+		storePhases_sse2(odd_row, c, mean4_sse2(u, d, l, r), mean4_sse2(ul, ur, dl, dr),
+				_mm_avg_epu8(l, r), _mm_avg_epu8(u, d), dst + 3*x);
+	}
+
+	bilinearRow_scalar(up, cur, down, width, odd_row, x, width, dst);
+}
+
+
+/** Malvar-He-Cutler candidates of the 8 pixels at x, in 16 bits (not yet clamped) */
+static inline void malvar8_sse2(const uint8_t* const* rows, int x,
+		__m128i& plus, __m128i& cross, __m128i& hor, __m128i& ver)
+{
+	const __m128i eight = _mm_set1_epi16(8);
+
+	__m128i c     = loadWiden8_sse2(rows[2] + x);
+	__m128i ns    = _mm_add_epi16(loadWiden8_sse2(rows[1] + x), loadWiden8_sse2(rows[3] + x));
+	__m128i we    = _mm_add_epi16(loadWiden8_sse2(rows[2] + x - 1), loadWiden8_sse2(rows[2] + x + 1));
+	__m128i far_v = _mm_add_epi16(loadWiden8_sse2(rows[0] + x), loadWiden8_sse2(rows[4] + x));
+	__m128i far_h = _mm_add_epi16(loadWiden8_sse2(rows[2] + x - 2), loadWiden8_sse2(rows[2] + x + 2));
+	__m128i diag  = _mm_add_epi16(
+			_mm_add_epi16(loadWiden8_sse2(rows[1] + x - 1), loadWiden8_sse2(rows[1] + x + 1)),
+			_mm_add_epi16(loadWiden8_sse2(rows[3] + x - 1), loadWiden8_sse2(rows[3] + x + 1)));
+
+	__m128i far = _mm_add_epi16(far_v, far_h);
+	__m128i c8 = _mm_add_epi16(_mm_slli_epi16(c, 3), eight); // Including the rounding
+	__m128i c10 = _mm_add_epi16(c8, _mm_slli_epi16(c, 1));
+	__m128i diag2 = _mm_slli_epi16(diag, 1);
+
+	plus = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(c8, _mm_slli_epi16(_mm_add_epi16(ns, we), 2)),
+			_mm_slli_epi16(far, 1)), 4);
+
+	cross = _mm_srai_epi16(_mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(c8, _mm_slli_epi16(c, 2)), _mm_slli_epi16(diag, 2)),
+			_mm_add_epi16(far, _mm_slli_epi16(far, 1))), 4);
+
+	hor = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(c10, _mm_slli_epi16(we, 3)),
+			_mm_add_epi16(_mm_slli_epi16(far_h, 1), diag2)), far_v), 4);
+
+	ver = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_add_epi16(c10, _mm_slli_epi16(ns, 3)),
+			_mm_add_epi16(_mm_slli_epi16(far_v, 1), diag2)), far_h), 4);
+}
+
+
+static void malvarRow_sse2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	malvarRow_scalar(rows, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 18 <= width; x += 16)
+	{
+		__m128i plus_lo, cross_lo, hor_lo, ver_lo;
+		__m128i plus_hi, cross_hi, hor_hi, ver_hi;
+		malvar8_sse2(rows, x,     plus_lo, cross_lo, hor_lo, ver_lo);
+		malvar8_sse2(rows, x + 8, plus_hi, cross_hi, hor_hi, ver_hi);
+
+		storePhases_sse2(odd_row, _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + x)),
+				_mm_packus_epi16(plus_lo, plus_hi), _mm_packus_epi16(cross_lo, cross_hi),
+				_mm_packus_epi16(hor_lo, hor_hi), _mm_packus_epi16(ver_lo, ver_hi), dst + 3*x);
+	}
+
+	malvarRow_scalar(rows, width, odd_row, x, width, dst);
+}
+
+
+/** Picks a where da < db, b where db < da, and otherwise (a + b) rounded and shifted one step less */
+static inline __m128i pickDirection_sse2(__m128i da, __m128i db, __m128i a, __m128i b, int shift)
+{
+	const __m128i half = _mm_set1_epi16(1 << (shift - 1));
+	const __m128i quarter = _mm_set1_epi16(1 << shift);
+
+	__m128i va = _mm_srai_epi16(_mm_add_epi16(a, half), shift);
+	__m128i vb = _mm_srai_epi16(_mm_add_epi16(b, half), shift);
+	__m128i both = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(a, b), quarter), shift + 1);
+
+	return select_sse2(_mm_cmplt_epi16(da, db), va, select_sse2(_mm_cmplt_epi16(db, da), vb, both));
+}
+
+
+/** Edge directed green of the 8 pixels at x, in 16 bits (not yet clamped) */
+static inline __m128i edgeGreen8_sse2(const uint8_t* const* rows, int x)
+{
+	__m128i c  = loadWiden8_sse2(rows[2] + x);
+	__m128i c2 = _mm_slli_epi16(c, 1);
+	__m128i w  = loadWiden8_sse2(rows[2] + x - 1);
+	__m128i e  = loadWiden8_sse2(rows[2] + x + 1);
+	__m128i n  = loadWiden8_sse2(rows[1] + x);
+	__m128i s  = loadWiden8_sse2(rows[3] + x);
+
+	__m128i lap_h = _mm_sub_epi16(c2, _mm_add_epi16(loadWiden8_sse2(rows[2] + x - 2), loadWiden8_sse2(rows[2] + x + 2)));
+	__m128i lap_v = _mm_sub_epi16(c2, _mm_add_epi16(loadWiden8_sse2(rows[0] + x), loadWiden8_sse2(rows[4] + x)));
+
+	__m128i dh = _mm_add_epi16(abs16_sse2(_mm_sub_epi16(w, e)), abs16_sse2(lap_h));
+	__m128i dv = _mm_add_epi16(abs16_sse2(_mm_sub_epi16(n, s)), abs16_sse2(lap_v));
+
+	__m128i gh = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(w, e), 1), lap_h);
+	__m128i gv = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(n, s), 1), lap_v);
+
+	return pickDirection_sse2(dh, dv, gh, gv, 2);
+}
+
+
+static void edgeGreenRow_sse2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* green)
+{
+	const __m128i even = _mm_set1_epi16(0x00FF);
+
+	edgeGreenRow_scalar(rows, width, odd_row, 0, 2, green);
+
+	int x = 2;
+
+	for (; x + 18 <= width; x += 16)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + x));
+		__m128i g = _mm_packus_epi16(edgeGreen8_sse2(rows, x), edgeGreen8_sse2(rows, x + 8));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(green + x), odd_row ? select_sse2(even, c, g) : select_sse2(even, g, c));
+	}
+
+	edgeGreenRow_scalar(rows, width, odd_row, x, width, green);
+}
+
+
+/** Edge directed cross, hor and ver of the 8 pixels at x, in 16 bits (not yet clamped) */
+static inline void edgeColor8_sse2(const uint8_t* const* bayer, const uint8_t* const* green, int x,
+		__m128i& cross, __m128i& hor, __m128i& ver)
+{
+	const __m128i one = _mm_set1_epi16(1);
+
+	__m128i g = _mm_slli_epi16(loadWiden8_sse2(green[1] + x), 1);
+
+	hor = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(
+			_mm_add_epi16(g, _mm_add_epi16(loadWiden8_sse2(bayer[1] + x - 1), loadWiden8_sse2(bayer[1] + x + 1))),
+			_mm_add_epi16(loadWiden8_sse2(green[1] + x - 1), loadWiden8_sse2(green[1] + x + 1))), one), 1);
+
+	ver = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(
+			_mm_add_epi16(g, _mm_add_epi16(loadWiden8_sse2(bayer[0] + x), loadWiden8_sse2(bayer[2] + x))),
+			_mm_add_epi16(loadWiden8_sse2(green[0] + x), loadWiden8_sse2(green[2] + x))), one), 1);
+
+	__m128i nw = loadWiden8_sse2(bayer[0] + x - 1);
+	__m128i ne = loadWiden8_sse2(bayer[0] + x + 1);
+	__m128i sw = loadWiden8_sse2(bayer[2] + x - 1);
+	__m128i se = loadWiden8_sse2(bayer[2] + x + 1);
+
+	__m128i lap1 = _mm_sub_epi16(g, _mm_add_epi16(loadWiden8_sse2(green[0] + x - 1), loadWiden8_sse2(green[2] + x + 1)));
+	__m128i lap2 = _mm_sub_epi16(g, _mm_add_epi16(loadWiden8_sse2(green[0] + x + 1), loadWiden8_sse2(green[2] + x - 1)));
+
+	__m128i d1 = _mm_add_epi16(abs16_sse2(_mm_sub_epi16(nw, se)), abs16_sse2(lap1));
+	__m128i d2 = _mm_add_epi16(abs16_sse2(_mm_sub_epi16(ne, sw)), abs16_sse2(lap2));
+
+	cross = pickDirection_sse2(d1, d2, _mm_add_epi16(_mm_add_epi16(nw, se), lap1), _mm_add_epi16(_mm_add_epi16(ne, sw), lap2), 1);
+}
+
+
+static void edgeColorRow_sse2(const uint8_t* const* bayer, const uint8_t* const* green, int width, bool odd_row,
+		uint8_t* dst)
+{
+	edgeColorRow_scalar(bayer, green, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 18 <= width; x += 16)
+	{
+		__m128i cross_lo, hor_lo, ver_lo;
+		__m128i cross_hi, hor_hi, ver_hi;
+		edgeColor8_sse2(bayer, green, x,     cross_lo, hor_lo, ver_lo);
+		edgeColor8_sse2(bayer, green, x + 8, cross_hi, hor_hi, ver_hi);
+
+		storePhases_sse2(odd_row, _mm_loadu_si128(reinterpret_cast<const __m128i*>(bayer[1] + x)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(green[1] + x)), _mm_packus_epi16(cross_lo, cross_hi),
+				_mm_packus_epi16(hor_lo, hor_hi), _mm_packus_epi16(ver_lo, ver_hi), dst + 3*x);
+	}
+
+	edgeColorRow_scalar(bayer, green, width, odd_row, x, width, dst);
+}
+
+
+//
+// AVX2 versions of the above, 32 pixels per iteration
+//
+
+__attribute__((target("avx2")))
+static inline void storePhases_avx2(bool odd_row, __m256i c, __m256i plus, __m256i cross, __m256i hor, __m256i ver,
+		uint8_t* dst)
+{
+	const __m256i even = _mm256_set1_epi16(0x00FF);
+
+	if (!odd_row)
+	{
+		storeRGB24_avx2(select_avx2(even, c, hor), select_avx2(even, plus, c), select_avx2(even, cross, ver), dst);
+	}
+	else
+	{
+		storeRGB24_avx2(select_avx2(even, ver, cross), select_avx2(even, c, plus), select_avx2(even, hor, c), dst);
+	}
+}
+
+
+__attribute__((target("avx2")))
+static void bilinearRow_avx2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	const uint8_t* up = rows[0];
+	const uint8_t* cur = rows[1];
+	const uint8_t* down = rows[2];
+
+	bilinearRow_scalar(up, cur, down, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 34 <= width; x += 32)
+	{
+		__m256i c  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x));
+		__m256i l  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x - 1));
+		__m256i r  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x + 1));
+		__m256i u  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x));
+		__m256i ul = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x - 1));
+		__m256i ur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(up + x + 1));
+		__m256i d  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + x));
+		__m256i dl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + x - 1));
+		__m256i dr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(down + x + 1));
+
+		storePhases_avx2(odd_row, c, mean4_avx2(u, d, l, r), mean4_avx2(ul, ur, dl, dr),
+				_mm256_avg_epu8(l, r), _mm256_avg_epu8(u, d), dst + 3*x);
+	}
+
+	bilinearRow_scalar(up, cur, down, width, odd_row, x, width, dst);
+}
+
+
+__attribute__((target("avx2")))
+static inline void malvar16_avx2(const uint8_t* const* rows, int x,
+		__m256i& plus, __m256i& cross, __m256i& hor, __m256i& ver)
+{
+	const __m256i eight = _mm256_set1_epi16(8);
+
+	__m256i c     = loadWiden16_avx2(rows[2] + x);
+	__m256i ns    = _mm256_add_epi16(loadWiden16_avx2(rows[1] + x), loadWiden16_avx2(rows[3] + x));
+	__m256i we    = _mm256_add_epi16(loadWiden16_avx2(rows[2] + x - 1), loadWiden16_avx2(rows[2] + x + 1));
+	__m256i far_v = _mm256_add_epi16(loadWiden16_avx2(rows[0] + x), loadWiden16_avx2(rows[4] + x));
+	__m256i far_h = _mm256_add_epi16(loadWiden16_avx2(rows[2] + x - 2), loadWiden16_avx2(rows[2] + x + 2));
+	__m256i diag  = _mm256_add_epi16(
+			_mm256_add_epi16(loadWiden16_avx2(rows[1] + x - 1), loadWiden16_avx2(rows[1] + x + 1)),
+			_mm256_add_epi16(loadWiden16_avx2(rows[3] + x - 1), loadWiden16_avx2(rows[3] + x + 1)));
+
+	__m256i far = _mm256_add_epi16(far_v, far_h);
+	__m256i c8 = _mm256_add_epi16(_mm256_slli_epi16(c, 3), eight);
+	__m256i c10 = _mm256_add_epi16(c8, _mm256_slli_epi16(c, 1));
+	__m256i diag2 = _mm256_slli_epi16(diag, 1);
+
+	plus = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_add_epi16(c8, _mm256_slli_epi16(_mm256_add_epi16(ns, we), 2)),
+			_mm256_slli_epi16(far, 1)), 4);
+
+	cross = _mm256_srai_epi16(_mm256_sub_epi16(
+			_mm256_add_epi16(_mm256_add_epi16(c8, _mm256_slli_epi16(c, 2)), _mm256_slli_epi16(diag, 2)),
+			_mm256_add_epi16(far, _mm256_slli_epi16(far, 1))), 4);
+
+	hor = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(_mm256_add_epi16(c10, _mm256_slli_epi16(we, 3)),
+			_mm256_add_epi16(_mm256_slli_epi16(far_h, 1), diag2)), far_v), 4);
+
+	ver = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(_mm256_add_epi16(c10, _mm256_slli_epi16(ns, 3)),
+			_mm256_add_epi16(_mm256_slli_epi16(far_v, 1), diag2)), far_h), 4);
+}
+
+
+__attribute__((target("avx2")))
+static void malvarRow_avx2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	malvarRow_scalar(rows, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 34 <= width; x += 32)
+	{
+		__m256i plus_lo, cross_lo, hor_lo, ver_lo;
+		__m256i plus_hi, cross_hi, hor_hi, ver_hi;
+		malvar16_avx2(rows, x,      plus_lo, cross_lo, hor_lo, ver_lo);
+		malvar16_avx2(rows, x + 16, plus_hi, cross_hi, hor_hi, ver_hi);
+
+		storePhases_avx2(odd_row, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[2] + x)),
+				packus16_avx2(plus_lo, plus_hi), packus16_avx2(cross_lo, cross_hi),
+				packus16_avx2(hor_lo, hor_hi), packus16_avx2(ver_lo, ver_hi), dst + 3*x);
+	}
+
+	malvarRow_scalar(rows, width, odd_row, x, width, dst);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i pickDirection_avx2(__m256i da, __m256i db, __m256i a, __m256i b, int shift)
+{
+	const __m256i half = _mm256_set1_epi16(1 << (shift - 1));
+	const __m256i quarter = _mm256_set1_epi16(1 << shift);
+
+	__m256i va = _mm256_srai_epi16(_mm256_add_epi16(a, half), shift);
+	__m256i vb = _mm256_srai_epi16(_mm256_add_epi16(b, half), shift);
+	__m256i both = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(a, b), quarter), shift + 1);
+
+	return select_avx2(_mm256_cmpgt_epi16(db, da), va, select_avx2(_mm256_cmpgt_epi16(da, db), vb, both));
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i edgeGreen16_avx2(const uint8_t* const* rows, int x)
+{
+	__m256i c  = loadWiden16_avx2(rows[2] + x);
+	__m256i c2 = _mm256_slli_epi16(c, 1);
+	__m256i w  = loadWiden16_avx2(rows[2] + x - 1);
+	__m256i e  = loadWiden16_avx2(rows[2] + x + 1);
+	__m256i n  = loadWiden16_avx2(rows[1] + x);
+	__m256i s  = loadWiden16_avx2(rows[3] + x);
+
+	__m256i lap_h = _mm256_sub_epi16(c2, _mm256_add_epi16(loadWiden16_avx2(rows[2] + x - 2), loadWiden16_avx2(rows[2] + x + 2)));
+	__m256i lap_v = _mm256_sub_epi16(c2, _mm256_add_epi16(loadWiden16_avx2(rows[0] + x), loadWiden16_avx2(rows[4] + x)));
+
+	__m256i dh = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(w, e)), _mm256_abs_epi16(lap_h));
+	__m256i dv = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(n, s)), _mm256_abs_epi16(lap_v));
+
+	__m256i gh = _mm256_add_epi16(_mm256_slli_epi16(_mm256_add_epi16(w, e), 1), lap_h);
+	__m256i gv = _mm256_add_epi16(_mm256_slli_epi16(_mm256_add_epi16(n, s), 1), lap_v);
+
+	return pickDirection_avx2(dh, dv, gh, gv, 2);
+}
+
+
+__attribute__((target("avx2")))
+static void edgeGreenRow_avx2(const uint8_t* const* rows, int width, bool odd_row, uint8_t* green)
+{
+	const __m256i even = _mm256_set1_epi16(0x00FF);
+
+	edgeGreenRow_scalar(rows, width, odd_row, 0, 2, green);
+
+	int x = 2;
+
+	for (; x + 34 <= width; x += 32)
+	{
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[2] + x));
+		__m256i g = packus16_avx2(edgeGreen16_avx2(rows, x), edgeGreen16_avx2(rows, x + 16));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(green + x), odd_row ? select_avx2(even, c, g) : select_avx2(even, g, c));
+	}
+
+	edgeGreenRow_scalar(rows, width, odd_row, x, width, green);
+}
+
+
+__attribute__((target("avx2")))
+static inline void edgeColor16_avx2(const uint8_t* const* bayer, const uint8_t* const* green, int x,
+		__m256i& cross, __m256i& hor, __m256i& ver)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+
+	__m256i g = _mm256_slli_epi16(loadWiden16_avx2(green[1] + x), 1);
+
+	hor = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(
+			_mm256_add_epi16(g, _mm256_add_epi16(loadWiden16_avx2(bayer[1] + x - 1), loadWiden16_avx2(bayer[1] + x + 1))),
+			_mm256_add_epi16(loadWiden16_avx2(green[1] + x - 1), loadWiden16_avx2(green[1] + x + 1))), one), 1);
+
+	ver = _mm256_srai_epi16(_mm256_add_epi16(_mm256_sub_epi16(
+			_mm256_add_epi16(g, _mm256_add_epi16(loadWiden16_avx2(bayer[0] + x), loadWiden16_avx2(bayer[2] + x))),
+			_mm256_add_epi16(loadWiden16_avx2(green[0] + x), loadWiden16_avx2(green[2] + x))), one), 1);
+
+	__m256i nw = loadWiden16_avx2(bayer[0] + x - 1);
+	__m256i ne = loadWiden16_avx2(bayer[0] + x + 1);
+	__m256i sw = loadWiden16_avx2(bayer[2] + x - 1);
+	__m256i se = loadWiden16_avx2(bayer[2] + x + 1);
+
+	__m256i lap1 = _mm256_sub_epi16(g, _mm256_add_epi16(loadWiden16_avx2(green[0] + x - 1), loadWiden16_avx2(green[2] + x + 1)));
+	__m256i lap2 = _mm256_sub_epi16(g, _mm256_add_epi16(loadWiden16_avx2(green[0] + x + 1), loadWiden16_avx2(green[2] + x - 1)));
+
+	__m256i d1 = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(nw, se)), _mm256_abs_epi16(lap1));
+	__m256i d2 = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(ne, sw)), _mm256_abs_epi16(lap2));
+
+	cross = pickDirection_avx2(d1, d2, _mm256_add_epi16(_mm256_add_epi16(nw, se), lap1),
+			_mm256_add_epi16(_mm256_add_epi16(ne, sw), lap2), 1);
+}
+
+
+__attribute__((target("avx2")))
+static void edgeColorRow_avx2(const uint8_t* const* bayer, const uint8_t* const* green, int width, bool odd_row,
+		uint8_t* dst)
+{
+	edgeColorRow_scalar(bayer, green, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 34 <= width; x += 32)
+	{
+		__m256i cross_lo, hor_lo, ver_lo;
+		__m256i cross_hi, hor_hi, ver_hi;
+		edgeColor16_avx2(bayer, green, x,      cross_lo, hor_lo, ver_lo);
+		edgeColor16_avx2(bayer, green, x + 16, cross_hi, hor_hi, ver_hi);
+
+		storePhases_avx2(odd_row, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bayer[1] + x)),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(green[1] + x)), packus16_avx2(cross_lo, cross_hi),
+				packus16_avx2(hor_lo, hor_hi), packus16_avx2(ver_lo, ver_hi), dst + 3*x);
+	}
+
+	edgeColorRow_scalar(bayer, green, width, odd_row, x, width, dst);
+}
+
+
+//
+// AVX-512 version of Malvar-He-Cutler, 64 pixels per iteration. The other methods do too
+// little arithmetic per loaded byte to gain from the wider vectors, and use the AVX2 kernels.
+//
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void storePhases_avx512(bool odd_row, __m512i c, __m512i plus, __m512i cross, __m512i hor, __m512i ver,
+		uint8_t* dst)
+{
+	// Set for the bytes of even columns, which _mm512_mask_blend_epi8() takes from its last argument
+	const __mmask64 even = 0x5555555555555555ULL;
+
+	if (!odd_row)
+	{
+		storeRGB24_avx512(_mm512_mask_blend_epi8(even, hor, c), _mm512_mask_blend_epi8(even, c, plus),
+				_mm512_mask_blend_epi8(even, ver, cross), dst);
+	}
+	else
+	{
+		storeRGB24_avx512(_mm512_mask_blend_epi8(even, cross, ver), _mm512_mask_blend_epi8(even, plus, c),
+				_mm512_mask_blend_epi8(even, c, hor), dst);
+	}
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void malvar32_avx512(const uint8_t* const* rows, int x,
+		__m512i& plus, __m512i& cross, __m512i& hor, __m512i& ver)
+{
+	const __m512i eight = _mm512_set1_epi16(8);
+
+	__m512i c     = loadWiden16_avx512(rows[2] + x);
+	__m512i ns    = _mm512_add_epi16(loadWiden16_avx512(rows[1] + x), loadWiden16_avx512(rows[3] + x));
+	__m512i we    = _mm512_add_epi16(loadWiden16_avx512(rows[2] + x - 1), loadWiden16_avx512(rows[2] + x + 1));
+	__m512i far_v = _mm512_add_epi16(loadWiden16_avx512(rows[0] + x), loadWiden16_avx512(rows[4] + x));
+	__m512i far_h = _mm512_add_epi16(loadWiden16_avx512(rows[2] + x - 2), loadWiden16_avx512(rows[2] + x + 2));
+	__m512i diag  = _mm512_add_epi16(
+			_mm512_add_epi16(loadWiden16_avx512(rows[1] + x - 1), loadWiden16_avx512(rows[1] + x + 1)),
+			_mm512_add_epi16(loadWiden16_avx512(rows[3] + x - 1), loadWiden16_avx512(rows[3] + x + 1)));
+
+	__m512i far = _mm512_add_epi16(far_v, far_h);
+	__m512i c8 = _mm512_add_epi16(_mm512_slli_epi16(c, 3), eight);
+	__m512i c10 = _mm512_add_epi16(c8, _mm512_slli_epi16(c, 1));
+	__m512i diag2 = _mm512_slli_epi16(diag, 1);
+
+	plus = _mm512_srai_epi16(_mm512_sub_epi16(_mm512_add_epi16(c8, _mm512_slli_epi16(_mm512_add_epi16(ns, we), 2)),
+			_mm512_slli_epi16(far, 1)), 4);
+
+	cross = _mm512_srai_epi16(_mm512_sub_epi16(
+			_mm512_add_epi16(_mm512_add_epi16(c8, _mm512_slli_epi16(c, 2)), _mm512_slli_epi16(diag, 2)),
+			_mm512_add_epi16(far, _mm512_slli_epi16(far, 1))), 4);
+
+	hor = _mm512_srai_epi16(_mm512_add_epi16(_mm512_sub_epi16(_mm512_add_epi16(c10, _mm512_slli_epi16(we, 3)),
+			_mm512_add_epi16(_mm512_slli_epi16(far_h, 1), diag2)), far_v), 4);
+
+	ver = _mm512_srai_epi16(_mm512_add_epi16(_mm512_sub_epi16(_mm512_add_epi16(c10, _mm512_slli_epi16(ns, 3)),
+			_mm512_add_epi16(_mm512_slli_epi16(far_v, 1), diag2)), far_h), 4);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void malvarRow_avx512(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst)
+{
+	malvarRow_scalar(rows, width, odd_row, 0, 2, dst);
+
+	int x = 2;
+
+	for (; x + 66 <= width; x += 64)
+	{
+		__m512i plus_lo, cross_lo, hor_lo, ver_lo;
+		__m512i plus_hi, cross_hi, hor_hi, ver_hi;
+		malvar32_avx512(rows, x,      plus_lo, cross_lo, hor_lo, ver_lo);
+		malvar32_avx512(rows, x + 32, plus_hi, cross_hi, hor_hi, ver_hi);
+
+		storePhases_avx512(odd_row, _mm512_loadu_si512(rows[2] + x),
+				packus16_avx512(plus_lo, plus_hi), packus16_avx512(cross_lo, cross_hi),
+				packus16_avx512(hor_lo, hor_hi), packus16_avx512(ver_lo, ver_hi), dst + 3*x);
+	}
+
+	malvarRow_scalar(rows, width, odd_row, x, width, dst);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+/** The row kernels of one instruction set */
+struct Kernels {
+	const char* name;
+	void (*bilinearRow)(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst);
+	void (*malvarRow)(const uint8_t* const* rows, int width, bool odd_row, uint8_t* dst);
+	void (*edgeGreenRow)(const uint8_t* const* rows, int width, bool odd_row, uint8_t* green);
+	void (*edgeColorRow)(const uint8_t* const* bayer, const uint8_t* const* green, int width, bool odd_row, uint8_t* dst);
+};
+
+
+static Kernels selectKernels()
+{
+#ifdef HAVE_X86_KERNELS
+	const CpuFeatures::Level level = CpuFeatures::getLevel();
+
+	if (level >= CpuFeatures::AVX512)
+	{
+		Kernels avx512 = { "avx512", bilinearRow_avx2, malvarRow_avx512, edgeGreenRow_avx2, edgeColorRow_avx2 };
+		return avx512;
+	}
+
+	if (level >= CpuFeatures::AVX2)
+	{
+		Kernels avx2 = { "avx2", bilinearRow_avx2, malvarRow_avx2, edgeGreenRow_avx2, edgeColorRow_avx2 };
+		return avx2;
+	}
+
+	if (level >= CpuFeatures::SSE2)
+	{
+		Kernels sse2 = { "sse2", bilinearRow_sse2, malvarRow_sse2, edgeGreenRow_sse2, edgeColorRow_sse2 };
+		return sse2;
+	}
+#endif
+
+	Kernels scalar = { "scalar", bilinearRow_generic, malvarRow_generic, edgeGreenRow_generic, edgeColorRow_generic };
+	return scalar;
+}
+
+
+static const Kernels kernels = selectKernels();
+
+
+/**
+ * One demosaicing of a whole frame, split into bands of rows. Each row also reads rows
+ * above and below it (1 or 2), so a band reads that many halo rows on each side, from
+ * the source frame or from the green plane finished before.
+ */
+struct Job {
+	const unsigned char* bayer;
+	int width;
+	int height;
+	unsigned char* dst;
+	int dst_pitch;
+	int dst_row;  ///< Row of the frame that goes into the first row of dst
+	int row_offset; ///< Row of the frame that band row 0 is (the bands cover part of the frame)
+	unsigned char* green; ///< Only used by EDGE_DIRECTED, width x height bytes
+	const ColorPipeline* color; ///< NULL when there is nothing to apply
+
+	const unsigned char* row(const unsigned char* plane, int y) const
+	{
+		return plane + mirror(y, height)*width;
+	}
+
+	unsigned char* dstRow(int y) const
+	{
+		return dst + (y - dst_row)*dst_pitch;
+	}
+
+	void finishRow(int y) const
+	{
+		if (color)
+		{
+			color->applyRGB24(dstRow(y), width);
+		}
+	}
+
+	static void bilinear(void* context, int first_row, int end_row)
+	{
+		Job* j = static_cast<Job*>(context);
+
+		for (int y = j->row_offset + first_row; y < j->row_offset + end_row; y++)
+		{
+			const uint8_t* rows[3] = { j->row(j->bayer, y - 1), j->row(j->bayer, y), j->row(j->bayer, y + 1) };
+			kernels.bilinearRow(rows, j->width, y & 1, j->dstRow(y));
+			j->finishRow(y);
+		}
+	}
+
+	static void malvar(void* context, int first_row, int end_row)
+	{
+		Job* j = static_cast<Job*>(context);
+
+		for (int y = j->row_offset + first_row; y < j->row_offset + end_row; y++)
+		{
+			const uint8_t* rows[5] = { j->row(j->bayer, y - 2), j->row(j->bayer, y - 1), j->row(j->bayer, y),
+					j->row(j->bayer, y + 1), j->row(j->bayer, y + 2) };
+			kernels.malvarRow(rows, j->width, y & 1, j->dstRow(y));
+			j->finishRow(y);
+		}
+	}
+
+	static void edgeGreen(void* context, int first_row, int end_row)
+	{
+		Job* j = static_cast<Job*>(context);
+
+		for (int y = j->row_offset + first_row; y < j->row_offset + end_row; y++)
+		{
+			const uint8_t* rows[5] = { j->row(j->bayer, y - 2), j->row(j->bayer, y - 1), j->row(j->bayer, y),
+					j->row(j->bayer, y + 1), j->row(j->bayer, y + 2) };
+			kernels.edgeGreenRow(rows, j->width, y & 1, j->green + y*j->width);
+		}
+	}
+
+	static void edgeColor(void* context, int first_row, int end_row)
+	{
+		Job* j = static_cast<Job*>(context);
+
+		for (int y = j->row_offset + first_row; y < j->row_offset + end_row; y++)
+		{
+			const uint8_t* bayer[3] = { j->row(j->bayer, y - 1), j->row(j->bayer, y), j->row(j->bayer, y + 1) };
+			const uint8_t* green[3] = { j->row(j->green, y - 1), j->row(j->green, y), j->row(j->green, y + 1) };
+			kernels.edgeColorRow(bayer, green, j->width, y & 1, j->dstRow(y));
+			j->finishRow(y);
+		}
+	}
+};
+
+
+/** @return color, or NULL if it would not change anything */
+static const ColorPipeline* prepareColor(ColorPipeline* color)
+{
+	return color && !color->isIdentity() ? color : 0;
+}
+
+
+/** Runs fn on the rows [first_row, end_row) of the frame, split into bands */
+static void runRows(Job& job, int first_row, int end_row, WorkerPool::BandFunction fn)
+{
+	job.row_offset = first_row;
+	WorkerPool::getDefault().runBands(end_row - first_row, MIN_ROWS_PER_BAND, fn, &job);
+}
+
+
+void demosaicRows(Algorithm algorithm, const unsigned char* bayer, int width, int height, int first_row, int end_row,
+		unsigned char* dst, int dst_pitch, ColorPipeline* color, std::vector<unsigned char>& scratch)
+{
+	Job job = { bayer, width, height, dst, dst_pitch, first_row, first_row, 0, prepareColor(color) };
+
+	switch (algorithm)
+	{
+	case BILINEAR:
+		runRows(job, first_row, end_row, Job::bilinear);
+		break;
+	case MALVAR_HE_CUTLER:
+		runRows(job, first_row, end_row, Job::malvar);
+		break;
+	case EDGE_DIRECTED:
+		scratch.resize(size_t(width) * height);
+		job.green = &scratch[0];
+
+		// The green of the rows next to each row is needed before any band can do its red and blue
+		// (mirrored rows outside the frame are within these too)
+		runRows(job, std::max(first_row - 1, 0), std::min(end_row + 1, height), Job::edgeGreen);
+		runRows(job, first_row, end_row, Job::edgeColor);
+		break;
+	default:
+		break;
+	}
+}
+
+
+void bilinear(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color)
+{
+	std::vector<unsigned char> unused;
+	demosaicRows(BILINEAR, bayer, width, height, 0, height, dst, dst_pitch, color, unused);
+}
+
+
+void malvarHeCutler(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color)
+{
+	std::vector<unsigned char> unused;
+	demosaicRows(MALVAR_HE_CUTLER, bayer, width, height, 0, height, dst, dst_pitch, color, unused);
+}
+
+
+void edgeDirected(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color)
+{
+	std::vector<unsigned char> green;
+	demosaicRows(EDGE_DIRECTED, bayer, width, height, 0, height, dst, dst_pitch, color, green);
+}
+
+
+void demosaic(Algorithm algorithm, const FrameView& frame, unsigned char* dst, int dst_pitch, ColorPipeline* color)
+{
+	const unsigned char* bayer = frame.data;
+	std::vector<unsigned char> interleaved;
+
+	if (frame.layout == FrameView::PLANAR)
+	{
+		interleaved.resize(size_t(frame.width) * frame.height);
+		ImageKernels::interleaveBayer(frame, &interleaved[0]);
+		bayer = &interleaved[0];
+	}
+
+	std::vector<unsigned char> scratch;
+	demosaicRows(algorithm, bayer, frame.width, frame.height, 0, frame.height, dst, dst_pitch, color, scratch);
+}
+
+
+const char* getAlgorithmName(Algorithm algorithm)
+{
+	switch (algorithm)
+	{
+	case BILINEAR:
+		return "linear";
+	case MALVAR_HE_CUTLER:
+		return "malvar";
+	case EDGE_DIRECTED:
+		return "edge";
+	default:
+		return "unknown";
+	}
+}
+
+
+bool parseAlgorithm(const std::string& name, Algorithm& algorithm)
+{
+	for (int i = 0; i < NUM_ALGORITHMS; i++)
+	{
+		if (name == getAlgorithmName(Algorithm(i)))
+		{
+			algorithm = Algorithm(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+const char* getImplementationName()
+{
+	return kernels.name;
+}
+
+
+} // Demosaic
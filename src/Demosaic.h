@@ -0,0 +1,92 @@
+/**
+ * Full resolution demosaicing of raw bayer frames.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef DEMOSAIC_H_
+#define DEMOSAIC_H_
+
+#include <string>
+#include <vector>
+
+#include "FrameView.h"
+
+class ColorPipeline;
+
+
+namespace Demosaic {
+
+
+enum Algorithm {
+	BILINEAR,         ///< Fast, but with zipper and color fringe artifacts at edges
+	MALVAR_HE_CUTLER, ///< Gradient-corrected linear interpolation (5x5 filters)
+	EDGE_DIRECTED,    ///< Hamilton-Adams style, interpolating along edges rather than across them
+	NUM_ALGORITHMS
+};
+
+
+/**
+ * Bilinear interpolation of an RGGB bayer image into width x height pixels of packed RGB (3 bytes each).
+ *
+ * Each missing color is the rounded mean of its nearest 2 or 4 neighbors of that color. Pixels
+ * outside the image are mirrored (column -1 is column 1, and so on), which keeps the bayer
+ * phase intact, so the border rows and columns are interpolated like the rest of the image.
+ *
+ * @param bayer width x height bytes. Both width and height must be at least 2.
+ * @param dst_pitch Number of bytes between the starts of two rows in dst
+ * @param color When not NULL, applied to each row right after demosaicing it
+ */
+void bilinear(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color = 0);
+
+/**
+ * Malvar-He-Cutler demosaicing, which is bilinear interpolation corrected by the laplacian of
+ * the color known at each pixel. Same arguments as bilinear(), but width and height must be at least 3.
+ */
+void malvarHeCutler(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color = 0);
+
+/**
+ * Edge directed demosaicing: the green plane is interpolated along the direction with the
+ * smallest gradient, and red and blue as differences to green. Same arguments as bilinear(),
+ * but width and height must be at least 3.
+ */
+void edgeDirected(const unsigned char* bayer, int width, int height, unsigned char* dst, int dst_pitch,
+		ColorPipeline* color = 0);
+
+/**
+ * Runs the given algorithm (see the functions above). They all need the neighborhood of each
+ * pixel in the mosaic, so a PLANAR frame is interleaved into a temporary copy first.
+ */
+void demosaic(Algorithm algorithm, const FrameView& frame, unsigned char* dst, int dst_pitch, ColorPipeline* color = 0);
+
+/**
+ * Demosaics only the rows [first_row, end_row) of a frame, for callers which consume the image
+ * a band of rows at a time (see SnapshotEncoder). Rows outside the range are still read as
+ * neighbors, so the result is the same as that part of what the functions above produce.
+ *
+ * @param bayer The whole frame, INTERLEAVED
+ * @param dst Receives the rows, starting with first_row
+ * @param scratch Working memory, kept by the caller so it can be reused from call to call
+ */
+void demosaicRows(Algorithm algorithm, const unsigned char* bayer, int width, int height, int first_row, int end_row,
+		unsigned char* dst, int dst_pitch, ColorPipeline* color, std::vector<unsigned char>& scratch);
+
+/** @return short name of the algorithm ("linear", "malvar" or "edge"), also used in file names */
+const char* getAlgorithmName(Algorithm algorithm);
+
+/** @return false if name is not the name of any algorithm */
+bool parseAlgorithm(const std::string& name, Algorithm& algorithm);
+
+/** @return name of the instruction set used ("avx512", "avx2", "sse2" or "scalar", see CpuFeatures) */
+const char* getImplementationName();
+
+
+} // Demosaic
+
+
+#endif /* DEMOSAIC_H_ */
@@ -0,0 +1,65 @@
+/**
+ * Description of how and when a frame was captured.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef FRAMEMETADATA_H_
+#define FRAMEMETADATA_H_
+
+#include <stdint.h>
+#include <time.h>
+
+
+/**
+ * Filled in by the capture path (DLC300::getFrame() or AsyncCapture) for every frame.
+ * The camera settings are decoded from the header actually sent to request the frame.
+ */
+struct FrameMetadata {
+	enum {
+		STATUS_SIZE  = 64, ///< Same as DLC300::STATUS_SIZE
+		TRAILER_SIZE = 256 ///< Same as DLC300::TRAILER_SIZE
+	};
+
+	/**
+	 * Number of the request for this frame. Every frame requested from the camera gets the
+	 * next number, so gaps mean frames lost in transfer or dropped on the way to the consumer.
+	 */
+	uint64_t sequence;
+
+	uint64_t header_sent_ns; ///< CLOCK_MONOTONIC time when the header requesting the frame was sent
+	uint64_t last_byte_ns;   ///< CLOCK_MONOTONIC time when the last packet of the frame arrived
+
+	int width;
+	int height;
+	int crop_x;   ///< Left column of the sensor area read out
+	int crop_y;   ///< Top row of the sensor area read out
+
+	uint16_t exposure;
+	uint8_t red_gain;
+	uint8_t green_gain;
+	uint8_t blue_gain;
+	int8_t red_offset;
+	int8_t green_offset;
+	int8_t blue_offset;
+
+	int status_length;  ///< Number of valid bytes in status
+	int trailer_length; ///< Number of valid bytes in trailer (at 800x600 it is copied from the end of the image data)
+	unsigned char status[STATUS_SIZE];   ///< Packet the camera sent before the image data
+	unsigned char trailer[TRAILER_SIZE]; ///< Packet the camera sent after the image data
+};
+
+
+/** @return current CLOCK_MONOTONIC time in nanoseconds, as used in FrameMetadata */
+inline uint64_t monotonicNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+
+#endif /* FRAMEMETADATA_H_ */
@@ -0,0 +1,200 @@
+/**
+ * Preallocated, reference counted frame buffers.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "FramePool.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include <chrono>
+
+
+static size_t roundUp(size_t value, size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+
+FramePool::FramePool(int numFrames, int frameCapacity, bool useHugePages, FrameMemoryAllocator* allocator) :
+		frames_(numFrames),
+		num_frames_(0),
+		memory_(0),
+		memory_size_(0),
+		uses_huge_pages_(false),
+		allocator_(allocator),
+		num_allocated_frames_(0),
+		frame_capacity_(frameCapacity)
+{
+	const size_t page_size = 4096;
+	const size_t huge_page_size = 2 * 1024 * 1024;
+
+	// Page aligned buffers, so they are usable for DMA and O_DIRECT writes
+	stride_ = roundUp(frameCapacity, page_size);
+
+	for (size_t i = 0; i < frames_.size(); i++)
+	{
+		frames_[i].data = 0;
+	}
+
+	// Memory the USB stack can transfer into directly is preferred (one buffer per frame,
+	// since the amount of such memory is limited, and some frames may have to do without)
+	if (allocator_)
+	{
+		for (size_t i = 0; i < frames_.size(); i++)
+		{
+			frames_[i].data = allocator_->allocate(stride_);
+
+			if (!frames_[i].data)
+			{
+				printf("FramePool: Only %d of %d frames could use device memory\n", int(i), numFrames);
+				break;
+			}
+
+			num_allocated_frames_++;
+		}
+	}
+
+	int num_remaining = numFrames - num_allocated_frames_;
+
+	if (num_remaining > 0 && useHugePages)
+	{
+		memory_size_ = roundUp(stride_ * num_remaining, huge_page_size);
+
+		void* p = mmap(NULL, memory_size_, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+		if (p != MAP_FAILED)
+		{
+			memory_ = static_cast<unsigned char*>(p);
+			uses_huge_pages_ = true;
+		}
+		else
+		{
+			printf("FramePool: No huge pages available (see /proc/sys/vm/nr_hugepages), using normal pages\n");
+		}
+	}
+
+	if (num_remaining > 0 && !memory_)
+	{
+		memory_size_ = roundUp(stride_ * num_remaining, page_size);
+
+		void* p = mmap(NULL, memory_size_, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED)
+		{
+			printf("FramePool: Could not allocate %zu bytes\n", memory_size_);
+			memory_size_ = 0;
+			num_remaining = 0;
+		}
+		else
+		{
+			memory_ = static_cast<unsigned char*>(p);
+
+			if (useHugePages)
+			{
+				madvise(memory_, memory_size_, MADV_HUGEPAGE);
+			}
+		}
+	}
+
+	num_frames_ = num_allocated_frames_ + num_remaining;
+
+	free_.reserve(num_frames_);
+
+	for (int i = 0; i < num_frames_; i++)
+	{
+		Frame& frame = frames_[i];
+
+		if (i >= num_allocated_frames_)
+		{
+			frame.data = memory_ + (i - num_allocated_frames_) * stride_;
+		}
+
+		// Touch every page now instead of taking page faults while capturing
+		memset(frame.data, 0, stride_);
+
+		frame.capacity = frameCapacity;
+		frame.width = 0;
+		frame.height = 0;
+		frame.size = 0;
+		frame.layout = FrameView::INTERLEAVED;
+		frame.pool = this;
+		frame.index = i;
+		frame.refcount = 0;
+
+		free_.push_back(&frame);
+	}
+}
+
+
+FramePool::~FramePool()
+{
+	if (int(free_.size()) != num_frames_)
+	{
+		printf("FramePool: %d frames still in use when destroying the pool\n", num_frames_ - int(free_.size()));
+	}
+
+	for (int i = 0; i < num_allocated_frames_; i++)
+	{
+		allocator_->free(frames_[i].data, stride_);
+	}
+
+	if (memory_)
+	{
+		munmap(memory_, memory_size_);
+	}
+}
+
+
+FrameRef FramePool::acquire(int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (free_.empty())
+	{
+		frame_returned_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+				[this]() { return !free_.empty(); });
+	}
+
+	if (free_.empty())
+	{
+		return FrameRef();
+	}
+
+	Frame* frame = free_.back();
+	free_.pop_back();
+
+	frame->refcount.store(1, std::memory_order_relaxed);
+	frame->width = 0;
+	frame->height = 0;
+	frame->size = 0;
+	frame->layout = FrameView::INTERLEAVED;
+
+	return FrameRef(frame);
+}
+
+
+int FramePool::getNumFree()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return int(free_.size());
+}
+
+
+void FramePool::recycle(Frame* frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		free_.push_back(frame);
+	}
+
+	frame_returned_.notify_one();
+}
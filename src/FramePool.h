@@ -0,0 +1,196 @@
+/**
+ * Preallocated, reference counted frame buffers.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "FrameMetadata.h"
+#include "FrameView.h"
+
+class FramePool;
+
+
+/** One raw bayer frame buffer owned by a FramePool */
+struct Frame {
+	unsigned char* data;
+	int capacity; ///< Size of data in bytes
+	int width;
+	int height;
+	int size;     ///< Number of image bytes in data (width * height)
+	FrameView::Layout layout;
+
+	FrameMetadata meta; ///< How and when the frame currently in data was captured
+
+	FramePool* pool;
+	int index; ///< Position in the pool (see FramePool::getBuffer())
+	std::atomic<int> refcount;
+
+	FrameView getView() const { return FrameView(data, width, height, layout); }
+};
+
+
+/**
+ * Provides memory for the buffers of a FramePool, such as memory the USB stack can DMA into directly.
+ */
+class FrameMemoryAllocator {
+public:
+	virtual ~FrameMemoryAllocator() {}
+
+	/** @return NULL if no (more) memory of this kind is available */
+	virtual unsigned char* allocate(size_t size) = 0;
+
+	virtual void free(unsigned char* memory, size_t size) = 0;
+};
+
+
+/**
+ * Shared handle to a Frame. Copying the handle shares the frame (no pixels are copied),
+ * and the frame goes back to its pool when the last handle referring to it is destroyed.
+ */
+class FrameRef {
+public:
+	FrameRef() : frame_(0) {}
+
+	/** Takes over one reference already held on frame (does not increment the reference count) */
+	explicit FrameRef(Frame* frame) : frame_(frame) {}
+
+	FrameRef(const FrameRef& other) : frame_(other.frame_) { addRef(); }
+
+	~FrameRef() { reset(); }
+
+	FrameRef& operator=(const FrameRef& other)
+	{
+		if (frame_ != other.frame_)
+		{
+			reset();
+			frame_ = other.frame_;
+			addRef();
+		}
+		return *this;
+	}
+
+	void reset();
+
+	/** Gives up ownership without releasing the reference, e.g. before handing the frame to a SpscQueue */
+	Frame* detach() { Frame* tmp = frame_; frame_ = 0; return tmp; }
+
+	Frame* get() const { return frame_; }
+	Frame* operator->() const { return frame_; }
+
+	operator bool() const { return frame_ != 0; }
+
+private:
+	Frame* frame_;
+
+	void addRef()
+	{
+		if (frame_)
+		{
+			frame_->refcount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+};
+
+
+/**
+ * A fixed number of frame buffers, all allocated (and touched) up front, so capturing
+ * and consuming frames never allocates memory or takes page faults in steady state.
+ *
+ * Each buffer is large enough for the biggest frame the camera delivers. Buffers are taken
+ * from a FrameMemoryAllocator first (when given). Remaining buffers can optionally be backed by
+ * huge pages, which reduces TLB pressure when walking 3 MB frames.
+ */
+class FramePool {
+public:
+	/**
+	 * @param numFrames Number of buffers in the pool
+	 * @param frameCapacity Size of each buffer in bytes
+	 * @param useHugePages Try to back the buffers with huge pages (falls back to normal pages)
+	 * @param allocator When not NULL, buffers are allocated from here as long as it is able to.
+	 *                  Must outlive the pool.
+	 */
+	FramePool(int numFrames, int frameCapacity, bool useHugePages = false, FrameMemoryAllocator* allocator = 0);
+	~FramePool();
+
+	/** @return a free frame, or an empty handle if none became free within timeout_ms */
+	FrameRef acquire(int timeout_ms = 0);
+
+	/**
+	 * @return the buffer of frame index (0..getNumFrames()-1), getBufferSize() bytes of page aligned
+	 *         memory, e.g. for registering all buffers with the kernel up front
+	 */
+	unsigned char* getBuffer(int index) { return frames_[index].data; }
+
+	/** @return size of each buffer, getFrameCapacity() rounded up to whole pages */
+	size_t getBufferSize() { return stride_; }
+
+	int getFrameCapacity() { return frame_capacity_; }
+	int getNumFrames() { return num_frames_; }
+	int getNumFree();
+
+	bool usesHugePages() { return uses_huge_pages_; }
+
+	/** @return number of buffers provided by the FrameMemoryAllocator */
+	int getNumAllocatedFrames() { return num_allocated_frames_; }
+
+	/**
+	 * @return true if the buffer of frame index was provided by the FrameMemoryAllocator. Such memory
+	 *         (e.g. usbfs mappings) can not always be pinned by the kernel, so it may not be usable for
+	 *         O_DIRECT writes or registered io_uring buffers.
+	 */
+	bool isAllocatedFrame(int index) { return index < num_allocated_frames_; }
+
+private:
+	friend class FrameRef;
+
+	std::vector<Frame> frames_;
+	int num_frames_; ///< Number of frames successfully allocated
+	std::vector<Frame*> free_; ///< Reserved for all frames up front, so push_back never allocates
+
+	std::mutex mutex_;
+	std::condition_variable frame_returned_;
+
+	unsigned char* memory_; ///< Buffers not provided by allocator_
+	size_t memory_size_;
+	size_t stride_;
+	bool uses_huge_pages_;
+
+	FrameMemoryAllocator* allocator_;
+	int num_allocated_frames_;
+
+	int frame_capacity_;
+
+	void recycle(Frame* frame);
+
+	FramePool(const FramePool&);
+	FramePool& operator=(const FramePool&);
+};
+
+
+inline void FrameRef::reset()
+{
+	if (frame_)
+	{
+		if (frame_->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			frame_->pool->recycle(frame_);
+		}
+		frame_ = 0;
+	}
+}
+
+
+#endif /* FRAMEPOOL_H_ */
@@ -0,0 +1,501 @@
+/**
+ * Statistics of raw bayer frames, gathered in one pass for everyone interested.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "FrameStatistics.h"
+#include "CpuFeatures.h"
+#include "SimdHelpers.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+//
+// Sums of R, (G1 + G2) / 2 and B over the quads [x, end) of a quad row
+//
+
+/** Either layout, see FrameView::getQuadRow(). Only every step:th quad when subsampling. */
+static void sumQuads_scalar(const uint8_t* const* planes, int stride, int x, int end, int step, long* sums)
+{
+	long r = 0;
+	long g = 0;
+	long b = 0;
+
+	for (; x < end; x += step)
+	{
+		r += planes[FrameView::R][stride*x];
+		g += (planes[FrameView::G1][stride*x] + planes[FrameView::G2][stride*x]) / 2;
+		b += planes[FrameView::B][stride*x];
+	}
+
+	sums[FrameStatistics::RED] += r;
+	sums[FrameStatistics::GREEN] += g;
+	sums[FrameStatistics::BLUE] += b;
+}
+
+
+static void sumQuads_generic(const uint8_t* row0, const uint8_t* row1, int x, int end, long* sums)
+{
+	const uint8_t* planes[FrameView::NUM_PLANES] = { row0, row0 + 1, row1, row1 + 1 };
+	sumQuads_scalar(planes, 2, x, end, 1, sums);
+}
+
+
+static void sumPlanes_generic(const uint8_t* const* planes, int x, int end, long* sums)
+{
+	sumQuads_scalar(planes, 1, x, end, 1, sums);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * 8 quads per iteration, each value in a 16 bit lane. All of them are below 256, so
+ * _mm_sad_epu8() against zero adds them up (into two 64 bit halves).
+ */
+static void sumQuads_sse2(const uint8_t* row0, const uint8_t* row1, int x, int end, long* sums)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i r = zero;
+	__m128i g = zero;
+	__m128i b = zero;
+
+	for (; x + 8 <= end; x += 8)
+	{
+		__m128i even = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2*x));
+		__m128i odd  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2*x));
+
+		__m128i g16 = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(even, 8), _mm_and_si128(odd, low_bytes)), 1);
+
+		r = _mm_add_epi64(r, _mm_sad_epu8(_mm_and_si128(even, low_bytes), zero));
+		g = _mm_add_epi64(g, _mm_sad_epu8(g16, zero));
+		b = _mm_add_epi64(b, _mm_sad_epu8(_mm_srli_epi16(odd, 8), zero));
+	}
+
+	int64_t lanes[2];
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), r);
+	sums[FrameStatistics::RED] += lanes[0] + lanes[1];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), g);
+	sums[FrameStatistics::GREEN] += lanes[0] + lanes[1];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), b);
+	sums[FrameStatistics::BLUE] += lanes[0] + lanes[1];
+
+	sumQuads_generic(row0, row1, x, end, sums);
+}
+
+
+/** The planar layout needs no unpacking, so 16 quads per iteration */
+static void sumPlanes_sse2(const uint8_t* const* planes, int x, int end, long* sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i r = zero;
+	__m128i g = zero;
+	__m128i b = zero;
+
+	for (; x + 16 <= end; x += 16)
+	{
+		__m128i g1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G1] + x));
+		__m128i g2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G2] + x));
+
+		r = _mm_add_epi64(r, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::R] + x)), zero));
+		g = _mm_add_epi64(g, _mm_sad_epu8(floorMean2_sse2(g1, g2), zero));
+		b = _mm_add_epi64(b, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::B] + x)), zero));
+	}
+
+	int64_t lanes[2];
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), r);
+	sums[FrameStatistics::RED] += lanes[0] + lanes[1];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), g);
+	sums[FrameStatistics::GREEN] += lanes[0] + lanes[1];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), b);
+	sums[FrameStatistics::BLUE] += lanes[0] + lanes[1];
+
+	sumPlanes_generic(planes, x, end, sums);
+}
+
+
+/** Same as sumQuads_sse2(), 16 quads per iteration */
+__attribute__((target("avx2")))
+static void sumQuads_avx2(const uint8_t* row0, const uint8_t* row1, int x, int end, long* sums)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+	const __m256i zero = _mm256_setzero_si256();
+
+	__m256i r = zero;
+	__m256i g = zero;
+	__m256i b = zero;
+
+	for (; x + 16 <= end; x += 16)
+	{
+		__m256i even = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 2*x));
+		__m256i odd  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 2*x));
+
+		__m256i g16 = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(even, 8), _mm256_and_si256(odd, low_bytes)), 1);
+
+		r = _mm256_add_epi64(r, _mm256_sad_epu8(_mm256_and_si256(even, low_bytes), zero));
+		g = _mm256_add_epi64(g, _mm256_sad_epu8(g16, zero));
+		b = _mm256_add_epi64(b, _mm256_sad_epu8(_mm256_srli_epi16(odd, 8), zero));
+	}
+
+	int64_t lanes[4];
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), r);
+	sums[FrameStatistics::RED] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), g);
+	sums[FrameStatistics::GREEN] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), b);
+	sums[FrameStatistics::BLUE] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	sumQuads_sse2(row0, row1, x, end, sums);
+}
+
+
+/** Same as sumPlanes_sse2(), 32 quads per iteration */
+__attribute__((target("avx2")))
+static void sumPlanes_avx2(const uint8_t* const* planes, int x, int end, long* sums)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	__m256i r = zero;
+	__m256i g = zero;
+	__m256i b = zero;
+
+	for (; x + 32 <= end; x += 32)
+	{
+		__m256i g1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G1] + x));
+		__m256i g2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G2] + x));
+
+		r = _mm256_add_epi64(r, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::R] + x)), zero));
+		g = _mm256_add_epi64(g, _mm256_sad_epu8(floorMean2_avx2(g1, g2), zero));
+		b = _mm256_add_epi64(b, _mm256_sad_epu8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::B] + x)), zero));
+	}
+
+	int64_t lanes[4];
+
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), r);
+	sums[FrameStatistics::RED] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), g);
+	sums[FrameStatistics::GREEN] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), b);
+	sums[FrameStatistics::BLUE] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	sumPlanes_sse2(planes, x, end, sums);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+/** The kernels of one instruction set */
+struct Kernels {
+	const char* name;
+	void (*sumQuads)(const uint8_t* row0, const uint8_t* row1, int x, int end, long* sums);
+	void (*sumPlanes)(const uint8_t* const* planes, int x, int end, long* sums);
+};
+
+
+static Kernels selectKernels()
+{
+#ifdef HAVE_X86_KERNELS
+	const CpuFeatures::Level level = CpuFeatures::getLevel();
+
+	// No AVX-512 kernels: the histogram dominates, and compute() measured no faster with them
+	if (level >= CpuFeatures::AVX2)
+	{
+		Kernels avx2 = { "avx2", sumQuads_avx2, sumPlanes_avx2 };
+		return avx2;
+	}
+
+	if (level >= CpuFeatures::SSE2)
+	{
+		Kernels sse2 = { "sse2", sumQuads_sse2, sumPlanes_sse2 };
+		return sse2;
+	}
+#endif
+
+	Kernels scalar = { "scalar", sumQuads_generic, sumPlanes_generic };
+	return scalar;
+}
+
+
+static const Kernels kernels = selectKernels();
+
+
+/** Smaller bands cost more in waking up threads than they gain */
+enum { MIN_QUAD_ROWS_PER_BAND = 16 };
+
+
+struct FrameStatistics::Job {
+	FrameStatistics* stats;
+	const FrameView* frame;
+	int quad_rows; ///< Number of quad rows looked at (after subsampling)
+	int bands;
+	bool sum_regions; ///< False when the region sums come from the SummedAreaTable
+};
+
+
+FrameStatistics::FrameStatistics() :
+	step_(1),
+	black_level_(0),
+	clip_level_(255),
+	should_build_table_(false)
+{
+	memset(histogram_, 0, sizeof(histogram_));
+}
+
+
+int FrameStatistics::addRegion(int left, int top, int right, int bottom)
+{
+	Region region = { left, top, right, bottom };
+	regions_.push_back(region);
+
+	Sums zero = { { 0, 0, 0 }, 0 };
+	region_sums_.push_back(zero);
+
+	return regions_.size() - 1;
+}
+
+
+void FrameStatistics::clearRegions()
+{
+	regions_.clear();
+	region_sums_.clear();
+}
+
+
+void FrameStatistics::setSubsampling(int step)
+{
+	step_ = std::max(step, 1);
+}
+
+
+void FrameStatistics::setLevels(uint8_t black_level, uint8_t clip_level)
+{
+	black_level_ = black_level;
+	clip_level_ = clip_level;
+}
+
+
+void FrameStatistics::computeBand(void* context, int band)
+{
+	Job* job = static_cast<Job*>(context);
+	FrameStatistics* s = job->stats;
+	Partial& p = s->partials_[band];
+
+	const int step = s->step_;
+	const int quads = job->frame->getQuadWidth();
+
+	memset(p.histogram, 0, sizeof(p.histogram));
+
+	Sums zero = { { 0, 0, 0 }, 0 };
+	p.region_sums.assign(s->regions_.size(), zero);
+
+	uint32_t* hist_r  = p.histogram[0];
+	uint32_t* hist_g1 = p.histogram[1];
+	uint32_t* hist_g2 = p.histogram[2];
+	uint32_t* hist_b  = p.histogram[3];
+
+	int first = band * job->quad_rows / job->bands;
+	int end = (band + 1) * job->quad_rows / job->bands;
+
+	for (int i = first; i < end; i++)
+	{
+		int y = i * step; // Quad row
+
+		const uint8_t* planes[FrameView::NUM_PLANES];
+		int stride;
+		job->frame->getQuadRow(y, planes, stride);
+
+		const uint8_t* r_row  = planes[FrameView::R];
+		const uint8_t* g1_row = planes[FrameView::G1];
+		const uint8_t* g2_row = planes[FrameView::G2];
+		const uint8_t* b_row  = planes[FrameView::B];
+
+		const int x_step = step * stride;
+		const int x_end = quads * stride;
+
+		for (int x = 0; x < x_end; x += x_step)
+		{
+			hist_r[r_row[x]]++;
+			hist_g1[g1_row[x]]++;
+			hist_g2[g2_row[x]]++;
+			hist_b[b_row[x]]++;
+		}
+
+		for (size_t r = 0; job->sum_regions && r < s->regions_.size(); r++)
+		{
+			const Region& region = s->regions_[r];
+
+			if (y < region.top/2 || y >= region.bottom/2)
+			{
+				continue;
+			}
+
+			int left = std::max(region.left/2, 0);
+			int right = std::min(region.right/2, quads);
+
+			if (left >= right)
+			{
+				continue;
+			}
+
+			Sums& sums = p.region_sums[r];
+
+			if (step == 1)
+			{
+				if (stride == 1)
+				{
+					kernels.sumPlanes(planes, left, right, sums.sum);
+				}
+				else
+				{
+					kernels.sumQuads(planes[FrameView::R], planes[FrameView::G2], left, right, sums.sum);
+				}
+				sums.quads += right - left;
+			}
+			else
+			{
+				// Only the quads on the subsampling grid
+				int x = (left + step - 1) / step * step;
+				sumQuads_scalar(planes, stride, x, right, step, sums.sum);
+				sums.quads += x < right ? (right - x + step - 1) / step : 0;
+			}
+		}
+	}
+}
+
+
+void FrameStatistics::compute(const FrameView& frame)
+{
+	WorkerPool& pool = WorkerPool::getDefault();
+
+	Job job;
+	job.stats = this;
+	job.frame = &frame;
+	job.quad_rows = (frame.getQuadHeight() + step_ - 1) / step_;
+	job.bands = std::max(1, std::min(pool.getThreadCount(), job.quad_rows / MIN_QUAD_ROWS_PER_BAND));
+	job.sum_regions = !should_build_table_;
+
+	if (int(partials_.size()) < job.bands)
+	{
+		partials_.resize(job.bands);
+	}
+
+	pool.run(job.bands, computeBand, &job);
+
+	memset(histogram_, 0, sizeof(histogram_));
+
+	Sums zero = { { 0, 0, 0 }, 0 };
+	region_sums_.assign(regions_.size(), zero);
+
+	for (int band = 0; band < job.bands; band++)
+	{
+		const Partial& p = partials_[band];
+
+		for (int i = 0; i < 256; i++)
+		{
+			histogram_[RED][i]   += p.histogram[0][i];
+			histogram_[GREEN][i] += p.histogram[1][i] + p.histogram[2][i];
+			histogram_[BLUE][i]  += p.histogram[3][i];
+		}
+
+		for (size_t r = 0; r < regions_.size(); r++)
+		{
+			for (int c = 0; c < NUM_CHANNELS; c++)
+			{
+				region_sums_[r].sum[c] += p.region_sums[r].sum[c];
+			}
+			region_sums_[r].quads += p.region_sums[r].quads;
+		}
+	}
+
+	if (should_build_table_)
+	{
+		table_.build(frame);
+
+		for (size_t r = 0; r < regions_.size(); r++)
+		{
+			const Region& region = regions_[r];
+
+			uint32_t sums[SummedAreaTable::NUM_PLANES];
+			table_.getSums(region.left, region.top, region.right, region.bottom, sums);
+
+			region_sums_[r].sum[RED] = sums[SummedAreaTable::R];
+			region_sums_[r].sum[GREEN] = (long(sums[SummedAreaTable::G1]) + sums[SummedAreaTable::G2]) / 2;
+			region_sums_[r].sum[BLUE] = sums[SummedAreaTable::B];
+			region_sums_[r].quads = table_.getQuads(region.left, region.top, region.right, region.bottom);
+		}
+	}
+}
+
+
+void FrameStatistics::getRegionSums(int region, long& sum_R, long& sum_G, long& sum_B)
+{
+	sum_R = region_sums_[region].sum[RED];
+	sum_G = region_sums_[region].sum[GREEN];
+	sum_B = region_sums_[region].sum[BLUE];
+}
+
+
+unsigned long FrameStatistics::getSamples(Channel channel)
+{
+	unsigned long samples = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		samples += histogram_[channel][i];
+	}
+
+	return samples;
+}
+
+
+unsigned long FrameStatistics::getClipped(Channel channel)
+{
+	unsigned long clipped = 0;
+
+	for (int i = clip_level_; i < 256; i++)
+	{
+		clipped += histogram_[channel][i];
+	}
+
+	return clipped;
+}
+
+
+unsigned long FrameStatistics::getBlack(Channel channel)
+{
+	unsigned long black = 0;
+
+	for (int i = 0; i <= black_level_; i++)
+	{
+		black += histogram_[channel][i];
+	}
+
+	return black;
+}
+
+
+double FrameStatistics::getMean(Channel channel)
+{
+	double sum = 0;
+	unsigned long samples = 0;
+
+	for (int i = 0; i < 256; i++)
+	{
+		sum += double(i) * histogram_[channel][i];
+		samples += histogram_[channel][i];
+	}
+
+	return samples ? sum / samples : 0;
+}
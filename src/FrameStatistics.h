@@ -0,0 +1,127 @@
+/**
+ * Statistics of raw bayer frames, gathered in one pass for everyone interested.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef FRAMESTATISTICS_H_
+#define FRAMESTATISTICS_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "FrameView.h"
+#include "SummedAreaTable.h"
+
+
+/**
+ * Walks an RGGB bayer frame once, collecting everything auto exposure, white balancing,
+ * the user interface and logging want to know about it:
+ * - a 256 bin histogram per channel (green counting both G1 and G2),
+ * - sums of R, G and B over any number of regions,
+ * - the number of clipped and black samples per channel.
+ *
+ * Configure it once (regions, levels, subsampling), then call compute() for every frame
+ * and read the results until the next call.
+ *
+ * All work is done on whole 2x2 quads, the same way the white balance always did it:
+ * the sums of a region use R, (G1 + G2) / 2 (rounded down) and B of each quad.
+ */
+class FrameStatistics {
+public:
+	enum Channel { RED, GREEN, BLUE, NUM_CHANNELS };
+
+	/** In bayer pixel coordinates. Rounded down to whole quads, and right and bottom are excluded. */
+	struct Region {
+		int left;
+		int top;
+		int right;
+		int bottom;
+	};
+
+	FrameStatistics();
+
+	/** @return index of the region, for getRegionSums() */
+	int addRegion(int left, int top, int right, int bottom);
+	void clearRegions();
+	int getNumRegions() { return regions_.size(); }
+
+	/**
+	 * Only looks at every step:th quad, in both directions, to save time when approximate
+	 * results are good enough. 1 (the default) looks at every quad.
+	 */
+	void setSubsampling(int step);
+
+	/** Samples <= black_level are counted as black, and samples >= clip_level as clipped */
+	void setLevels(uint8_t black_level, uint8_t clip_level);
+
+	/**
+	 * Also builds a SummedAreaTable of every frame, and takes the region sums from it instead of
+	 * summing each region over its rows, for when there are more regions than are worth summing
+	 * one by one (spot metering, uniformity checks). Off by default.
+	 *
+	 * The region sums then ignore subsampling, and green is (G1 + G2) / 2 rounded down once for
+	 * the whole region, instead of for every quad.
+	 */
+	void setBuildSummedAreaTable(bool should_build) { should_build_table_ = should_build; }
+
+	/** Either layout, with the same results */
+	void compute(const FrameView& frame);
+
+	//
+	// Results of the latest compute()
+	//
+
+	const uint32_t* getHistogram(Channel channel) { return histogram_[channel]; }
+
+	void getRegionSums(int region, long& sum_R, long& sum_G, long& sum_B);
+
+	/** @return the number of quads summed in the region */
+	long getRegionQuads(int region) { return region_sums_[region].quads; }
+
+	/** @return the number of samples of the channel (twice the number of quads for green) */
+	unsigned long getSamples(Channel channel);
+
+	unsigned long getClipped(Channel channel);
+	unsigned long getBlack(Channel channel);
+
+	/** @return the mean of all samples of the channel */
+	double getMean(Channel channel);
+
+	/** Only valid after setBuildSummedAreaTable(true). Unaffected by subsampling. */
+	const SummedAreaTable& getSummedAreaTable() { return table_; }
+
+private:
+	struct Sums {
+		long sum[NUM_CHANNELS];
+		long quads;
+	};
+
+	std::vector<Region> regions_;
+	int step_;
+	uint8_t black_level_;
+	uint8_t clip_level_;
+	bool should_build_table_;
+
+	uint32_t histogram_[NUM_CHANNELS][256];
+	std::vector<Sums> region_sums_;
+
+	/** What each band collects by itself, added up when all bands are done */
+	struct Partial {
+		uint32_t histogram[4][256]; ///< R, G1, G2 and B, so consecutive increments rarely hit the same counter
+		std::vector<Sums> region_sums;
+	};
+
+	std::vector<Partial> partials_;
+
+	SummedAreaTable table_;
+
+	struct Job;
+	static void computeBand(void* context, int band);
+};
+
+
+#endif /* FRAMESTATISTICS_H_ */
@@ -0,0 +1,87 @@
+/**
+ * Read access to a raw bayer frame in either of the layouts the capture path produces.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef FRAMEVIEW_H_
+#define FRAMEVIEW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * An RGGB bayer frame, either as the sensor delivers it or split into one plane per color
+ * (see CaptureThread::setLayout()). Does not own the pixels.
+ *
+ * Everything that reads frames takes one of these, and has a fast path for each layout:
+ * the planar one lets each color be loaded with plain contiguous vector loads, instead
+ * of every other byte of two rows.
+ */
+struct FrameView {
+	enum Layout {
+		INTERLEAVED, ///< width x height bytes, R G1 on even rows and G2 B on odd rows
+		PLANAR       ///< Four (width/2) x (height/2) planes, R, G1, G2 and B, one after the other
+	};
+
+	enum Plane { R, G1, G2, B, NUM_PLANES };
+
+	const unsigned char* data;
+	int width;  ///< In bayer pixels, whatever the layout
+	int height;
+	Layout layout;
+
+	FrameView(const unsigned char* data, int width, int height, Layout layout = INTERLEAVED) :
+		data(data),
+		width(width),
+		height(height),
+		layout(layout)
+	{
+	}
+
+	int getQuadWidth() const { return width / 2; }
+	int getQuadHeight() const { return height / 2; }
+
+	/** @return row y of the mosaic (INTERLEAVED only) */
+	const unsigned char* getRow(int y) const
+	{
+		return data + size_t(y) * width;
+	}
+
+	/** @return row qy of a plane, getQuadWidth() bytes (PLANAR only) */
+	const unsigned char* getPlaneRow(Plane plane, int qy) const
+	{
+		return data + (size_t(plane) * getQuadHeight() + qy) * getQuadWidth();
+	}
+
+	/**
+	 * Where the samples of quad row qy are in either layout: the first sample of each plane,
+	 * with step bytes between those of neighboring quads.
+	 */
+	void getQuadRow(int qy, const unsigned char* planes[NUM_PLANES], int& step) const
+	{
+		if (layout == PLANAR)
+		{
+			for (int p = 0; p < NUM_PLANES; p++)
+			{
+				planes[p] = getPlaneRow(Plane(p), qy);
+			}
+			step = 1;
+		}
+		else
+		{
+			planes[R] = getRow(2*qy);
+			planes[G1] = planes[R] + 1;
+			planes[G2] = getRow(2*qy + 1);
+			planes[B] = planes[G2] + 1;
+			step = 2;
+		}
+	}
+};
+
+
+#endif /* FRAMEVIEW_H_ */
@@ -14,6 +14,9 @@
 #include <SDL/SDL_gfxPrimitives.h>
 #include <SDL/SDL_gfxPrimitives_font.h>
 
+#include "ColorPipeline.h"
+#include "ImageKernels.h"
+
 
 class SDLWindow {
 
@@ -103,28 +106,55 @@ class SDLWindow {
 		posx = free_x/2;
 	}
 
-	void drawBayerAsRGB_Internal(unsigned char* img, int width_bayer, int height_bayer)
+	void drawBayerAsRGB_Internal(const FrameView& frame)
 	{
+		const int width_bayer = frame.width;
+		const int height_bayer = frame.height;
+
 		assert(width_bayer/2 <= w_);
 		assert(height_bayer/2 <= h_);
 
 		int posx, posy;
 		getTopLeftOffset(posx, posy, width_bayer/2, height_bayer/2);
 
+		const SDL_PixelFormat* format = screen_->format;
+
+		// Straight into the screen when it has 8 bits per color in 32 bit pixels (the usual case)
+		if (format->BytesPerPixel == 4 && format->Rloss == 0 && format->Gloss == 0 && format->Bloss == 0)
+		{
+			ImageKernels::PixelFormat32 pixelFormat = { format->Rshift, format->Gshift, format->Bshift, format->Amask };
+
+			Uint8* dst = (Uint8*)screen_->pixels + posy*screen_->pitch + posx*4;
+
+			ImageKernels::binBayer2x2ToRGB32(frame, dst, screen_->pitch, pixelFormat, color_);
+			return;
+		}
+
+		ColorPipeline* color = color_ && !color_->isIdentity() ? color_ : 0;
+
 		for (int y = 0; y < height_bayer/2; y++)
 		{
+			const unsigned char* planes[FrameView::NUM_PLANES];
+			int stride;
+			frame.getQuadRow(y, planes, stride);
+
 			for (int x = 0; x < width_bayer/2; x++)
 			{
-				uint8_t R  = img[(y*2  )*width_bayer + x*2 + 0];
-				uint8_t G1 = img[(y*2  )*width_bayer + x*2 + 1];
-				uint8_t G2 = img[(y*2+1)*width_bayer + x*2 + 0];
-				uint8_t B =  img[(y*2+1)*width_bayer + x*2 + 1];
-				safeDrawPixel(screen_, x + posx, y + posy, R, (G1 + G2)/2, B);
+				uint8_t R  = planes[FrameView::R][stride*x];
+				uint8_t G1 = planes[FrameView::G1][stride*x];
+				uint8_t G2 = planes[FrameView::G2][stride*x];
+				uint8_t B  = planes[FrameView::B][stride*x];
+				uint8_t rgb[3] = { R, uint8_t((G1 + G2)/2), B };
+				if (color)
+				{
+					color->applyRGB24(rgb, 1);
+				}
+				safeDrawPixel(screen_, x + posx, y + posy, rgb[0], rgb[1], rgb[2]);
 			}
 		}
 	}
 
-	void drawWhitebalanceRegion(unsigned char* img, int width_bayer, int height_bayer)
+	void drawWhitebalanceRegion(int width_bayer, int height_bayer)
 	{
 		int left_bayer, top_bayer, right_bayer, bottom_bayer;
 
@@ -157,8 +187,9 @@ class SDLWindow {
 	const int h_;
 	enum { top_text_height_ = 10 };
 	SDL_Surface *screen_;
+	ColorPipeline* color_;
 public:
-	SDLWindow() : should_show_whitebalance_region_(false), should_call_sdl_quit_(true), w_(1024), h_(768+top_text_height_), screen_(0)
+	SDLWindow() : should_show_whitebalance_region_(false), should_call_sdl_quit_(true), w_(1024), h_(768+top_text_height_), screen_(0), color_(0)
 	{
 		if ( SDL_Init(SDL_INIT_VIDEO) < 0 )
 		{
@@ -182,6 +213,12 @@ public:
 			SDL_Quit();
 	}
 
+	/** Applied to the image by every drawBayerAsRGB() from now on. NULL to show the raw colors. */
+	void setColorPipeline(ColorPipeline* color)
+	{
+		color_ = color;
+	}
+
 	void clear()
 	{
 		clearInternalFramebuffer(screen_);
@@ -204,16 +241,16 @@ public:
 	 * This version does not do any kind of demosaiking, it just takes the 4x4 bayer patch,
 	 * and converts it into a single pixel without any interpolation
 	 * */
-	void drawBayerAsRGB(unsigned char* img, int width_bayer, int height_bayer)
+	void drawBayerAsRGB(const FrameView& frame)
 	{
 		Slock(screen_);
 		//clearInternalFramebuffer();
 
-		drawBayerAsRGB_Internal(img, width_bayer, height_bayer);
+		drawBayerAsRGB_Internal(frame);
 
 		if (should_show_whitebalance_region_)
 		{
-			drawWhitebalanceRegion(img, width_bayer, height_bayer);
+			drawWhitebalanceRegion(frame.width, frame.height);
 		}
 
 		stringRGBA(screen_, 0, 0, "ESC = quit, F1 = take 1 snapshot, F2 = toggle taking snapshots continuously, F3 = set white balance, F4 = cycle resolution", 255, 255, 255, 255);
@@ -0,0 +1,761 @@
+/**
+ * Vectorized conversions of raw bayer frames, shared by the live view and the snapshot code.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "ImageKernels.h"
+#include "ColorPipeline.h"
+#include "CpuFeatures.h"
+#include "SimdHelpers.h"
+#include "WorkerPool.h"
+
+
+namespace ImageKernels {
+
+
+/** Smaller bands cost more in waking up threads than they gain */
+enum { MIN_ROWS_PER_BAND = 32 };
+
+
+//
+// Scalar versions, also used for the pixels at the end of each row not filling a whole vector
+//
+
+static void binRowToRGB24_scalar(const uint8_t* row0, const uint8_t* row1, int x, int out_width, uint8_t* dst)
+{
+	for (; x < out_width; x++)
+	{
+		dst[3*x + 0] = row0[2*x];
+		dst[3*x + 1] = (row0[2*x + 1] + row1[2*x]) / 2;
+		dst[3*x + 2] = row1[2*x + 1];
+	}
+}
+
+
+static void binRowToRGB32_scalar(const uint8_t* row0, const uint8_t* row1, int x, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	for (; x < out_width; x++)
+	{
+		uint32_t R = row0[2*x];
+		uint32_t G = (row0[2*x + 1] + row1[2*x]) / 2;
+		uint32_t B = row1[2*x + 1];
+
+		dst[x] = (R << f.r_shift) | (G << f.g_shift) | (B << f.b_shift) | f.fill;
+	}
+}
+
+
+static void binPlanesToRGB24_scalar(const uint8_t* const* planes, int x, int out_width, uint8_t* dst)
+{
+	for (; x < out_width; x++)
+	{
+		dst[3*x + 0] = planes[FrameView::R][x];
+		dst[3*x + 1] = (planes[FrameView::G1][x] + planes[FrameView::G2][x]) / 2;
+		dst[3*x + 2] = planes[FrameView::B][x];
+	}
+}
+
+
+static void binPlanesToRGB32_scalar(const uint8_t* const* planes, int x, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	for (; x < out_width; x++)
+	{
+		uint32_t R = planes[FrameView::R][x];
+		uint32_t G = (planes[FrameView::G1][x] + planes[FrameView::G2][x]) / 2;
+		uint32_t B = planes[FrameView::B][x];
+
+		dst[x] = (R << f.r_shift) | (G << f.g_shift) | (B << f.b_shift) | f.fill;
+	}
+}
+
+
+/** Even bytes of a mosaic row to one plane row, and odd bytes to another */
+static void splitRow_scalar(const uint8_t* src, int x, int quads, uint8_t* even, uint8_t* odd)
+{
+	for (; x < quads; x++)
+	{
+		even[x] = src[2*x];
+		odd[x] = src[2*x + 1];
+	}
+}
+
+
+static void mergeRow_scalar(const uint8_t* even, const uint8_t* odd, int x, int quads, uint8_t* dst)
+{
+	for (; x < quads; x++)
+	{
+		dst[2*x] = even[x];
+		dst[2*x + 1] = odd[x];
+	}
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+//
+// SSE2 versions, 8 output pixels per iteration. Each quad ends up in 16 bit lanes:
+// R and G1 from the even row, G2 and B from the odd row.
+//
+
+static inline void binQuads_sse2(const uint8_t* row0, const uint8_t* row1, __m128i& r, __m128i& g, __m128i& b)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+
+	__m128i even = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0));
+	__m128i odd  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1));
+
+	r = _mm_and_si128(even, low_bytes);
+	g = _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(even, 8), _mm_and_si128(odd, low_bytes)), 1);
+	b = _mm_srli_epi16(odd, 8);
+}
+
+
+static void binRowToRGB24_sse2(const uint8_t* row0, const uint8_t* row1, int out_width, uint8_t* dst)
+{
+	int x = 0;
+
+	// Each store writes 4 bytes beyond the pixels, which must still be within the row
+	for (; x + 10 <= out_width; x += 8)
+	{
+		__m128i r, g, b;
+		binQuads_sse2(row0 + 2*x, row1 + 2*x, r, g, b);
+
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x),      compactRGB24_sse2(_mm_unpacklo_epi16(rg, b)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x + 12), compactRGB24_sse2(_mm_unpackhi_epi16(rg, b)));
+	}
+
+	binRowToRGB24_scalar(row0, row1, x, out_width, dst);
+}
+
+
+static void binRowToRGB32_sse2(const uint8_t* row0, const uint8_t* row1, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i r_shift = _mm_cvtsi32_si128(f.r_shift);
+	const __m128i g_shift = _mm_cvtsi32_si128(f.g_shift);
+	const __m128i b_shift = _mm_cvtsi32_si128(f.b_shift);
+	const __m128i fill = _mm_set1_epi32(f.fill);
+
+	int x = 0;
+
+	for (; x + 8 <= out_width; x += 8)
+	{
+		__m128i r, g, b;
+		binQuads_sse2(row0 + 2*x, row1 + 2*x, r, g, b);
+
+		__m128i lo = _mm_or_si128(_mm_or_si128(
+				_mm_sll_epi32(_mm_unpacklo_epi16(r, zero), r_shift),
+				_mm_sll_epi32(_mm_unpacklo_epi16(g, zero), g_shift)), _mm_or_si128(
+				_mm_sll_epi32(_mm_unpacklo_epi16(b, zero), b_shift), fill));
+
+		__m128i hi = _mm_or_si128(_mm_or_si128(
+				_mm_sll_epi32(_mm_unpackhi_epi16(r, zero), r_shift),
+				_mm_sll_epi32(_mm_unpackhi_epi16(g, zero), g_shift)), _mm_or_si128(
+				_mm_sll_epi32(_mm_unpackhi_epi16(b, zero), b_shift), fill));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),     lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 4), hi);
+	}
+
+	binRowToRGB32_scalar(row0, row1, x, out_width, dst, f);
+}
+
+
+/** 16 output pixels per iteration, straight from the planes without widening */
+static void binPlanesToRGB24_sse2(const uint8_t* const* planes, int out_width, uint8_t* dst)
+{
+	int x = 0;
+
+	// Each store writes 4 bytes beyond the pixels, which must still be within the row
+	for (; x + 18 <= out_width; x += 16)
+	{
+		__m128i r  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::R] + x));
+		__m128i g1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G1] + x));
+		__m128i g2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G2] + x));
+		__m128i b  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::B] + x));
+
+		storeRGB24_sse2(r, floorMean2_sse2(g1, g2), b, dst + 3*x);
+	}
+
+	binPlanesToRGB24_scalar(planes, x, out_width, dst);
+}
+
+
+static void binPlanesToRGB32_sse2(const uint8_t* const* planes, int out_width, uint32_t* dst, const PixelFormat32& f)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i r_shift = _mm_cvtsi32_si128(f.r_shift);
+	const __m128i g_shift = _mm_cvtsi32_si128(f.g_shift);
+	const __m128i b_shift = _mm_cvtsi32_si128(f.b_shift);
+	const __m128i fill = _mm_set1_epi32(f.fill);
+
+	int x = 0;
+
+	for (; x + 16 <= out_width; x += 16)
+	{
+		__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::R] + x));
+		__m128i g = floorMean2_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G1] + x)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G2] + x)));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::B] + x));
+
+		// Pixels 0-7 and 8-15 in 16 bit lanes
+		__m128i r16[2] = { _mm_unpacklo_epi8(r, zero), _mm_unpackhi_epi8(r, zero) };
+		__m128i g16[2] = { _mm_unpacklo_epi8(g, zero), _mm_unpackhi_epi8(g, zero) };
+		__m128i b16[2] = { _mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero) };
+
+		for (int i = 0; i < 2; i++)
+		{
+			__m128i lo = _mm_or_si128(_mm_or_si128(
+					_mm_sll_epi32(_mm_unpacklo_epi16(r16[i], zero), r_shift),
+					_mm_sll_epi32(_mm_unpacklo_epi16(g16[i], zero), g_shift)), _mm_or_si128(
+					_mm_sll_epi32(_mm_unpacklo_epi16(b16[i], zero), b_shift), fill));
+
+			__m128i hi = _mm_or_si128(_mm_or_si128(
+					_mm_sll_epi32(_mm_unpackhi_epi16(r16[i], zero), r_shift),
+					_mm_sll_epi32(_mm_unpackhi_epi16(g16[i], zero), g_shift)), _mm_or_si128(
+					_mm_sll_epi32(_mm_unpackhi_epi16(b16[i], zero), b_shift), fill));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 8*i),     lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 8*i + 4), hi);
+		}
+	}
+
+	binPlanesToRGB32_scalar(planes, x, out_width, dst, f);
+}
+
+
+/** 16 quads per iteration */
+static void splitRow_sse2(const uint8_t* src, int quads, uint8_t* even, uint8_t* odd)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+
+	int x = 0;
+
+	for (; x + 16 <= quads; x += 16)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*x));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2*x + 16));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(even + x),
+				_mm_packus_epi16(_mm_and_si128(a, low_bytes), _mm_and_si128(b, low_bytes)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(odd + x),
+				_mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+	}
+
+	splitRow_scalar(src, x, quads, even, odd);
+}
+
+
+static void mergeRow_sse2(const uint8_t* even, const uint8_t* odd, int quads, uint8_t* dst)
+{
+	int x = 0;
+
+	for (; x + 16 <= quads; x += 16)
+	{
+		__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(even + x));
+		__m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i*>(odd + x));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*x),      _mm_unpacklo_epi8(e, o));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2*x + 16), _mm_unpackhi_epi8(e, o));
+	}
+
+	mergeRow_scalar(even, odd, x, quads, dst);
+}
+
+
+//
+// AVX2 versions, 16 output pixels per iteration. The unpack instructions work within each
+// 128 bit lane, so the halves are put back in order with a permute.
+//
+
+__attribute__((target("avx2")))
+static inline void binQuads_avx2(const uint8_t* row0, const uint8_t* row1, __m256i& r, __m256i& g, __m256i& b)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+
+	__m256i even = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0));
+	__m256i odd  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1));
+
+	r = _mm256_and_si256(even, low_bytes);
+	g = _mm256_srli_epi16(_mm256_add_epi16(_mm256_srli_epi16(even, 8), _mm256_and_si256(odd, low_bytes)), 1);
+	b = _mm256_srli_epi16(odd, 8);
+}
+
+
+__attribute__((target("avx2")))
+static void binRowToRGB24_avx2(const uint8_t* row0, const uint8_t* row1, int out_width, uint8_t* dst)
+{
+	const __m256i compact = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	int x = 0;
+
+	// The last store writes 4 bytes beyond the pixels, which must still be within the row
+	for (; x + 18 <= out_width; x += 16)
+	{
+		__m256i r, g, b;
+		binQuads_avx2(row0 + 2*x, row1 + 2*x, r, g, b);
+
+		__m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+
+		// Pixels 0-3 and 8-11, and pixels 4-7 and 12-15
+		__m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, b), compact);
+		__m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, b), compact);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x),      _mm256_castsi256_si128(lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x + 12), _mm256_castsi256_si128(hi));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x + 24), _mm256_extracti128_si256(lo, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3*x + 36), _mm256_extracti128_si256(hi, 1));
+	}
+
+	binRowToRGB24_scalar(row0, row1, x, out_width, dst);
+}
+
+
+__attribute__((target("avx2")))
+static void binRowToRGB32_avx2(const uint8_t* row0, const uint8_t* row1, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m128i r_shift = _mm_cvtsi32_si128(f.r_shift);
+	const __m128i g_shift = _mm_cvtsi32_si128(f.g_shift);
+	const __m128i b_shift = _mm_cvtsi32_si128(f.b_shift);
+	const __m256i fill = _mm256_set1_epi32(f.fill);
+
+	int x = 0;
+
+	for (; x + 16 <= out_width; x += 16)
+	{
+		__m256i r, g, b;
+		binQuads_avx2(row0 + 2*x, row1 + 2*x, r, g, b);
+
+		__m256i lo = _mm256_or_si256(_mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(r, zero), r_shift),
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(g, zero), g_shift)), _mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(b, zero), b_shift), fill));
+
+		__m256i hi = _mm256_or_si256(_mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(r, zero), r_shift),
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(g, zero), g_shift)), _mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(b, zero), b_shift), fill));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),     _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	binRowToRGB32_scalar(row0, row1, x, out_width, dst, f);
+}
+
+
+__attribute__((target("avx2")))
+static void binPlanesToRGB24_avx2(const uint8_t* const* planes, int out_width, uint8_t* dst)
+{
+	int x = 0;
+
+	// The last store writes 4 bytes beyond the pixels, which must still be within the row
+	for (; x + 34 <= out_width; x += 32)
+	{
+		__m256i r  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::R] + x));
+		__m256i g1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G1] + x));
+		__m256i g2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G2] + x));
+		__m256i b  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::B] + x));
+
+		storeRGB24_avx2(r, floorMean2_avx2(g1, g2), b, dst + 3*x);
+	}
+
+	binPlanesToRGB24_scalar(planes, x, out_width, dst);
+}
+
+
+__attribute__((target("avx2")))
+static void binPlanesToRGB32_avx2(const uint8_t* const* planes, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m128i r_shift = _mm_cvtsi32_si128(f.r_shift);
+	const __m128i g_shift = _mm_cvtsi32_si128(f.g_shift);
+	const __m128i b_shift = _mm_cvtsi32_si128(f.b_shift);
+	const __m256i fill = _mm256_set1_epi32(f.fill);
+
+	int x = 0;
+
+	for (; x + 16 <= out_width; x += 16)
+	{
+		__m128i g8 = floorMean2_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G1] + x)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[FrameView::G2] + x)));
+
+		// In order in 16 bit lanes, the same as binQuads_avx2() gives
+		__m256i r = loadWiden16_avx2(planes[FrameView::R] + x);
+		__m256i g = _mm256_cvtepu8_epi16(g8);
+		__m256i b = loadWiden16_avx2(planes[FrameView::B] + x);
+
+		__m256i lo = _mm256_or_si256(_mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(r, zero), r_shift),
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(g, zero), g_shift)), _mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpacklo_epi16(b, zero), b_shift), fill));
+
+		__m256i hi = _mm256_or_si256(_mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(r, zero), r_shift),
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(g, zero), g_shift)), _mm256_or_si256(
+				_mm256_sll_epi32(_mm256_unpackhi_epi16(b, zero), b_shift), fill));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),     _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	binPlanesToRGB32_scalar(planes, x, out_width, dst, f);
+}
+
+
+/** 32 quads per iteration */
+__attribute__((target("avx2")))
+static void splitRow_avx2(const uint8_t* src, int quads, uint8_t* even, uint8_t* odd)
+{
+	const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+
+	int x = 0;
+
+	for (; x + 32 <= quads; x += 32)
+	{
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2*x));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2*x + 32));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(even + x),
+				packus16_avx2(_mm256_and_si256(a, low_bytes), _mm256_and_si256(b, low_bytes)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(odd + x),
+				packus16_avx2(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)));
+	}
+
+	splitRow_scalar(src, x, quads, even, odd);
+}
+
+
+__attribute__((target("avx2")))
+static void mergeRow_avx2(const uint8_t* even, const uint8_t* odd, int quads, uint8_t* dst)
+{
+	int x = 0;
+
+	for (; x + 32 <= quads; x += 32)
+	{
+		__m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(even + x));
+		__m256i o = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(odd + x));
+
+		// Quads 0-7 and 16-23, and quads 8-15 and 24-31
+		__m256i lo = _mm256_unpacklo_epi8(e, o);
+		__m256i hi = _mm256_unpackhi_epi8(e, o);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2*x),      _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2*x + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	mergeRow_scalar(even, odd, x, quads, dst);
+}
+
+
+//
+// AVX-512 versions of the 32 bit conversions, 32 output pixels per iteration. The other
+// kernels are limited by the 3 byte stores or by memory, measured no faster (the layout
+// changes slower) with the wider vectors, and use AVX2.
+//
+
+__attribute__((target("avx512f,avx512bw")))
+static inline void binQuads_avx512(const uint8_t* row0, const uint8_t* row1, __m512i& r, __m512i& g, __m512i& b)
+{
+	const __m512i low_bytes = _mm512_set1_epi16(0x00FF);
+
+	__m512i even = _mm512_loadu_si512(row0);
+	__m512i odd  = _mm512_loadu_si512(row1);
+
+	r = _mm512_and_si512(even, low_bytes);
+	g = _mm512_srli_epi16(_mm512_add_epi16(_mm512_srli_epi16(even, 8), _mm512_and_si512(odd, low_bytes)), 1);
+	b = _mm512_srli_epi16(odd, 8);
+}
+
+
+/**
+ * Writes 32 pixels from r, g and b, which hold one 16 bit value per pixel, in order.
+ * Zero masked intrinsics throughout, see lowHalf_avx512().
+ */
+__attribute__((target("avx512f,avx512bw")))
+static inline void storeRGB32_avx512(__m512i r, __m512i g, __m512i b, uint32_t* dst, const PixelFormat32& f)
+{
+	const __m128i r_shift = _mm_cvtsi32_si128(f.r_shift);
+	const __m128i g_shift = _mm_cvtsi32_si128(f.g_shift);
+	const __m128i b_shift = _mm_cvtsi32_si128(f.b_shift);
+	const __m512i fill = _mm512_set1_epi32(f.fill);
+
+	__m512i lo = _mm512_or_si512(_mm512_or_si512(
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, lowHalf_avx512(r)), r_shift),
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, lowHalf_avx512(g)), g_shift)),
+			_mm512_or_si512(
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, lowHalf_avx512(b)), b_shift), fill));
+
+	__m512i hi = _mm512_or_si512(_mm512_or_si512(
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, highHalf_avx512(r)), r_shift),
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, highHalf_avx512(g)), g_shift)),
+			_mm512_or_si512(
+			_mm512_maskz_sll_epi32(0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, highHalf_avx512(b)), b_shift), fill));
+
+	_mm512_storeu_si512(dst,      lo);
+	_mm512_storeu_si512(dst + 16, hi);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void binRowToRGB32_avx512(const uint8_t* row0, const uint8_t* row1, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	int x = 0;
+
+	for (; x + 32 <= out_width; x += 32)
+	{
+		__m512i r, g, b;
+		binQuads_avx512(row0 + 2*x, row1 + 2*x, r, g, b);
+		storeRGB32_avx512(r, g, b, dst + x, f);
+	}
+
+	binRowToRGB32_scalar(row0, row1, x, out_width, dst, f);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+static void binPlanesToRGB32_avx512(const uint8_t* const* planes, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	int x = 0;
+
+	for (; x + 32 <= out_width; x += 32)
+	{
+		__m256i g8 = floorMean2_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G1] + x)),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[FrameView::G2] + x)));
+
+		storeRGB32_avx512(loadWiden16_avx512(planes[FrameView::R] + x), _mm512_cvtepu8_epi16(g8),
+				loadWiden16_avx512(planes[FrameView::B] + x), dst + x, f);
+	}
+
+	binPlanesToRGB32_scalar(planes, x, out_width, dst, f);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+static void binRowToRGB24_generic(const uint8_t* row0, const uint8_t* row1, int out_width, uint8_t* dst)
+{
+	binRowToRGB24_scalar(row0, row1, 0, out_width, dst);
+}
+
+
+static void binRowToRGB32_generic(const uint8_t* row0, const uint8_t* row1, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	binRowToRGB32_scalar(row0, row1, 0, out_width, dst, f);
+}
+
+
+static void binPlanesToRGB24_generic(const uint8_t* const* planes, int out_width, uint8_t* dst)
+{
+	binPlanesToRGB24_scalar(planes, 0, out_width, dst);
+}
+
+
+static void binPlanesToRGB32_generic(const uint8_t* const* planes, int out_width, uint32_t* dst,
+		const PixelFormat32& f)
+{
+	binPlanesToRGB32_scalar(planes, 0, out_width, dst, f);
+}
+
+
+static void splitRow_generic(const uint8_t* src, int quads, uint8_t* even, uint8_t* odd)
+{
+	splitRow_scalar(src, 0, quads, even, odd);
+}
+
+
+static void mergeRow_generic(const uint8_t* even, const uint8_t* odd, int quads, uint8_t* dst)
+{
+	mergeRow_scalar(even, odd, 0, quads, dst);
+}
+
+
+/** The row kernels of one instruction set */
+struct Kernels {
+	const char* name;
+	void (*binRowToRGB24)(const uint8_t* row0, const uint8_t* row1, int out_width, uint8_t* dst);
+	void (*binRowToRGB32)(const uint8_t* row0, const uint8_t* row1, int out_width, uint32_t* dst, const PixelFormat32& f);
+	void (*binPlanesToRGB24)(const uint8_t* const* planes, int out_width, uint8_t* dst);
+	void (*binPlanesToRGB32)(const uint8_t* const* planes, int out_width, uint32_t* dst, const PixelFormat32& f);
+	void (*splitRow)(const uint8_t* src, int quads, uint8_t* even, uint8_t* odd);
+	void (*mergeRow)(const uint8_t* even, const uint8_t* odd, int quads, uint8_t* dst);
+};
+
+
+static Kernels selectKernels()
+{
+#ifdef HAVE_X86_KERNELS
+	const CpuFeatures::Level level = CpuFeatures::getLevel();
+
+	if (level >= CpuFeatures::AVX512)
+	{
+		Kernels avx512 = { "avx512", binRowToRGB24_avx2, binRowToRGB32_avx512, binPlanesToRGB24_avx2,
+				binPlanesToRGB32_avx512, splitRow_avx2, mergeRow_avx2 };
+		return avx512;
+	}
+
+	if (level >= CpuFeatures::AVX2)
+	{
+		Kernels avx2 = { "avx2", binRowToRGB24_avx2, binRowToRGB32_avx2, binPlanesToRGB24_avx2, binPlanesToRGB32_avx2,
+				splitRow_avx2, mergeRow_avx2 };
+		return avx2;
+	}
+
+	if (level >= CpuFeatures::SSE2)
+	{
+		Kernels sse2 = { "sse2", binRowToRGB24_sse2, binRowToRGB32_sse2, binPlanesToRGB24_sse2, binPlanesToRGB32_sse2,
+				splitRow_sse2, mergeRow_sse2 };
+		return sse2;
+	}
+#endif
+
+	Kernels scalar = { "scalar", binRowToRGB24_generic, binRowToRGB32_generic, binPlanesToRGB24_generic,
+			binPlanesToRGB32_generic, splitRow_generic, mergeRow_generic };
+	return scalar;
+}
+
+
+static const Kernels kernels = selectKernels();
+
+
+/** One conversion of a whole frame, split into bands of output rows */
+struct BinJob {
+	const FrameView* frame;
+	unsigned char* dst;
+	int dst_pitch;
+	const PixelFormat32* format;
+	const ColorPipeline* color; ///< NULL when there is nothing to apply
+
+	static void binToRGB24(void* context, int first_row, int end_row)
+	{
+		BinJob* j = static_cast<BinJob*>(context);
+		const FrameView& f = *j->frame;
+
+		for (int y = first_row; y < end_row; y++)
+		{
+			unsigned char* row = j->dst + y*j->dst_pitch;
+
+			if (f.layout == FrameView::PLANAR)
+			{
+				const uint8_t* planes[FrameView::NUM_PLANES];
+				int step;
+				f.getQuadRow(y, planes, step);
+				kernels.binPlanesToRGB24(planes, f.getQuadWidth(), row);
+			}
+			else
+			{
+				kernels.binRowToRGB24(f.getRow(2*y), f.getRow(2*y + 1), f.getQuadWidth(), row);
+			}
+
+			if (j->color)
+			{
+				j->color->applyRGB24(row, f.getQuadWidth());
+			}
+		}
+	}
+
+	static void binToRGB32(void* context, int first_row, int end_row)
+	{
+		BinJob* j = static_cast<BinJob*>(context);
+		const FrameView& f = *j->frame;
+
+		for (int y = first_row; y < end_row; y++)
+		{
+			uint32_t* row = reinterpret_cast<uint32_t*>(j->dst + y*j->dst_pitch);
+
+			if (f.layout == FrameView::PLANAR)
+			{
+				const uint8_t* planes[FrameView::NUM_PLANES];
+				int step;
+				f.getQuadRow(y, planes, step);
+				kernels.binPlanesToRGB32(planes, f.getQuadWidth(), row, *j->format);
+			}
+			else
+			{
+				kernels.binRowToRGB32(f.getRow(2*y), f.getRow(2*y + 1), f.getQuadWidth(), row, *j->format);
+			}
+
+			if (j->color)
+			{
+				j->color->applyRGB32(row, f.getQuadWidth(), *j->format);
+			}
+		}
+	}
+};
+
+
+/** @return color, or NULL if it would not change anything */
+static const ColorPipeline* prepareColor(ColorPipeline* color)
+{
+	return color && !color->isIdentity() ? color : 0;
+}
+
+
+void binBayer2x2ToRGB24(const FrameView& frame, unsigned char* dst, int dst_pitch, ColorPipeline* color)
+{
+	BinJob job = { &frame, dst, dst_pitch, 0, prepareColor(color) };
+	WorkerPool::getDefault().runBands(frame.getQuadHeight(), MIN_ROWS_PER_BAND, BinJob::binToRGB24, &job);
+}
+
+
+void binBayer2x2ToRGB32(const FrameView& frame, unsigned char* dst, int dst_pitch, const PixelFormat32& format,
+		ColorPipeline* color)
+{
+	BinJob job = { &frame, dst, dst_pitch, &format, prepareColor(color) };
+	WorkerPool::getDefault().runBands(frame.getQuadHeight(), MIN_ROWS_PER_BAND, BinJob::binToRGB32, &job);
+}
+
+
+void deinterleaveBayer(const unsigned char* bayer, int width, int height, unsigned char* planes)
+{
+	const int quads = width / 2;
+	const size_t plane_size = size_t(quads) * (height / 2);
+
+	for (int qy = 0; qy < height / 2; qy++)
+	{
+		unsigned char* r = planes + qy*quads;
+
+		kernels.splitRow(bayer + (2*qy) * width, quads, r, r + plane_size);
+		kernels.splitRow(bayer + (2*qy + 1) * width, quads, r + 2*plane_size, r + 3*plane_size);
+	}
+}
+
+
+void interleaveBayer(const FrameView& frame, unsigned char* bayer)
+{
+	const int width = frame.width;
+
+	for (int qy = 0; qy < frame.getQuadHeight(); qy++)
+	{
+		kernels.mergeRow(frame.getPlaneRow(FrameView::R, qy), frame.getPlaneRow(FrameView::G1, qy),
+				frame.getQuadWidth(), bayer + (2*qy) * width);
+		kernels.mergeRow(frame.getPlaneRow(FrameView::G2, qy), frame.getPlaneRow(FrameView::B, qy),
+				frame.getQuadWidth(), bayer + (2*qy + 1) * width);
+	}
+}
+
+
+const char* getImplementationName()
+{
+	return kernels.name;
+}
+
+
+} // ImageKernels
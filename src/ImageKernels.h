@@ -0,0 +1,65 @@
+/**
+ * Vectorized conversions of raw bayer frames, shared by the live view and the snapshot code.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef IMAGEKERNELS_H_
+#define IMAGEKERNELS_H_
+
+#include <stdint.h>
+
+#include "FrameView.h"
+
+class ColorPipeline;
+
+
+namespace ImageKernels {
+
+
+/** Where red, green and blue go in 32 bit pixels, such as those of an SDL_Surface */
+struct PixelFormat32 {
+	int r_shift;
+	int g_shift;
+	int b_shift;
+	uint32_t fill; ///< Or:ed into every pixel, e.g. to make an alpha channel opaque
+};
+
+
+/**
+ * Turns each 2x2 RGGB quad of a bayer image into one pixel, without any interpolation:
+ * R and B as is, and G = (G1 + G2) / 2 (rounded down).
+ *
+ * @param frame In either layout
+ * @param dst Receives (width/2) x (height/2) pixels, 3 bytes (R, G, B) each
+ * @param dst_pitch Number of bytes between the starts of two rows in dst
+ * @param color When not NULL, applied to each row right after binning it
+ */
+void binBayer2x2ToRGB24(const FrameView& frame, unsigned char* dst, int dst_pitch, ColorPipeline* color = 0);
+
+/** Same as binBayer2x2ToRGB24(), but writing 32 bit pixels laid out as described by format */
+void binBayer2x2ToRGB32(const FrameView& frame, unsigned char* dst, int dst_pitch, const PixelFormat32& format,
+		ColorPipeline* color = 0);
+
+/**
+ * Splits an interleaved bayer frame into the planes of FrameView::PLANAR.
+ * Runs in the calling thread only, since it is meant for the capture thread.
+ *
+ * @param planes Receives width x height bytes
+ */
+void deinterleaveBayer(const unsigned char* bayer, int width, int height, unsigned char* planes);
+
+/** The opposite of deinterleaveBayer(), for whatever needs the mosaic (raw snapshots, demosaicing) */
+void interleaveBayer(const FrameView& frame, unsigned char* bayer);
+
+/** @return name of the instruction set used ("avx512", "avx2", "sse2" or "scalar", see CpuFeatures) */
+const char* getImplementationName();
+
+
+} // ImageKernels
+
+
+#endif /* IMAGEKERNELS_H_ */
@@ -0,0 +1,149 @@
+/**
+ * Lock-free mailbox holding the latest value of a small struct (a seqlock).
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+
+/**
+ * Any number of threads can update the value, and any number of threads can read it,
+ * without readers ever taking a lock or seeing a half written value.
+ *
+ * Writers make the version odd while writing, and readers retry when the version was odd or
+ * changed while they copied the value. The value is kept in relaxed atomic words, so copying it
+ * concurrently with a writer is well defined.
+ *
+ * @note T must be trivially copyable
+ */
+template <class T>
+class Mailbox {
+public:
+	explicit Mailbox(const T& initial = T()) :
+		version_(0)
+	{
+		storeWords(initial);
+	}
+
+	/**
+	 * Replaces the value with the one f makes of it, atomically with respect to other writers
+	 * (so concurrent updates of different fields never undo each other). f must not block.
+	 * The version only changes if f actually changed the value.
+	 */
+	template <class F>
+	void update(F f)
+	{
+		uint64_t version = version_.load(std::memory_order_relaxed);
+
+		// Writers take turns by making the version odd
+		while ((version & 1) || !version_.compare_exchange_weak(version, version + 1, std::memory_order_acquire))
+		{
+			if (version & 1)
+			{
+				std::this_thread::yield();
+				version = version_.load(std::memory_order_relaxed);
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_release);
+
+		T value;
+		loadWords(value);
+
+		T previous = value;
+		f(value);
+
+		// Setters are called every frame with mostly the same values, which should not look like news
+		if (memcmp(&previous, &value, sizeof(T)) == 0)
+		{
+			version_.store(version, std::memory_order_release);
+			return;
+		}
+
+		storeWords(value);
+
+		version_.store(version + 2, std::memory_order_release);
+	}
+
+	void publish(const T& value)
+	{
+		update([&value](T& current) { current = value; });
+	}
+
+	/**
+	 * Copies the latest value into value.
+	 * @return the version of that value (see getVersion())
+	 */
+	uint64_t read(T& value) const
+	{
+		for (;;)
+		{
+			uint64_t version = version_.load(std::memory_order_acquire);
+
+			if (version & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			loadWords(value);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (version_.load(std::memory_order_relaxed) == version)
+			{
+				return version / 2;
+			}
+		}
+	}
+
+	/** @return a number increasing with every update that changed the value, for cheaply checking for changes */
+	uint64_t getVersion() const { return version_.load(std::memory_order_acquire) / 2; }
+
+private:
+	enum { NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+	std::atomic<uint64_t> version_;
+	std::atomic<uint64_t> words_[NUM_WORDS];
+
+	void loadWords(T& value) const
+	{
+		uint64_t words[NUM_WORDS];
+
+		for (int i = 0; i < NUM_WORDS; i++)
+		{
+			words[i] = words_[i].load(std::memory_order_relaxed);
+		}
+
+		memcpy(&value, words, sizeof(T));
+	}
+
+	void storeWords(const T& value)
+	{
+		uint64_t words[NUM_WORDS] = { 0 };
+
+		memcpy(words, &value, sizeof(T));
+
+		for (int i = 0; i < NUM_WORDS; i++)
+		{
+			words_[i].store(words[i], std::memory_order_relaxed);
+		}
+	}
+
+	Mailbox(const Mailbox&);
+	Mailbox& operator=(const Mailbox&);
+};
+
+
+#endif /* MAILBOX_H_ */
@@ -0,0 +1,420 @@
+/**
+ * One file holding every frame of a recording, with the metadata of each frame and an index.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "SequenceFile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static uint64_t roundUpToPage(uint64_t size)
+{
+	return (size + SEQUENCE_PAGE_SIZE - 1) / SEQUENCE_PAGE_SIZE * SEQUENCE_PAGE_SIZE;
+}
+
+
+SequenceWriter::SequenceWriter(int framesInFlight) :
+	writer_(2 * (framesInFlight > 0 ? framesInFlight : 1)), // The record and the image of each frame
+	dropped_(0)
+{
+	// About ten minutes at 25 fps before the index grows in the middle of a recording
+	index_.reserve(16384);
+}
+
+
+SequenceWriter::~SequenceWriter()
+{
+	close();
+}
+
+
+int SequenceWriter::open(const char* filename, bool direct, FramePool* pool)
+{
+	index_.clear();
+	dropped_ = 0;
+
+	if (writer_.open(filename, direct, pool) < 0)
+	{
+		return -1;
+	}
+
+	unsigned char page[SEQUENCE_PAGE_SIZE];
+	memset(page, 0, sizeof(page));
+
+	SequenceHeader* header = reinterpret_cast<SequenceHeader*>(page);
+	memcpy(header->magic, SEQUENCE_MAGIC, sizeof(header->magic));
+	header->version = SEQUENCE_VERSION;
+	header->page_size = SEQUENCE_PAGE_SIZE;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	header->created_ns = uint64_t(now.tv_sec) * 1000000000u + now.tv_nsec;
+	header->monotonic_ns = monotonicNanoseconds();
+
+	if (writer_.append(page, sizeof(page)) < 0)
+	{
+		writer_.close();
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int SequenceWriter::append(const FrameRef& frame)
+{
+	if (!writer_.isOpen())
+	{
+		return -1;
+	}
+
+	// Everything which could keep the image from being queued is checked before the record is.
+	// A record without its image would send a reader walking the records into the next record.
+	const size_t payload_size = roundUpToPage(frame->size);
+
+	if (payload_size > frame->pool->getBufferSize() || !writer_.hasRoom(2))
+	{
+		dropped_++;
+		return -1;
+	}
+
+	unsigned char page[SEQUENCE_PAGE_SIZE];
+	memset(page, 0, sizeof(page));
+
+	const FrameMetadata& meta = frame->meta;
+	const uint64_t offset = writer_.getSize();
+
+	SequenceFrameRecord* record = reinterpret_cast<SequenceFrameRecord*>(page);
+	record->tag = SEQUENCE_RECORD_TAG;
+	record->frame_number = index_.size();
+	record->payload_offset = offset + SEQUENCE_PAGE_SIZE;
+	record->payload_size = frame->size;
+	record->layout = frame->layout;
+
+	record->sequence = meta.sequence;
+	record->header_sent_ns = meta.header_sent_ns;
+	record->last_byte_ns = meta.last_byte_ns;
+	record->width = frame->width;
+	record->height = frame->height;
+	record->crop_x = meta.crop_x;
+	record->crop_y = meta.crop_y;
+	record->exposure = meta.exposure;
+	record->red_gain = meta.red_gain;
+	record->green_gain = meta.green_gain;
+	record->blue_gain = meta.blue_gain;
+	record->red_offset = meta.red_offset;
+	record->green_offset = meta.green_offset;
+	record->blue_offset = meta.blue_offset;
+	record->status_length = meta.status_length;
+	record->trailer_length = meta.trailer_length;
+	memcpy(record->status, meta.status, sizeof(record->status));
+	memcpy(record->trailer, meta.trailer, sizeof(record->trailer));
+
+	if (writer_.append(page, sizeof(page)) < 0)
+	{
+		dropped_++;
+		return -1;
+	}
+
+	// Frame buffers are whole pages, so the padding is written straight from the buffer as well.
+	// Can not be rejected after the checks above.
+	writer_.append(frame, payload_size);
+
+	SequenceIndexEntry entry;
+	entry.record_offset = offset;
+	entry.sequence = meta.sequence;
+	entry.last_byte_ns = meta.last_byte_ns;
+	index_.push_back(entry);
+
+	return record->frame_number;
+}
+
+
+int SequenceWriter::close()
+{
+	if (!writer_.isOpen())
+	{
+		return 0;
+	}
+
+	// The footer goes last in the file, after the index and the padding up to the next page
+	const size_t index_size = index_.size() * sizeof(SequenceIndexEntry);
+	std::vector<unsigned char> tail(roundUpToPage(index_size + sizeof(SequenceFooter)), 0);
+
+	if (index_size > 0)
+	{
+		memcpy(&tail[0], &index_[0], index_size);
+	}
+
+	SequenceFooter* footer = reinterpret_cast<SequenceFooter*>(&tail[tail.size() - sizeof(SequenceFooter)]);
+	footer->index_offset = writer_.getSize();
+	footer->num_frames = index_.size();
+	memcpy(footer->magic, SEQUENCE_INDEX_MAGIC, sizeof(footer->magic));
+
+	// Makes room for the index, however many frames were in flight
+	int rc = writer_.flush();
+
+	if (writer_.append(&tail[0], tail.size()) < 0)
+	{
+		rc = -1;
+	}
+
+	if (writer_.close() < 0)
+	{
+		rc = -1;
+	}
+
+	return rc;
+}
+
+
+void SequenceWriter::print(FILE* out)
+{
+	writer_.print(out);
+	fprintf(out, "  frames: %lu recorded, %lu dropped\n", getFrames(), dropped_);
+}
+
+
+SequenceReader::SequenceReader() :
+	data_(0),
+	size_(0),
+	index_(0),
+	num_frames_(0),
+	has_index_(false)
+{
+
+}
+
+
+SequenceReader::~SequenceReader()
+{
+	close();
+}
+
+
+int SequenceReader::open(const char* filename)
+{
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+
+	if (fd < 0)
+	{
+		printf("Could not open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < SEQUENCE_PAGE_SIZE)
+	{
+		printf("%s is not a sequence file\n", filename);
+		::close(fd);
+		return -1;
+	}
+
+	void* data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd); // The mapping keeps the file open
+
+	if (data == MAP_FAILED)
+	{
+		printf("Could not map %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	data_ = static_cast<const unsigned char*>(data);
+	size_ = st.st_size;
+
+	const SequenceHeader& header = getHeader();
+
+	if (memcmp(header.magic, SEQUENCE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != SEQUENCE_VERSION || header.page_size != SEQUENCE_PAGE_SIZE)
+	{
+		printf("%s is not a sequence file (or from another version)\n", filename);
+		close();
+		return -1;
+	}
+
+	const SequenceFooter* footer = 0;
+
+	if (size_ % SEQUENCE_PAGE_SIZE == 0 && size_ >= 2 * SEQUENCE_PAGE_SIZE)
+	{
+		footer = reinterpret_cast<const SequenceFooter*>(data_ + size_ - sizeof(SequenceFooter));
+
+		const uint64_t index_end = size_ - sizeof(SequenceFooter);
+
+		if (memcmp(footer->magic, SEQUENCE_INDEX_MAGIC, sizeof(footer->magic)) != 0 ||
+				footer->index_offset < SEQUENCE_PAGE_SIZE || footer->index_offset % SEQUENCE_PAGE_SIZE != 0 ||
+				footer->index_offset > index_end ||
+				footer->num_frames > (index_end - footer->index_offset) / sizeof(SequenceIndexEntry))
+		{
+			footer = 0;
+		}
+	}
+
+	if (footer)
+	{
+		index_ = reinterpret_cast<const SequenceIndexEntry*>(data_ + footer->index_offset);
+		num_frames_ = footer->num_frames;
+		has_index_ = true;
+
+		// Only the index itself is read, so this stays quick however large the frames are
+		for (int i = 0; i < num_frames_; i++)
+		{
+			if (index_[i].record_offset % SEQUENCE_PAGE_SIZE != 0 ||
+					index_[i].record_offset + SEQUENCE_PAGE_SIZE > footer->index_offset)
+			{
+				printf("%s has a damaged index (frame %d)\n", filename, i);
+				close();
+				return -1;
+			}
+		}
+	}
+	else
+	{
+		rebuildIndex();
+		printf("%s was not closed properly, found %d frames without the index\n", filename, num_frames_);
+	}
+
+	return 0;
+}
+
+
+void SequenceReader::close()
+{
+	if (data_)
+	{
+		munmap(const_cast<unsigned char*>(data_), size_);
+	}
+
+	data_ = 0;
+	size_ = 0;
+	index_ = 0;
+	num_frames_ = 0;
+	has_index_ = false;
+	rebuilt_index_.clear();
+}
+
+
+const SequenceFrameRecord& SequenceReader::getRecord(int frame)
+{
+	return *reinterpret_cast<const SequenceFrameRecord*>(data_ + index_[frame].record_offset);
+}
+
+
+void SequenceReader::getMetadata(int frame, FrameMetadata& meta)
+{
+	const SequenceFrameRecord& record = getRecord(frame);
+
+	meta.sequence = record.sequence;
+	meta.header_sent_ns = record.header_sent_ns;
+	meta.last_byte_ns = record.last_byte_ns;
+	meta.width = record.width;
+	meta.height = record.height;
+	meta.crop_x = record.crop_x;
+	meta.crop_y = record.crop_y;
+	meta.exposure = record.exposure;
+	meta.red_gain = record.red_gain;
+	meta.green_gain = record.green_gain;
+	meta.blue_gain = record.blue_gain;
+	meta.red_offset = record.red_offset;
+	meta.green_offset = record.green_offset;
+	meta.blue_offset = record.blue_offset;
+	meta.status_length = record.status_length;
+	meta.trailer_length = record.trailer_length;
+	memcpy(meta.status, record.status, sizeof(meta.status));
+	memcpy(meta.trailer, record.trailer, sizeof(meta.trailer));
+}
+
+
+FrameView SequenceReader::getFrame(int frame)
+{
+	const SequenceFrameRecord& record = getRecord(frame);
+
+	// A record pointing outside the file (or at too little data) gives an empty view
+	if (record.tag != SEQUENCE_RECORD_TAG || record.payload_offset + record.payload_size > size_ ||
+			uint64_t(record.width) * record.height > record.payload_size)
+	{
+		return FrameView(0, 0, 0);
+	}
+
+	return FrameView(data_ + record.payload_offset, record.width, record.height, FrameView::Layout(record.layout));
+}
+
+
+int SequenceReader::findSequence(uint64_t sequence)
+{
+	// Frames are recorded in the order they were captured
+	int first = 0;
+	int last = num_frames_;
+
+	while (first < last)
+	{
+		int middle = first + (last - first) / 2;
+
+		if (index_[middle].sequence < sequence)
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			last = middle;
+		}
+	}
+
+	return first < num_frames_ ? first : -1;
+}
+
+
+bool SequenceReader::isValidRecord(uint64_t offset)
+{
+	if (offset + SEQUENCE_PAGE_SIZE > size_)
+	{
+		return false;
+	}
+
+	const SequenceFrameRecord& record = *reinterpret_cast<const SequenceFrameRecord*>(data_ + offset);
+
+	return record.tag == SEQUENCE_RECORD_TAG &&
+			record.frame_number == rebuilt_index_.size() &&
+			record.payload_offset == offset + SEQUENCE_PAGE_SIZE &&
+			record.payload_offset + record.payload_size <= size_;
+}
+
+
+/**
+ * Walks the frame records from the start of the file, until one is missing (where the
+ * recording stopped, or a write never completed).
+ */
+void SequenceReader::rebuildIndex()
+{
+	rebuilt_index_.clear();
+
+	for (uint64_t offset = SEQUENCE_PAGE_SIZE; isValidRecord(offset); )
+	{
+		const SequenceFrameRecord& record = *reinterpret_cast<const SequenceFrameRecord*>(data_ + offset);
+
+		SequenceIndexEntry entry;
+		entry.record_offset = offset;
+		entry.sequence = record.sequence;
+		entry.last_byte_ns = record.last_byte_ns;
+		rebuilt_index_.push_back(entry);
+
+		offset = record.payload_offset + roundUpToPage(record.payload_size);
+	}
+
+	index_ = rebuilt_index_.empty() ? 0 : &rebuilt_index_[0];
+	num_frames_ = rebuilt_index_.size();
+	has_index_ = false;
+}
@@ -0,0 +1,205 @@
+/**
+ * One file holding every frame of a recording, with the metadata of each frame and an index.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SEQUENCEFILE_H_
+#define SEQUENCEFILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "FrameMetadata.h"
+#include "FramePool.h"
+#include "FrameView.h"
+#include "UringWriter.h"
+
+
+/**
+ * On-disk layout of a sequence file. Everything is stored in host byte order, and every part
+ * starts at a multiple of SEQUENCE_PAGE_SIZE, so frames can be written with O_DIRECT straight
+ * from their buffers, and mapped by the reader without copying:
+ *
+ *   SequenceHeader                      padded to one page
+ *   SequenceFrameRecord, frame 0        padded to one page
+ *   image data of frame 0               padded to whole pages
+ *   SequenceFrameRecord, frame 1
+ *   ...
+ *   SequenceIndexEntry for each frame
+ *   SequenceFooter                      in the last bytes of the file, ending on a page boundary
+ *
+ * The index is only written when the recording is closed. A file without it (e.g. after a crash)
+ * can still be read, by walking the frame records from the start.
+ */
+#define SEQUENCE_MAGIC "DLC300S1"
+#define SEQUENCE_INDEX_MAGIC "DLC300SI"
+
+enum {
+	SEQUENCE_VERSION = 1,
+	SEQUENCE_PAGE_SIZE = 4096,
+	SEQUENCE_RECORD_TAG = 0x46435344 ///< "DSCF" in a little endian file, starting every frame record
+};
+
+struct SequenceHeader {
+	char     magic[8];      ///< SEQUENCE_MAGIC, not NUL terminated
+	uint32_t version;       ///< SEQUENCE_VERSION
+	uint32_t page_size;     ///< SEQUENCE_PAGE_SIZE
+	uint64_t created_ns;    ///< CLOCK_REALTIME when the recording started
+	uint64_t monotonic_ns;  ///< CLOCK_MONOTONIC at the same time, to relate the frame timestamps to created_ns
+};
+
+struct SequenceFrameRecord {
+	uint32_t tag;            ///< SEQUENCE_RECORD_TAG
+	uint32_t frame_number;   ///< Position in the file, counting from 0
+	uint64_t payload_offset; ///< Where the image data starts (the page after this record)
+	uint32_t payload_size;   ///< Number of image bytes (the padding after them is not included)
+	uint32_t layout;         ///< FrameView::Layout
+
+	// FrameMetadata, field by field so the layout does not depend on the struct
+	uint64_t sequence;
+	uint64_t header_sent_ns;
+	uint64_t last_byte_ns;
+	int32_t  width;
+	int32_t  height;
+	int32_t  crop_x;
+	int32_t  crop_y;
+	uint16_t exposure;
+	uint8_t  red_gain;
+	uint8_t  green_gain;
+	uint8_t  blue_gain;
+	int8_t   red_offset;
+	int8_t   green_offset;
+	int8_t   blue_offset;
+	uint16_t status_length;
+	uint16_t trailer_length;
+	uint8_t  status[FrameMetadata::STATUS_SIZE];
+	uint8_t  trailer[FrameMetadata::TRAILER_SIZE];
+};
+
+/** What finding, ordering and seeking among the frames needs, without touching their records */
+struct SequenceIndexEntry {
+	uint64_t record_offset; ///< Of the SequenceFrameRecord
+	uint64_t sequence;      ///< Same as in the record
+	uint64_t last_byte_ns;  ///< Same as in the record
+};
+
+struct SequenceFooter {
+	uint64_t index_offset;  ///< Of the first SequenceIndexEntry
+	uint64_t num_frames;    ///< Number of index entries
+	char     magic[8];      ///< SEQUENCE_INDEX_MAGIC, last in the file
+};
+
+
+/**
+ * Records frames into a sequence file, in the thread consuming them (not the capture thread).
+ * The writes go through a UringWriter, so appending a frame never waits for the disk, and
+ * frames which would have to are dropped instead.
+ */
+class SequenceWriter {
+public:
+	/** @param framesInFlight Maximum number of frames being written at once */
+	explicit SequenceWriter(int framesInFlight = 16);
+
+	/** close()s the file */
+	~SequenceWriter();
+
+	/**
+	 * Creates (or truncates) filename, and writes its header.
+	 * @param direct, pool As for UringWriter::open()
+	 * @return 0, or -1 if the file could not be created
+	 */
+	int open(const char* filename, bool direct, FramePool* pool = 0);
+
+	bool isOpen() { return writer_.isOpen(); }
+
+	/**
+	 * Queues frame (with its metadata) to be appended. Keeps a reference to the frame until it is written.
+	 * @return frame number in the file, or -1 if the frame was dropped
+	 */
+	int append(const FrameRef& frame);
+
+	/** See UringWriter::poll() */
+	void poll() { writer_.poll(); }
+
+	/**
+	 * Waits for every frame, and then writes the index.
+	 * @return -1 if anything could not be written
+	 */
+	int close();
+
+	unsigned long getFrames() { return index_.size(); }
+	unsigned long getDroppedFrames() { return dropped_; }
+
+	UringWriter& getWriter() { return writer_; }
+
+	void print(FILE* out);
+
+private:
+	UringWriter writer_;
+	std::vector<SequenceIndexEntry> index_;
+	unsigned long dropped_;
+
+	SequenceWriter(const SequenceWriter&);
+	SequenceWriter& operator=(const SequenceWriter&);
+};
+
+
+/**
+ * Random access to the frames of a sequence file, mapped into memory. Opening only reads the
+ * header and the index, however long the recording, and the pixels of a frame are only read
+ * from disk when getFrame() is used.
+ */
+class SequenceReader {
+public:
+	SequenceReader();
+	~SequenceReader();
+
+	/** @return 0, or -1 if filename is not a sequence file (says why) */
+	int open(const char* filename);
+	void close();
+
+	bool isOpen() { return data_ != 0; }
+
+	/** @return false if the index was missing (the recording was not closed), and had to be rebuilt */
+	bool hasIndex() { return has_index_; }
+
+	const SequenceHeader& getHeader() { return *reinterpret_cast<const SequenceHeader*>(data_); }
+
+	int getNumFrames() { return num_frames_; }
+
+	const SequenceIndexEntry& getIndexEntry(int frame) { return index_[frame]; }
+	const SequenceFrameRecord& getRecord(int frame);
+
+	/** @param meta Set to the metadata recorded along with frame */
+	void getMetadata(int frame, FrameMetadata& meta);
+
+	/** @return the image data of frame, pointing into the mapped file (valid until close()) */
+	FrameView getFrame(int frame);
+
+	/** @return first frame captured at or after sequence number, or -1 */
+	int findSequence(uint64_t sequence);
+
+private:
+	const unsigned char* data_;
+	size_t size_;
+
+	const SequenceIndexEntry* index_; ///< Into data_, or into rebuilt_index_
+	int num_frames_;
+	bool has_index_;
+	std::vector<SequenceIndexEntry> rebuilt_index_;
+
+	bool isValidRecord(uint64_t offset);
+	void rebuildIndex();
+
+	SequenceReader(const SequenceReader&);
+	SequenceReader& operator=(const SequenceReader&);
+};
+
+
+#endif /* SEQUENCEFILE_H_ */
@@ -0,0 +1,251 @@
+/**
+ * Building blocks shared by the SSE2, AVX2 and AVX-512 image kernels (ImageKernels.cc and Demosaic.cc).
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SIMDHELPERS_H_
+#define SIMDHELPERS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+
+#ifdef HAVE_X86_KERNELS
+
+/** Packs four 0x00BBGGRR pixels into 12 bytes of R, G, B (the last 4 bytes are zero) */
+static inline __m128i compactRGB24_sse2(__m128i p)
+{
+	// Move pixel 1 and 3 next to pixel 0 and 2, within each 64 bit half
+	const __m128i even_pixels = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+	__m128i u = _mm_or_si128(_mm_and_si128(p, even_pixels), _mm_srli_epi64(_mm_andnot_si128(even_pixels, p), 8));
+
+	// ...and the upper 6 bytes next to the lower 6 bytes
+	const __m128i low_6_bytes = _mm_set_epi32(0, 0, 0x0000FFFF, 0xFFFFFFFF);
+	return _mm_or_si128(_mm_and_si128(u, low_6_bytes), _mm_andnot_si128(low_6_bytes, _mm_srli_si128(u, 2)));
+}
+
+
+/**
+ * Interleaves 16 red, green and blue bytes into 48 bytes of packed RGB at dst.
+ * @warning Writes 4 (zero) bytes beyond the 48 bytes
+ */
+static inline void storeRGB24_sse2(__m128i r, __m128i g, __m128i b, uint8_t* dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i rg_lo = _mm_unpacklo_epi8(r, g);
+	__m128i rg_hi = _mm_unpackhi_epi8(r, g);
+	__m128i b_lo = _mm_unpacklo_epi8(b, zero);
+	__m128i b_hi = _mm_unpackhi_epi8(b, zero);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst),      compactRGB24_sse2(_mm_unpacklo_epi16(rg_lo, b_lo)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), compactRGB24_sse2(_mm_unpackhi_epi16(rg_lo, b_lo)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 24), compactRGB24_sse2(_mm_unpacklo_epi16(rg_hi, b_hi)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 36), compactRGB24_sse2(_mm_unpackhi_epi16(rg_hi, b_hi)));
+}
+
+
+/** Byte-wise (a + b + c + d + 2) / 4 */
+static inline __m128i mean4_sse2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	__m128i lo = _mm_add_epi16(
+			_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+			_mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+
+	__m128i hi = _mm_add_epi16(
+			_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+			_mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+
+	return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, two), 2), _mm_srli_epi16(_mm_add_epi16(hi, two), 2));
+}
+
+
+/** Byte-wise (a + b) / 2, rounded down (_mm_avg_epu8() rounds up) */
+static inline __m128i floorMean2_sse2(__m128i a, __m128i b)
+{
+	return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+
+/** Bytes of a where mask is set, otherwise bytes of b */
+static inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+
+/** 4 bytes at p into the lowest 32 bits */
+static inline __m128i load32_sse2(const uint8_t* p)
+{
+	int32_t v;
+	memcpy(&v, p, sizeof(v));
+	return _mm_cvtsi32_si128(v);
+}
+
+
+/** 8 bytes at p, zero extended to 16 bits */
+static inline __m128i loadWiden8_sse2(const uint8_t* p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+}
+
+
+/** 16 bit |a| (SSE2 has no _mm_abs_epi16) */
+static inline __m128i abs16_sse2(__m128i a)
+{
+	return _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a));
+}
+
+
+/**
+ * Interleaves 32 red, green and blue bytes into 96 bytes of packed RGB at dst.
+ * @warning Writes 4 (zero) bytes beyond the 96 bytes
+ */
+__attribute__((target("avx2")))
+static inline void storeRGB24_avx2(__m256i r, __m256i g, __m256i b, uint8_t* dst)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i compact = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	// Within each 128 bit lane: pixels 0-7 (lo) and 8-15 (hi) of that lane
+	__m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+	__m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+	__m256i b_lo = _mm256_unpacklo_epi8(b, zero);
+	__m256i b_hi = _mm256_unpackhi_epi8(b, zero);
+
+	// 12 bytes each, holding pixels 0-3, 4-7, 8-11, 12-15 of each lane
+	__m256i p0 = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg_lo, b_lo), compact);
+	__m256i p1 = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg_lo, b_lo), compact);
+	__m256i p2 = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg_hi, b_hi), compact);
+	__m256i p3 = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg_hi, b_hi), compact);
+
+	// In increasing address order, so each store overwrites the zeros of the previous one
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst),      _mm256_castsi256_si128(p0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 12), _mm256_castsi256_si128(p1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 24), _mm256_castsi256_si128(p2));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 36), _mm256_castsi256_si128(p3));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 48), _mm256_extracti128_si256(p0, 1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 60), _mm256_extracti128_si256(p1, 1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 72), _mm256_extracti128_si256(p2, 1));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 84), _mm256_extracti128_si256(p3, 1));
+}
+
+
+/** Byte-wise (a + b + c + d + 2) / 4 */
+__attribute__((target("avx2")))
+static inline __m256i mean4_avx2(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+
+	__m256i lo = _mm256_add_epi16(
+			_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+			_mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+
+	__m256i hi = _mm256_add_epi16(
+			_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+			_mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+
+	// Packing within each lane restores the order the unpacking changed
+	return _mm256_packus_epi16(_mm256_srli_epi16(_mm256_add_epi16(lo, two), 2),
+			_mm256_srli_epi16(_mm256_add_epi16(hi, two), 2));
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i floorMean2_avx2(__m256i a, __m256i b)
+{
+	return _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i select_avx2(__m256i mask, __m256i a, __m256i b)
+{
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+
+/** 16 bytes at p, zero extended to 16 bits */
+__attribute__((target("avx2")))
+static inline __m256i loadWiden16_avx2(const uint8_t* p)
+{
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+
+/** Saturates two vectors of 16 bit values into bytes, keeping them in order (lo first) */
+__attribute__((target("avx2")))
+static inline __m256i packus16_avx2(__m256i lo, __m256i hi)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+
+//
+// GCC 12 implements the plain extract, cast, permute and widening intrinsics of AVX-512 with an
+// undefined vector to merge into, which -Wmaybe-uninitialized reports at -O3. Their zero masked
+// forms, with every element selected, are the same instructions and build clean.
+//
+
+/** @return bits 0-255 of v */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m256i lowHalf_avx512(__m512i v)
+{
+	return _mm512_maskz_extracti64x4_epi64(0xFF, v, 0);
+}
+
+
+/** @return bits 256-511 of v */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m256i highHalf_avx512(__m512i v)
+{
+	return _mm512_maskz_extracti64x4_epi64(0xFF, v, 1);
+}
+
+
+/** 32 bytes at p, zero extended to 16 bits */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i loadWiden16_avx512(const uint8_t* p)
+{
+	return _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+
+/** Saturates two vectors of 16 bit values into bytes, keeping them in order (lo first) */
+__attribute__((target("avx512f,avx512bw")))
+static inline __m512i packus16_avx512(__m512i lo, __m512i hi)
+{
+	return _mm512_maskz_permutexvar_epi64(0xFF, _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), _mm512_packus_epi16(lo, hi));
+}
+
+
+/**
+ * Interleaves 64 red, green and blue bytes into 192 bytes of packed RGB at dst.
+ * @warning Writes 4 (zero) bytes beyond the 192 bytes
+ */
+__attribute__((target("avx512f,avx512bw")))
+static inline void storeRGB24_avx512(__m512i r, __m512i g, __m512i b, uint8_t* dst)
+{
+	storeRGB24_avx2(lowHalf_avx512(r), lowHalf_avx512(g), lowHalf_avx512(b), dst);
+	storeRGB24_avx2(highHalf_avx512(r), highHalf_avx512(g), highHalf_avx512(b), dst + 96);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+#endif /* SIMDHELPERS_H_ */
@@ -0,0 +1,175 @@
+/**
+ * Turns one captured frame into the files of a snapshot.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "SnapshotEncoder.h"
+#include "ColorPipeline.h"
+#include "ImageKernels.h"
+#include "SnapshotHelpers.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+
+/** One of the files of a snapshot, written from start to end */
+class OutputFile {
+public:
+	OutputFile() : fd_(-1) {}
+	~OutputFile() { close(); }
+
+	/** @return false if the file could not be created (and says so) */
+	bool open(const std::string& filename, const std::string& header)
+	{
+		filename_ = filename;
+		printf("\n=====[Saving frame as %s]=====\n", filename.c_str());
+
+		fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (fd_ < 0)
+		{
+			printf("Could not create %s: %s\n", filename.c_str(), strerror(errno));
+			return false;
+		}
+
+		return write(header.data(), header.size());
+	}
+
+	bool isOpen() { return fd_ >= 0; }
+
+	/** @return false (and closes the file) if the data could not be written */
+	bool write(const void* data, size_t size)
+	{
+		const char* p = static_cast<const char*>(data);
+
+		while (size > 0)
+		{
+			ssize_t n = ::write(fd_, p, size);
+
+			if (n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			if (n <= 0)
+			{
+				printf("Could not write %s: %s\n", filename_.c_str(), n < 0 ? strerror(errno) : "disk full");
+				close();
+				return false;
+			}
+
+			p += n;
+			size -= n;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		if (fd_ >= 0)
+		{
+			::close(fd_);
+			fd_ = -1;
+		}
+	}
+
+private:
+	int fd_;
+	std::string filename_;
+
+	OutputFile(const OutputFile&);
+	OutputFile& operator=(const OutputFile&);
+};
+
+
+static std::string ppmHeader(int width, int height)
+{
+	char header[50];
+	snprintf(header, sizeof(header), "P6\n%d %d 255\n", width, height);
+	return header;
+}
+
+
+SnapshotEncoder::SnapshotEncoder(int outputs, Demosaic::Algorithm algorithm, ColorPipeline* color) :
+	outputs_(outputs),
+	algorithm_(algorithm),
+	color_(color)
+{
+
+}
+
+
+int SnapshotEncoder::encode(const FrameView& frame, int index)
+{
+	const int w = frame.width;
+	const int h = frame.height;
+
+	// Everything below walks the mosaic. The raw file needs it anyway, and demosaicing reads
+	// rows around each band, which a band of the planes does not have.
+	const unsigned char* bayer = frame.data;
+
+	if (frame.layout == FrameView::PLANAR)
+	{
+		interleaved_.resize(size_t(w) * h);
+		ImageKernels::interleaveBayer(frame, &interleaved_[0]);
+		bayer = &interleaved_[0];
+	}
+
+	OutputFile raw;
+	OutputFile binned;
+	OutputFile demosaiced;
+
+	bool ok = true;
+
+	if (outputs_ & RAW)
+	{
+		ok &= raw.open(SnapshotHelpers::buildRAWSnapshotFilename(index), "");
+	}
+
+	if (outputs_ & BINNED)
+	{
+		ok &= binned.open(SnapshotHelpers::buildPPMSnapshotFilename(index), ppmHeader(w/2, h/2));
+		binned_.resize(size_t(CHUNK_ROWS/2) * (w/2) * 3);
+	}
+
+	if (outputs_ & DEMOSAICED)
+	{
+		ok &= demosaiced.open(SnapshotHelpers::buildPPMSnapshot_demosaicFilename(index, algorithm_), ppmHeader(w, h));
+		demosaiced_.resize(size_t(CHUNK_ROWS) * w * 3);
+	}
+
+	for (int y = 0; y < h && (raw.isOpen() || binned.isOpen() || demosaiced.isOpen()); y += CHUNK_ROWS)
+	{
+		const int rows = std::min(int(CHUNK_ROWS), h - y);
+		const unsigned char* band = bayer + size_t(y) * w;
+
+		if (raw.isOpen())
+		{
+			ok &= raw.write(band, size_t(rows) * w);
+		}
+
+		if (binned.isOpen())
+		{
+			ImageKernels::binBayer2x2ToRGB24(FrameView(band, w, rows), &binned_[0], (w/2) * 3, color_);
+			ok &= binned.write(&binned_[0], size_t(rows/2) * (w/2) * 3);
+		}
+
+		if (demosaiced.isOpen())
+		{
+			Demosaic::demosaicRows(algorithm_, bayer, w, h, y, y + rows, &demosaiced_[0], w * 3, color_, scratch_);
+			ok &= demosaiced.write(&demosaiced_[0], size_t(rows) * w * 3);
+		}
+	}
+
+	return ok ? 0 : -1;
+}
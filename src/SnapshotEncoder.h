@@ -0,0 +1,70 @@
+/**
+ * Turns one captured frame into the files of a snapshot.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SNAPSHOTENCODER_H_
+#define SNAPSHOTENCODER_H_
+
+#include <string>
+#include <vector>
+
+#include "Demosaic.h"
+#include "FrameView.h"
+
+class ColorPipeline;
+
+
+/**
+ * Writes any of the snapshot files (the raw mosaic, the binned PPM and the demosaiced PPM,
+ * named as SnapshotHelpers says) in one pass over the frame: a band of CHUNK_ROWS rows is
+ * converted into each output while it is in the cache, and every file gets one large
+ * write(2) per band, instead of whole images being produced and written one after the other.
+ *
+ * Keeps its buffers from snapshot to snapshot, so each thread writing snapshots should have
+ * an encoder of its own.
+ */
+class SnapshotEncoder {
+public:
+	enum Output {
+		RAW = 1,        ///< raw_chunk_NNNNN.raw, the mosaic as the sensor delivered it
+		BINNED = 2,     ///< combined_NNNNN.ppm, each 2x2 quad binned into one pixel
+		DEMOSAICED = 4, ///< combined_demosaic_ALG_NNNNN.ppm, full resolution
+		ALL = RAW | BINNED | DEMOSAICED
+	};
+
+	/** Bayer rows per band. Even, so bands hold whole quads. */
+	enum { CHUNK_ROWS = 128 };
+
+	/**
+	 * @param outputs Or:ed Output values
+	 * @param color Applied to the PPM files (may be NULL). Must not be changed during encode().
+	 */
+	SnapshotEncoder(int outputs, Demosaic::Algorithm algorithm, ColorPipeline* color);
+
+	/**
+	 * Writes the snapshot files of frame, numbered index.
+	 * @return 0 on success, -1 if any of the files could not be written
+	 */
+	int encode(const FrameView& frame, int index);
+
+private:
+	int outputs_;
+	Demosaic::Algorithm algorithm_;
+	ColorPipeline* color_;
+
+	std::vector<unsigned char> interleaved_; ///< PLANAR frames as a mosaic
+	std::vector<unsigned char> binned_;      ///< One band of each image
+	std::vector<unsigned char> demosaiced_;
+	std::vector<unsigned char> scratch_;     ///< For Demosaic::demosaicRows()
+
+	SnapshotEncoder(const SnapshotEncoder&);
+	SnapshotEncoder& operator=(const SnapshotEncoder&);
+};
+
+
+#endif /* SNAPSHOTENCODER_H_ */
@@ -0,0 +1,216 @@
+/**
+ * Saves snapshots of captured frames in threads of its own.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "SnapshotWriter.h"
+#include "ColorPipeline.h"
+#include "SnapshotEncoder.h"
+#include "SnapshotHelpers.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+
+SnapshotWriter::SnapshotWriter(int queueDepth, int threads, Demosaic::Algorithm algorithm, ColorPipeline* color) :
+	num_threads_(threads > 0 ? threads : 1),
+	algorithm_(algorithm),
+	color_(color),
+	queue_(queueDepth > 0 ? queueDepth : 1),
+	head_(0),
+	count_(0),
+	busy_(0),
+	should_run_(false),
+	next_index_(0),
+	written_(0),
+	dropped_(0)
+{
+	// Builds the tables here, so the workers only ever read them
+	if (color_)
+	{
+		color_->prepare();
+	}
+}
+
+
+SnapshotWriter::~SnapshotWriter()
+{
+	stop();
+}
+
+
+void SnapshotWriter::start()
+{
+	if (!workers_.empty())
+	{
+		return;
+	}
+
+	next_index_ = SnapshotHelpers::getNextUnusedIndex();
+	should_run_ = true;
+
+	for (int i = 0; i < num_threads_; i++)
+	{
+		workers_.push_back(std::thread(&SnapshotWriter::workerMain, this));
+	}
+}
+
+
+void SnapshotWriter::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		should_run_ = false;
+	}
+	job_available_.notify_all();
+
+	for (size_t i = 0; i < workers_.size(); i++)
+	{
+		workers_[i].join();
+	}
+
+	workers_.clear();
+}
+
+
+bool SnapshotWriter::submit(const FrameRef& frame, int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (count_ == int(queue_.size()))
+	{
+		if (timeout_ms < 0)
+		{
+			job_done_.wait(lock, [this]() { return count_ < int(queue_.size()) || !should_run_; });
+		}
+		else if (timeout_ms > 0)
+		{
+			job_done_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+					[this]() { return count_ < int(queue_.size()) || !should_run_; });
+		}
+	}
+
+	if (count_ == int(queue_.size()) || !should_run_)
+	{
+		dropped_++;
+		return false;
+	}
+
+	// Numbers handed out earlier may not have been written yet, so the search starts after them
+	int index = SnapshotHelpers::getNextUnusedIndex(next_index_);
+
+	if (index < 0)
+	{
+		printf("Could not save snapshot. Image numbering exhausted\n"
+				"(i.e. all non-negative integers have been used up)\n");
+		dropped_++;
+		return false;
+	}
+
+	next_index_ = index + 1;
+
+	Job& job = queue_[(head_ + count_) % queue_.size()];
+	job.frame = frame;
+	job.index = index;
+	count_++;
+
+	lock.unlock();
+	job_available_.notify_one();
+
+	return true;
+}
+
+
+void SnapshotWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	if (count_ > 0 || busy_ > 0)
+	{
+		printf("Writing %d queued snapshot(s)...\n", count_ + busy_);
+	}
+
+	job_done_.wait(lock, [this]() { return (count_ == 0 && busy_ == 0) || workers_.empty(); });
+}
+
+
+int SnapshotWriter::getQueueDepth()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return count_;
+}
+
+
+unsigned long SnapshotWriter::getWrittenFrames()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return written_;
+}
+
+
+unsigned long SnapshotWriter::getDroppedFrames()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dropped_;
+}
+
+
+void SnapshotWriter::workerMain()
+{
+	// Each thread keeps the buffers of its own encoder
+	SnapshotEncoder encoder(SnapshotEncoder::ALL, algorithm_, color_);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	for (;;)
+	{
+		// Keeps going after stop() until the queue is empty, so nothing queued is lost
+		job_available_.wait(lock, [this]() { return count_ > 0 || !should_run_; });
+
+		if (count_ == 0)
+		{
+			break;
+		}
+
+		Job job;
+		job.frame = queue_[head_].frame;
+		job.index = queue_[head_].index;
+		queue_[head_].frame.reset();
+		head_ = (head_ + 1) % queue_.size();
+		count_--;
+		busy_++;
+
+		lock.unlock();
+		job_done_.notify_all(); // There is room in the queue
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int rc = encoder.encode(job.frame->getView(), job.index);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		job.frame.reset(); // Back to the pool before reporting the frame as written
+
+		lock.lock();
+		busy_--;
+
+		// A snapshot which could not be written counts as dropped
+		if (rc == 0)
+		{
+			written_++;
+		}
+		else
+		{
+			dropped_++;
+		}
+
+		printf("Snapshot %05d %s in %.1f ms (%d waiting, %lu written, %lu dropped)\n", job.index,
+				rc == 0 ? "written" : "failed", ms, count_, written_, dropped_);
+
+		job_done_.notify_all();
+	}
+}
+
@@ -0,0 +1,105 @@
+/**
+ * Saves snapshots of captured frames in threads of its own.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SNAPSHOTWRITER_H_
+#define SNAPSHOTWRITER_H_
+
+#include "Demosaic.h"
+#include "FramePool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ColorPipeline;
+
+
+/**
+ * Converts and writes snapshots (the raw frame, the binned view and a demosaiced image,
+ * see SnapshotEncoder) in worker threads, so the loop consuming frames only hands over
+ * a FrameRef and moves on to the next frame.
+ *
+ * Frames wait in a bounded queue. When the disk can not keep up and the queue is full,
+ * submit() drops the new frame instead of delaying the caller (unless told to wait),
+ * and the number of frames dropped versus written shows how far behind the writer is.
+ *
+ * Every frame waiting or being written keeps its FrameRef, so the FramePool needs
+ * getMaxFramesHeld() frames more than it would otherwise.
+ */
+class SnapshotWriter {
+public:
+	/**
+	 * @param queueDepth Number of frames which may wait to be written
+	 * @param threads Number of worker threads
+	 * @param color Applied to the converted images (may be NULL). Must not be changed while
+	 *              the writer runs, and must outlive it.
+	 */
+	SnapshotWriter(int queueDepth, int threads, Demosaic::Algorithm algorithm, ColorPipeline* color);
+
+	/** Writes whatever is still queued (see stop()) */
+	~SnapshotWriter();
+
+	void start();
+
+	/** Writes every frame already queued, and then stops the worker threads */
+	void stop();
+
+	/**
+	 * Queues frame to be saved under the next unused snapshot number.
+	 *
+	 * @param timeout_ms How long to wait for room in the queue. 0 drops the frame right away
+	 *                   when the queue is full, and -1 waits as long as it takes.
+	 * @return false if the frame was dropped
+	 */
+	bool submit(const FrameRef& frame, int timeout_ms = 0);
+
+	/** Waits until every frame queued so far has been written */
+	void flush();
+
+	int getQueueDepth();
+	int getMaxFramesHeld() { return int(queue_.size()) + num_threads_; }
+
+	unsigned long getWrittenFrames();
+	unsigned long getDroppedFrames();
+
+private:
+	struct Job {
+		FrameRef frame;
+		int index;
+	};
+
+	const int num_threads_;
+	Demosaic::Algorithm algorithm_;
+	ColorPipeline* color_;
+
+	std::vector<std::thread> workers_;
+
+	std::mutex mutex_;
+	std::condition_variable job_available_;
+	std::condition_variable job_done_; ///< Also signals room in the queue
+
+	std::vector<Job> queue_; ///< Ring buffer of count_ jobs starting at head_, allocated up front
+	int head_;
+	int count_;
+	int busy_; ///< Number of workers writing a frame
+	bool should_run_;
+
+	int next_index_;
+	unsigned long written_;
+	unsigned long dropped_;
+
+	void workerMain();
+
+	SnapshotWriter(const SnapshotWriter&);
+	SnapshotWriter& operator=(const SnapshotWriter&);
+};
+
+
+#endif /* SNAPSHOTWRITER_H_ */
@@ -0,0 +1,186 @@
+/**
+ * Bounded lock-free single-producer / single-consumer queue.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Ring buffer handing elements from exactly one producer thread to exactly one consumer thread.
+ *
+ * What happens when the producer finds the ring full is decided by the overflow policy:
+ * NEWEST_WINS throws away the oldest element (which is handed back to the producer, so
+ * it can reuse whatever the element refers to), while BLOCK waits for the consumer.
+ *
+ * Both the consumer and a producer evicting an element advance the read index using
+ * compare-and-swap, so an element is always taken by exactly one of them.
+ *
+ * @note T must be trivially copyable (typically a pointer), since it is stored in std::atomic
+ */
+template <class T>
+class SpscQueue {
+public:
+	enum OverflowPolicy {
+		NEWEST_WINS, ///< Drop the oldest element when full. The producer never waits.
+		BLOCK        ///< Wait for the consumer when full
+	};
+
+	SpscQueue(int capacity, OverflowPolicy policy = BLOCK) :
+		slots_(capacity),
+		capacity_(capacity),
+		policy_(policy),
+		read_(0),
+		write_(0),
+		dropped_(0),
+		closed_(false)
+	{
+
+	}
+
+	/**
+	 * Adds value to the queue (producer only).
+	 *
+	 * @param evicted Set to the element dropped to make room for value, or T() if none was dropped
+	 * @return false if the queue was closed while waiting for room (BLOCK only)
+	 */
+	bool push(const T& value, T& evicted)
+	{
+		size_t w = write_.load(std::memory_order_relaxed);
+
+		evicted = T();
+
+		for (;;)
+		{
+			size_t r = read_.load(std::memory_order_acquire);
+
+			if (w - r < capacity_)
+			{
+				break;
+			}
+
+			if (policy_ == NEWEST_WINS)
+			{
+				T oldest = slots_[r % capacity_].load(std::memory_order_relaxed);
+
+				if (read_.compare_exchange_strong(r, r + 1, std::memory_order_acq_rel))
+				{
+					evicted = oldest;
+					dropped_.fetch_add(1, std::memory_order_relaxed);
+					break;
+				}
+
+				// The consumer took the oldest element first, so there is room now
+				continue;
+			}
+
+			if (closed_.load(std::memory_order_relaxed))
+			{
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+
+		slots_[w % capacity_].store(value, std::memory_order_relaxed);
+		write_.store(w + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	/**
+	 * Removes the oldest element from the queue (consumer only).
+	 * @return false if the queue was empty
+	 */
+	bool tryPop(T& value)
+	{
+		for (;;)
+		{
+			size_t r = read_.load(std::memory_order_acquire);
+			size_t w = write_.load(std::memory_order_acquire);
+
+			if (r == w)
+			{
+				return false;
+			}
+
+			T candidate = slots_[r % capacity_].load(std::memory_order_relaxed);
+
+			// Fails if the producer evicted this element while we were reading it
+			if (read_.compare_exchange_weak(r, r + 1, std::memory_order_acq_rel))
+			{
+				value = candidate;
+				return true;
+			}
+		}
+	}
+
+	/**
+	 * Like tryPop(), but waits up to timeout_ms for an element to arrive.
+	 * @return false on timeout, or if the queue was closed while empty
+	 */
+	bool pop(T& value, int timeout_ms)
+	{
+		std::chrono::steady_clock::time_point deadline =
+				std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+		while (!tryPop(value))
+		{
+			if (closed_.load(std::memory_order_relaxed) || std::chrono::steady_clock::now() >= deadline)
+			{
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+
+		return true;
+	}
+
+	/** Wakes up a producer or consumer waiting in push() or pop(), and makes them give up */
+	void close() { closed_.store(true, std::memory_order_relaxed); }
+
+	/** @return number of elements currently queued */
+	int size()
+	{
+		size_t r = read_.load(std::memory_order_acquire);
+		size_t w = write_.load(std::memory_order_acquire);
+		return int(w - r);
+	}
+
+	int capacity() { return int(capacity_); }
+
+	OverflowPolicy getPolicy() { return policy_; }
+
+	/** @return number of elements thrown away by NEWEST_WINS since the queue was created */
+	unsigned long getDropCount() { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	std::vector< std::atomic<T> > slots_;
+	const size_t capacity_;
+	const OverflowPolicy policy_;
+
+	std::atomic<size_t> read_;  ///< Total number of elements ever removed
+	std::atomic<size_t> write_; ///< Total number of elements ever added
+
+	std::atomic<unsigned long> dropped_;
+	std::atomic<bool> closed_;
+
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+};
+
+
+#endif /* SPSCQUEUE_H_ */
@@ -0,0 +1,197 @@
+/**
+ * Integral image of the four bayer planes, for constant time sums over any rectangle.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "SummedAreaTable.h"
+#include "CpuFeatures.h"
+#include "SimdHelpers.h"
+
+#include <algorithm>
+
+
+//
+// One row of the table: the running sums along the quad row, plus the row above.
+// planes and stride are as from FrameView::getQuadRow(), and out and above point at
+// entry 1 of their rows (entry 0 is always zero).
+//
+
+static void buildRow_scalar(const uint8_t* const* planes, int stride, int x, int quads,
+		uint32_t* running, const uint32_t* above, uint32_t* out)
+{
+	for (; x < quads; x++)
+	{
+		for (int p = 0; p < 4; p++)
+		{
+			running[p] += planes[p][stride*x];
+		}
+
+		for (int p = 0; p < 4; p++)
+		{
+			out[4*x + p] = running[p] + above[4*x + p];
+		}
+	}
+}
+
+
+static void buildRow_generic(const uint8_t* const* planes, int stride, int quads, const uint32_t* above, uint32_t* out)
+{
+	uint32_t running[4] = { 0, 0, 0, 0 };
+	buildRow_scalar(planes, stride, 0, quads, running, above, out);
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+/**
+ * All four planes of a quad fit in one vector, so the prefix sum along the row is a
+ * single vector addition per quad. 4 quads per iteration.
+ */
+static void buildRow_sse2(const uint8_t* const* planes, int stride, int quads, const uint32_t* above, uint32_t* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i running = zero;
+
+	int x = 0;
+
+	for (; x + 4 <= quads; x += 4)
+	{
+		// The bayer rows of 4 quads, R G1 R G1... and G2 B G2 B..., whatever the layout
+		__m128i row0, row1;
+
+		if (stride == 1)
+		{
+			row0 = _mm_unpacklo_epi8(load32_sse2(planes[FrameView::R] + x), load32_sse2(planes[FrameView::G1] + x));
+			row1 = _mm_unpacklo_epi8(load32_sse2(planes[FrameView::G2] + x), load32_sse2(planes[FrameView::B] + x));
+		}
+		else
+		{
+			row0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes[FrameView::R] + 2*x));
+			row1 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes[FrameView::G2] + 2*x));
+		}
+
+		// R G1 G2 B of 4 quads
+		__m128i q = _mm_unpacklo_epi16(row0, row1);
+
+		__m128i lo = _mm_unpacklo_epi8(q, zero);
+		__m128i hi = _mm_unpackhi_epi8(q, zero);
+
+		__m128i quad[4] = {
+				_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+				_mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+
+		for (int i = 0; i < 4; i++)
+		{
+			running = _mm_add_epi32(running, quad[i]);
+
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + 4*(x + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4*(x + i)), _mm_add_epi32(running, a));
+		}
+	}
+
+	uint32_t tail[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(tail), running);
+
+	buildRow_scalar(planes, stride, x, quads, tail, above, out);
+}
+
+#endif // HAVE_X86_KERNELS
+
+
+/** The kernels of one instruction set */
+struct Kernels {
+	const char* name;
+	void (*buildRow)(const uint8_t* const* planes, int stride, int quads, const uint32_t* above, uint32_t* out);
+};
+
+
+static Kernels selectKernels()
+{
+#ifdef HAVE_X86_KERNELS
+	if (CpuFeatures::getLevel() >= CpuFeatures::SSE2)
+	{
+		Kernels sse2 = { "sse2", buildRow_sse2 };
+		return sse2;
+	}
+#endif
+
+	Kernels scalar = { "scalar", buildRow_generic };
+	return scalar;
+}
+
+
+static const Kernels kernels = selectKernels();
+
+
+SummedAreaTable::SummedAreaTable() :
+	quad_width_(0),
+	quad_height_(0)
+{
+}
+
+
+void SummedAreaTable::build(const FrameView& frame)
+{
+	quad_width_ = frame.getQuadWidth();
+	quad_height_ = frame.getQuadHeight();
+
+	const size_t row_entries = size_t(quad_width_ + 1) * NUM_PLANES;
+
+	table_.resize(row_entries * (quad_height_ + 1));
+
+	// Row 0 and column 0 are all zeros
+	std::fill(table_.begin(), table_.begin() + row_entries, 0);
+
+	for (int qy = 0; qy < quad_height_; qy++)
+	{
+		uint32_t* above = &table_[row_entries * qy];
+		uint32_t* out = above + row_entries;
+
+		std::fill(out, out + NUM_PLANES, 0);
+
+		const uint8_t* planes[FrameView::NUM_PLANES];
+		int stride;
+		frame.getQuadRow(qy, planes, stride);
+
+		kernels.buildRow(planes, stride, quad_width_, above + NUM_PLANES, out + NUM_PLANES);
+	}
+}
+
+
+void SummedAreaTable::clip(int& left, int& top, int& right, int& bottom) const
+{
+	left   = std::min(std::max(left / 2, 0), quad_width_);
+	right  = std::min(std::max(right / 2, left), quad_width_);
+	top    = std::min(std::max(top / 2, 0), quad_height_);
+	bottom = std::min(std::max(bottom / 2, top), quad_height_);
+}
+
+
+void SummedAreaTable::getSums(int left, int top, int right, int bottom, uint32_t sums[NUM_PLANES]) const
+{
+	clip(left, top, right, bottom);
+
+	const uint32_t* a = entry(left, top);
+	const uint32_t* b = entry(right, top);
+	const uint32_t* c = entry(left, bottom);
+	const uint32_t* d = entry(right, bottom);
+
+	// Wraps around in between, but the result is right
+	for (int p = 0; p < NUM_PLANES; p++)
+	{
+		sums[p] = d[p] - b[p] - c[p] + a[p];
+	}
+}
+
+
+long SummedAreaTable::getQuads(int left, int top, int right, int bottom) const
+{
+	clip(left, top, right, bottom);
+
+	return long(right - left) * (bottom - top);
+}
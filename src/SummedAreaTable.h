@@ -0,0 +1,63 @@
+/**
+ * Integral image of the four bayer planes, for constant time sums over any rectangle.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef SUMMEDAREATABLE_H_
+#define SUMMEDAREATABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "FrameView.h"
+
+
+/**
+ * Summed-area table of the R, G1, G2 and B planes of an RGGB bayer frame. Once built
+ * (one pass over the frame), the sum of each plane over any rectangle takes 4 lookups,
+ * so any number of measurement regions can be queried per frame.
+ *
+ * Entry (qx, qy) holds the sums of all quads above and to the left of quad (qx, qy), with the
+ * four planes next to each other (16 bytes per entry). Sums are 32 bits, which is enough for
+ * 2^24 quads (far more than the largest frame).
+ */
+class SummedAreaTable {
+public:
+	enum Plane { R, G1, G2, B, NUM_PLANES };
+
+	SummedAreaTable();
+
+	void build(const FrameView& frame);
+
+	/**
+	 * Sums of each plane over a rectangle, in bayer pixel coordinates like FrameStatistics::Region:
+	 * rounded down to whole quads, right and bottom excluded, and clipped to the frame.
+	 */
+	void getSums(int left, int top, int right, int bottom, uint32_t sums[NUM_PLANES]) const;
+
+	/** @return the number of quads getSums() adds up for the rectangle */
+	long getQuads(int left, int top, int right, int bottom) const;
+
+	int getQuadWidth() const { return quad_width_; }
+	int getQuadHeight() const { return quad_height_; }
+
+private:
+	int quad_width_;
+	int quad_height_;
+	std::vector<uint32_t> table_; ///< (quad_height_ + 1) rows of (quad_width_ + 1) entries
+
+	const uint32_t* entry(int qx, int qy) const
+	{
+		return &table_[(size_t(qy) * (quad_width_ + 1) + qx) * NUM_PLANES];
+	}
+
+	void clip(int& left, int& top, int& right, int& bottom) const;
+};
+
+
+#endif /* SUMMEDAREATABLE_H_ */
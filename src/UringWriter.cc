@@ -0,0 +1,674 @@
+/**
+ * Streams frames to a file without waiting for the disk, using io_uring.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "UringWriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+
+static size_t roundUp(size_t value, size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+
+#ifdef HAVE_IO_URING
+
+/**
+ * The submission and completion queues shared with the kernel. There is no liburing
+ * in the dependencies, and the little of it needed here is just the three system calls
+ * and the memory ordering of the ring indices.
+ */
+struct UringWriter::Ring {
+	int fd;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+
+UringWriter::Ring* UringWriter::createRing(unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, entries, &params);
+
+	if (fd < 0)
+	{
+		return 0; // ENOSYS before Linux 5.1, EPERM when disabled (kernel.io_uring_disabled)
+	}
+
+	Ring* ring = new Ring();
+	ring->fd = fd;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(0, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(0, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	void* sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		printf("UringWriter: Could not map the io_uring queues: %s\n", strerror(errno));
+
+		if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+		if (ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+		if (sqes != MAP_FAILED) munmap(sqes, ring->sqes_size);
+
+		::close(fd);
+		delete ring;
+		return 0;
+	}
+
+	char* sq = static_cast<char*>(ring->sq_ring);
+	ring->sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	ring->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	ring->sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	ring->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	ring->sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+	char* cq = static_cast<char*>(ring->cq_ring);
+	ring->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	ring->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	ring->cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	ring->cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	return ring;
+}
+
+
+void UringWriter::destroyRing(Ring* ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	::close(ring->fd);
+	delete ring;
+}
+
+#else
+
+struct UringWriter::Ring {
+	int fd;
+};
+
+
+UringWriter::Ring* UringWriter::createRing(unsigned entries)
+{
+	return 0;
+}
+
+
+void UringWriter::destroyRing(Ring* ring)
+{
+	delete ring;
+}
+
+#endif // HAVE_IO_URING
+
+
+UringWriter::UringWriter(int queueDepth) :
+	queue_depth_(queueDepth > 0 ? queueDepth : 1),
+	fd_(-1),
+	direct_(false),
+	end_(0),
+	ring_(0),
+	registered_pool_(0),
+	slots_(queue_depth_),
+	pending_(0),
+	unsubmitted_(0),
+	writes_(0),
+	bytes_(0),
+	rejected_(0),
+	failed_(0)
+{
+	for (int i = queue_depth_ - 1; i >= 0; i--)
+	{
+		slots_[i].copy = 0;
+		slots_[i].copy_capacity = 0;
+		free_slots_.push_back(i);
+	}
+
+	// Every write in flight has an entry in each queue, so neither can overflow
+	ring_ = createRing(queue_depth_);
+}
+
+
+UringWriter::~UringWriter()
+{
+	close();
+
+	if (ring_)
+	{
+		destroyRing(ring_);
+	}
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		free(slots_[i].copy);
+	}
+}
+
+
+int UringWriter::open(const char* filename, bool direct, FramePool* pool)
+{
+	close();
+
+	filename_ = filename;
+	direct_ = direct;
+	end_ = 0;
+
+	writes_ = 0;
+	bytes_ = 0;
+	rejected_ = 0;
+	failed_ = 0;
+	latency_.reset();
+	first_queued_ = Clock::time_point();
+	last_completed_ = Clock::time_point();
+
+	fd_ = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+
+	if (fd_ < 0 && direct && errno == EINVAL)
+	{
+		printf("%s does not support O_DIRECT, writing through the page cache\n", filename);
+		direct_ = false;
+		fd_ = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+
+	if (fd_ < 0)
+	{
+		printf("Could not create %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+#ifdef HAVE_IO_URING
+	if (ring_ && pool && pool->getNumAllocatedFrames() < pool->getNumFrames())
+	{
+		std::vector<struct iovec> buffers(pool->getNumFrames());
+
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			// Buffers from the pool's allocator are left as empty entries, since usbfs memory
+			// (VM_IO | VM_PFNMAP) can not be pinned, and one such buffer fails the whole call
+			bool can_register = !pool->isAllocatedFrame(i);
+			buffers[i].iov_base = can_register ? pool->getBuffer(i) : 0;
+			buffers[i].iov_len = can_register ? pool->getBufferSize() : 0;
+		}
+
+		if (syscall(__NR_io_uring_register, ring_->fd, IORING_REGISTER_BUFFERS, &buffers[0], buffers.size()) == 0)
+		{
+			registered_pool_ = pool;
+		}
+		else
+		{
+			// ENOMEM when the buffers exceed RLIMIT_MEMLOCK (ulimit -l), EFAULT before Linux 5.13
+			// if some entries had to be left empty
+			printf("Writing %s without registered buffers: %s\n", filename, strerror(errno));
+		}
+	}
+#endif
+
+	if (direct_ && pool && pool->getNumAllocatedFrames() > 0)
+	{
+		printf("Writing %s: frames in the %d device memory buffers are copied first, as O_DIRECT can not use them\n",
+				filename, pool->getNumAllocatedFrames());
+	}
+
+	return 0;
+}
+
+
+int UringWriter::close()
+{
+	if (fd_ < 0)
+	{
+		return 0;
+	}
+
+	int rc = flush();
+
+#ifdef HAVE_IO_URING
+	if (registered_pool_ && ring_)
+	{
+		syscall(__NR_io_uring_register, ring_->fd, IORING_UNREGISTER_BUFFERS, 0, 0);
+		registered_pool_ = 0;
+	}
+#endif
+
+	::close(fd_);
+	fd_ = -1;
+
+	return rc;
+}
+
+
+int64_t UringWriter::append(const FrameRef& frame, size_t size)
+{
+	if (fd_ < 0)
+	{
+		return -1;
+	}
+
+	// O_DIRECT pins the pages written, which fails (EFAULT) for device memory
+	if (direct_ && frame->pool->isAllocatedFrame(frame->index))
+	{
+		return append(static_cast<const void*>(frame->data), size);
+	}
+
+	size_t length = direct_ ? roundUp(size, ALIGNMENT) : size;
+
+	// The padding comes from the rest of the buffer, which always holds whole pages
+	if (length > frame->pool->getBufferSize())
+	{
+		failed_++;
+		return -1;
+	}
+
+	int slot = takeSlot();
+
+	if (slot < 0)
+	{
+		return -1;
+	}
+
+	Slot& s = slots_[slot];
+	s.frame = frame;
+	s.iov.iov_base = frame->data;
+	s.iov.iov_len = length;
+	s.buffer_index = frame->pool == registered_pool_ && !frame->pool->isAllocatedFrame(frame->index) ? frame->index : -1;
+
+	return queueWrite(slot);
+}
+
+
+int64_t UringWriter::append(const void* data, size_t size)
+{
+	if (fd_ < 0)
+	{
+		return -1;
+	}
+
+	size_t length = direct_ ? roundUp(size, ALIGNMENT) : size;
+
+	int slot = takeSlot();
+
+	if (slot < 0)
+	{
+		return -1;
+	}
+
+	Slot& s = slots_[slot];
+
+	if (s.copy_capacity < length)
+	{
+		void* memory = 0;
+
+		if (posix_memalign(&memory, ALIGNMENT, roundUp(length, ALIGNMENT)) != 0)
+		{
+			free_slots_.push_back(slot);
+			pending_--;
+			failed_++;
+			return -1;
+		}
+
+		free(s.copy);
+		s.copy = static_cast<unsigned char*>(memory);
+		s.copy_capacity = roundUp(length, ALIGNMENT);
+	}
+
+	memcpy(s.copy, data, size);
+	memset(s.copy + size, 0, length - size);
+
+	s.iov.iov_base = s.copy;
+	s.iov.iov_len = length;
+	s.buffer_index = -1;
+
+	return queueWrite(slot);
+}
+
+
+bool UringWriter::hasRoom(int writes)
+{
+	if (int(free_slots_.size()) < writes && ring_)
+	{
+		submit(false);
+		reap();
+	}
+
+	return int(free_slots_.size()) >= writes;
+}
+
+
+void UringWriter::poll()
+{
+	if (ring_)
+	{
+		if (submit(false) < 0)
+		{
+			abandonRing();
+			return;
+		}
+
+		reap();
+	}
+}
+
+
+int UringWriter::flush()
+{
+	while (ring_ && pending_ > 0)
+	{
+		if (submit(true) < 0)
+		{
+			abandonRing();
+			break;
+		}
+
+		reap();
+	}
+
+	return failed_ > 0 ? -1 : 0;
+}
+
+
+double UringWriter::getThroughput()
+{
+	double seconds = std::chrono::duration<double>(last_completed_ - first_queued_).count();
+	return seconds > 0 ? bytes_ / seconds : 0;
+}
+
+
+void UringWriter::print(FILE* out)
+{
+	fprintf(out, "%s: %lu writes, %.1f MB, %.1f MB/s, rejected=%lu, failed=%lu (%s%s%s)\n", filename_.c_str(),
+			writes_, bytes_ / 1e6, getThroughput() / 1e6, rejected_, failed_, ring_ ? "io_uring" : "pwrite",
+			registered_pool_ ? ", registered buffers" : "", direct_ ? ", O_DIRECT" : "");
+
+	fprintf(out, "  write latency: mean=%llu us, p50<%llu us, p99<%llu us, max=%llu us\n",
+			(unsigned long long)latency_.getMean(),
+			(unsigned long long)latency_.getPercentile(0.5),
+			(unsigned long long)latency_.getPercentile(0.99),
+			(unsigned long long)latency_.getMax());
+}
+
+
+/** @return a free slot, or -1 if all of them are in use even after picking up completed writes */
+int UringWriter::takeSlot()
+{
+	if (free_slots_.empty() && ring_)
+	{
+		submit(false);
+		reap();
+	}
+
+	if (free_slots_.empty())
+	{
+		rejected_++;
+		return -1;
+	}
+
+	int slot = free_slots_.back();
+	free_slots_.pop_back();
+	pending_++;
+
+	return slot;
+}
+
+
+/** Appends the iov of slot to the file */
+int64_t UringWriter::queueWrite(int slot)
+{
+	Slot& s = slots_[slot];
+
+	s.offset = end_;
+	s.size = s.iov.iov_len;
+	s.queued = Clock::now();
+
+	end_ += s.size;
+
+	if (first_queued_ == Clock::time_point())
+	{
+		first_queued_ = s.queued;
+	}
+
+	// Without io_uring, s is written (and the slot freed) before this returns
+	int64_t offset = s.offset;
+	writeNow(slot);
+
+	return offset;
+}
+
+
+/**
+ * Queues the write of slot in the submission queue (handed to the kernel by the next submit()),
+ * or without io_uring, writes it right away.
+ */
+void UringWriter::writeNow(int slot)
+{
+	Slot& s = slots_[slot];
+
+#ifdef HAVE_IO_URING
+	if (ring_)
+	{
+		unsigned tail = *ring_->sq_tail;
+		unsigned index = tail & ring_->sq_mask;
+
+		struct io_uring_sqe* sqe = &ring_->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+
+		if (s.buffer_index >= 0)
+		{
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->addr = reinterpret_cast<uint64_t>(s.iov.iov_base);
+			sqe->len = s.iov.iov_len;
+			sqe->buf_index = s.buffer_index;
+		}
+		else
+		{
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->addr = reinterpret_cast<uint64_t>(&s.iov);
+			sqe->len = 1;
+		}
+
+		sqe->fd = fd_;
+		sqe->off = s.offset;
+		sqe->user_data = slot;
+
+		ring_->sq_array[index] = index;
+
+		// The kernel must see the entry before the new tail
+		__atomic_store_n(ring_->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		unsubmitted_++;
+		return;
+	}
+#endif
+
+	ssize_t n;
+
+	do
+	{
+		n = pwrite(fd_, s.iov.iov_base, s.iov.iov_len, s.offset);
+	}
+	while (n < 0 && errno == EINTR);
+
+	complete(slot, n < 0 ? -errno : int(n));
+}
+
+
+/**
+ * Hands the queued writes to the kernel.
+ * @param wait Also wait for at least one write to complete
+ * @return -1 if io_uring failed (the writes still queued are then lost)
+ */
+int UringWriter::submit(bool wait)
+{
+#ifdef HAVE_IO_URING
+	for (;;)
+	{
+		int n = syscall(__NR_io_uring_enter, ring_->fd, unsubmitted_, wait ? 1 : 0,
+				wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+
+		if (n >= 0)
+		{
+			unsubmitted_ -= n;
+			return 0;
+		}
+
+		// The completion queue is full or the kernel is short of memory, so try again after reaping
+		if (errno == EAGAIN || errno == EBUSY)
+		{
+			return 0;
+		}
+
+		if (errno != EINTR)
+		{
+			printf("Writing %s: io_uring_enter failed: %s\n", filename_.c_str(), strerror(errno));
+			return -1;
+		}
+	}
+#else
+	return -1;
+#endif
+}
+
+
+/** Handles every completed write */
+void UringWriter::reap()
+{
+#ifdef HAVE_IO_URING
+	unsigned head = *ring_->cq_head;
+	unsigned tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail)
+	{
+		const struct io_uring_cqe* cqe = &ring_->cqes[head & ring_->cq_mask];
+		int slot = int(cqe->user_data);
+		int result = cqe->res;
+
+		head++;
+
+		complete(slot, result);
+	}
+
+	// Gives the entries back to the kernel
+	__atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+#endif
+}
+
+
+/** @param result Number of bytes written, or -errno */
+void UringWriter::complete(int slot, int result)
+{
+	Slot& s = slots_[slot];
+
+	if (result > 0 && size_t(result) < s.iov.iov_len)
+	{
+		// A short write (e.g. interrupted by a signal). The rest is a write of its own, which
+		// with O_DIRECT has to start on a block boundary as well, so the partly written
+		// block is written again. Not even one whole block written counts as a failure.
+		size_t done = direct_ ? size_t(result) / ALIGNMENT * ALIGNMENT : size_t(result);
+
+		if (done > 0)
+		{
+			s.iov.iov_base = static_cast<char*>(s.iov.iov_base) + done;
+			s.iov.iov_len -= done;
+			s.offset += done;
+
+			writeNow(slot);
+			return;
+		}
+
+		result = -EIO;
+	}
+
+	if (result < 0 || (result == 0 && s.iov.iov_len > 0))
+	{
+		// Only the first failure is reported, since every write after it is likely to fail the same way
+		if (failed_ == 0)
+		{
+			printf("Could not write %s: %s\n", filename_.c_str(), strerror(result < 0 ? -result : ENOSPC));
+		}
+		failed_++;
+	}
+	else
+	{
+		last_completed_ = Clock::now();
+		latency_.add(std::chrono::duration_cast<std::chrono::microseconds>(last_completed_ - s.queued).count());
+		writes_++;
+		bytes_ += s.size;
+	}
+
+	s.frame.reset();
+	free_slots_.push_back(slot);
+	pending_--;
+}
+
+
+/**
+ * Gives up on io_uring after io_uring_enter() failed. Every write not completed by then counts as
+ * failed and lets go of its frame, and later writes are pwrite()s. Closing the ring cancels whatever
+ * the kernel still had of those writes, which at worst puts newer data in the file, never elsewhere.
+ */
+void UringWriter::abandonRing()
+{
+	std::vector<bool> in_use(slots_.size(), true);
+
+	for (size_t i = 0; i < free_slots_.size(); i++)
+	{
+		in_use[free_slots_[i]] = false;
+	}
+
+	for (size_t i = 0; i < slots_.size(); i++)
+	{
+		if (in_use[i])
+		{
+			slots_[i].frame.reset();
+			free_slots_.push_back(i);
+			failed_++;
+		}
+	}
+
+	pending_ = 0;
+	unsubmitted_ = 0;
+
+	// The buffers are unregistered along with the ring
+	registered_pool_ = 0;
+	destroyRing(ring_);
+	ring_ = 0;
+}
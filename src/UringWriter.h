@@ -0,0 +1,175 @@
+/**
+ * Streams frames to a file without waiting for the disk, using io_uring.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef URINGWRITER_H_
+#define URINGWRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "CaptureStats.h"
+#include "FramePool.h"
+
+
+/**
+ * Appends frames (and small records between them) to one file, for recording every captured
+ * frame. The writes are queued to the kernel through io_uring and complete in the background,
+ * so the caller never waits for the disk, and each frame is written straight from its pool
+ * buffer, which stays referenced (through its FrameRef) until the write has completed.
+ *
+ * Writes queued by append() go to the kernel together, in one system call, at the next poll(),
+ * which also picks up the writes that have completed. The buffers of a FramePool can be
+ * registered with the kernel up front, which saves pinning their pages for every write, and
+ * O_DIRECT keeps a long recording from filling memory with dirty pages.
+ *
+ * On kernels without io_uring (before 5.1, or with it disabled) every write is a pwrite()
+ * in the calling thread instead, which does wait for the page cache or disk.
+ *
+ * @note Not thread safe. Use each writer from one thread (not the capture thread).
+ */
+class UringWriter {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	/** O_DIRECT needs the memory, size and file offset of every write to be multiples of this */
+	enum { ALIGNMENT = 4096 };
+
+	/** @param queueDepth Maximum number of writes queued or in flight at once */
+	explicit UringWriter(int queueDepth = 32);
+
+	/** Waits for the writes in flight (see close()) */
+	~UringWriter();
+
+	/**
+	 * Creates (or truncates) filename.
+	 *
+	 * @param direct Write with O_DIRECT, bypassing the page cache. Every write is then padded
+	 *               to a multiple of ALIGNMENT, so each record starts at an aligned offset.
+	 * @param pool When not NULL, its buffers are registered with the kernel, except those from its
+	 *             FrameMemoryAllocator (device memory). Must outlive the writer.
+	 * @return 0, or -1 if the file could not be created
+	 */
+	int open(const char* filename, bool direct, FramePool* pool = 0);
+
+	bool isOpen() { return fd_ >= 0; }
+
+	/**
+	 * Queues size bytes of the frame's buffer (from the start) to be appended to the file.
+	 * Keeps a reference to the frame until the write has completed. With O_DIRECT, frames in
+	 * device memory are copied first, like the data of the other append().
+	 *
+	 * @return file offset the data goes to, or -1 if queueDepth writes are already in flight
+	 *         (the caller should drop the frame) or the file is not open
+	 */
+	int64_t append(const FrameRef& frame, size_t size);
+
+	/** Same as above for data outside the frame pool, which is copied first */
+	int64_t append(const void* data, size_t size);
+
+	/**
+	 * For records made up of several writes, which should be queued all or none.
+	 * @return true if the next writes append() calls will not be rejected
+	 */
+	bool hasRoom(int writes);
+
+	/** Hands the queued writes to the kernel and handles those completed, without waiting */
+	void poll();
+
+	/**
+	 * Waits for every write queued so far to complete.
+	 * @return -1 if any write failed since open() (including those lost when io_uring failed), otherwise 0
+	 */
+	int flush();
+
+	/** flush()es and closes the file. @return as flush() */
+	int close();
+
+	bool usesIoUring() { return ring_ != 0; }
+	bool usesRegisteredBuffers() { return registered_pool_ != 0; }
+	bool isDirect() { return direct_; }
+
+	/** @return number of bytes appended so far, padding included, i.e. the offset of the next record */
+	int64_t getSize() { return end_; }
+
+	/** @return number of writes queued or in flight */
+	int getPending() { return pending_; }
+
+	unsigned long getWrites() { return writes_; }
+	unsigned long long getBytesWritten() { return bytes_; }
+	unsigned long getRejectedWrites() { return rejected_; }
+	unsigned long getFailedWrites() { return failed_; }
+
+	/** Time from queueing each write until poll() or flush() found it completed */
+	LatencyHistogram& getLatency() { return latency_; }
+
+	/** @return bytes per second, from the first write queued to the last one completed */
+	double getThroughput();
+
+	void print(FILE* out);
+
+private:
+	struct Ring; ///< The io_uring queues, mapped from the kernel
+
+	/** One write, from being queued until it has completed */
+	struct Slot {
+		FrameRef frame;        ///< The data, for append(const FrameRef&, size_t)
+		unsigned char* copy;   ///< ALIGNMENT aligned, for append(const void*, size_t). Kept for reuse.
+		size_t copy_capacity;
+		struct iovec iov;      ///< What is left to write
+		int64_t offset;        ///< Where iov goes
+		size_t size;           ///< Of the whole write
+		int buffer_index;      ///< Registered buffer holding the data, or -1
+		Clock::time_point queued;
+	};
+
+	const int queue_depth_;
+
+	int fd_;
+	std::string filename_;
+	bool direct_;
+	int64_t end_;
+
+	Ring* ring_;                ///< NULL when falling back to pwrite()
+	FramePool* registered_pool_; ///< Pool whose buffers are registered with ring_, or NULL
+
+	std::vector<Slot> slots_;
+	std::vector<int> free_slots_;
+	int pending_;     ///< Slots taken
+	int unsubmitted_; ///< Writes queued in ring_, but not yet handed to the kernel
+
+	unsigned long writes_;
+	unsigned long long bytes_;
+	unsigned long rejected_;
+	unsigned long failed_;
+	LatencyHistogram latency_;
+	Clock::time_point first_queued_;
+	Clock::time_point last_completed_;
+
+	static Ring* createRing(unsigned entries);
+	static void destroyRing(Ring* ring);
+
+	int takeSlot();
+	int64_t queueWrite(int slot);
+	void writeNow(int slot);
+	int submit(bool wait);
+	void reap();
+	void complete(int slot, int result);
+	void abandonRing();
+
+	UringWriter(const UringWriter&);
+	UringWriter& operator=(const UringWriter&);
+};
+
+
+#endif /* URINGWRITER_H_ */
@@ -0,0 +1,202 @@
+/**
+ * Bulk transfer backends for the DLC300 camera: real hardware, recording and replay.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "UsbTransport.h"
+#include "DLC300.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+
+int LibusbTransport::bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+		int& transferred, unsigned int timeout_ms)
+{
+	transferred = 0;
+	return libusb_bulk_transfer(cam_.getDeviceHandle(), endpoint, data, length, &transferred, timeout_ms);
+}
+
+
+bool LibusbTransport::isPresent()
+{
+	return cam_.getDeviceHandle() != 0;
+}
+
+
+RecordingTransport::RecordingTransport(UsbTransport& inner, const char* filename) :
+		inner_(inner),
+		file_(fopen(filename, "wb")),
+		start_(std::chrono::steady_clock::now())
+{
+	if (!file_)
+	{
+		printf("Could not open %s for recording\n", filename);
+		return;
+	}
+
+	fwrite(RECORDING_MAGIC, 1, strlen(RECORDING_MAGIC), file_);
+}
+
+
+RecordingTransport::~RecordingTransport()
+{
+	if (file_)
+	{
+		fclose(file_);
+	}
+}
+
+
+int RecordingTransport::bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+		int& transferred, unsigned int timeout_ms)
+{
+	int rc = inner_.bulkTransfer(endpoint, data, length, transferred, timeout_ms);
+
+	if (file_)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		TransferRecord record;
+		memset(&record, 0, sizeof(record));
+
+		record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start_).count();
+		record.rc = rc;
+		record.length = length;
+		record.transferred = transferred;
+		record.endpoint = endpoint;
+
+		if (fwrite(&record, sizeof(record), 1, file_) != 1 ||
+				fwrite(data, 1, transferred, file_) != size_t(transferred))
+		{
+			printf("Recording stopped, could not write to file\n");
+			fclose(file_);
+			file_ = 0;
+		}
+	}
+
+	return rc;
+}
+
+
+ReplayTransport::ReplayTransport(const char* filename, bool realtime, bool loop) :
+		file_(fopen(filename, "rb")),
+		realtime_(realtime),
+		loop_(loop),
+		finished_(false),
+		mismatches_(0),
+		started_(false),
+		offset_ns_(0),
+		last_ns_(0)
+{
+	if (!file_)
+	{
+		printf("Could not open recording %s\n", filename);
+		return;
+	}
+
+	char magic[sizeof(RECORDING_MAGIC)] = { 0 };
+
+	if (fread(magic, 1, strlen(RECORDING_MAGIC), file_) != strlen(RECORDING_MAGIC) ||
+			strcmp(magic, RECORDING_MAGIC) != 0)
+	{
+		printf("%s is not a DLC300 recording\n", filename);
+		fclose(file_);
+		file_ = 0;
+	}
+}
+
+
+ReplayTransport::~ReplayTransport()
+{
+	if (file_)
+	{
+		fclose(file_);
+	}
+}
+
+
+bool ReplayTransport::readRecord(TransferRecord& record)
+{
+	return fread(&record, sizeof(record), 1, file_) == 1;
+}
+
+
+int ReplayTransport::bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+		int& transferred, unsigned int timeout_ms)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	transferred = 0;
+
+	if (!file_ || finished_)
+	{
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+
+	TransferRecord record;
+
+	if (!readRecord(record))
+	{
+		if (loop_)
+		{
+			fseek(file_, strlen(RECORDING_MAGIC), SEEK_SET);
+			offset_ns_ += last_ns_;
+		}
+
+		if (!loop_ || !readRecord(record))
+		{
+			finished_ = true;
+			return LIBUSB_ERROR_NO_DEVICE;
+		}
+	}
+
+	if (!started_)
+	{
+		started_ = true;
+		start_ = std::chrono::steady_clock::now() - std::chrono::nanoseconds(record.timestamp_ns);
+	}
+
+	last_ns_ = record.timestamp_ns;
+
+	if (record.endpoint != endpoint)
+	{
+		mismatches_++;
+	}
+
+	uint32_t skip = record.transferred;
+
+	if (endpoint & 0x80)
+	{
+		uint32_t n = std::min(record.transferred, uint32_t(length));
+
+		if (fread(data, 1, n, file_) != n)
+		{
+			finished_ = true;
+			return LIBUSB_ERROR_NO_DEVICE;
+		}
+
+		transferred = n;
+		skip -= n;
+	}
+	else
+	{
+		transferred = std::min(record.transferred, uint32_t(length));
+	}
+
+	fseek(file_, skip, SEEK_CUR);
+
+	if (realtime_)
+	{
+		std::this_thread::sleep_until(start_ + std::chrono::nanoseconds(offset_ns_ + record.timestamp_ns));
+	}
+
+	return record.rc;
+}
@@ -0,0 +1,136 @@
+/**
+ * Bulk transfer backends for the DLC300 camera: real hardware, recording and replay.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef USBTRANSPORT_H_
+#define USBTRANSPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <mutex>
+
+class DLC300;
+
+
+/**
+ * Everything DLC300::read() and DLC300::write() need from the USB stack.
+ */
+class UsbTransport {
+public:
+	virtual ~UsbTransport() {}
+
+	/** Same semantics and return values as libusb_bulk_transfer() */
+	virtual int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+			int& transferred, unsigned int timeout_ms) = 0;
+
+	/** @return true if transfers can be made */
+	virtual bool isPresent() = 0;
+};
+
+
+/** Talks to the camera DLC300 currently has open */
+class LibusbTransport : public UsbTransport {
+	DLC300& cam_;
+public:
+	LibusbTransport(DLC300& cam) : cam_(cam) {}
+
+	int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+			int& transferred, unsigned int timeout_ms);
+
+	bool isPresent();
+};
+
+
+/**
+ * On-disk layout of each transfer in a recording. The file starts with the 8 byte RECORDING_MAGIC,
+ * and contains one TransferRecord per transfer, each followed by its 'transferred' bytes of payload.
+ * All fields are stored in host byte order.
+ */
+struct TransferRecord {
+	uint64_t timestamp_ns; ///< Time since the recording started, when the transfer completed
+	int32_t  rc;           ///< Value returned by libusb_bulk_transfer()
+	uint32_t length;       ///< Number of bytes requested
+	uint32_t transferred;  ///< Number of bytes actually transferred (and stored after this record)
+	uint8_t  endpoint;     ///< bit7 set for IN transfers
+	uint8_t  reserved[3];
+};
+
+#define RECORDING_MAGIC "DLC300R1"
+
+
+/**
+ * Passes every transfer on to another transport, logging direction, length, payload and
+ * completion time of each one to a file which ReplayTransport can play back.
+ */
+class RecordingTransport : public UsbTransport {
+public:
+	RecordingTransport(UsbTransport& inner, const char* filename);
+	~RecordingTransport();
+
+	bool isOpen() { return file_ != 0; }
+
+	int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+			int& transferred, unsigned int timeout_ms);
+
+	bool isPresent() { return inner_.isPresent(); }
+
+private:
+	UsbTransport& inner_;
+	FILE* file_;
+	std::chrono::steady_clock::time_point start_;
+	std::mutex mutex_;
+};
+
+
+/**
+ * Serves the transfers of a recording back, in order, so the whole capture and processing
+ * path can be exercised without a camera attached.
+ *
+ * OUT transfers are only checked for having the same endpoint as the recording.
+ * IN transfers get the recorded payload (truncated to the requested length).
+ */
+class ReplayTransport : public UsbTransport {
+public:
+	/**
+	 * @param realtime Reproduce the recorded timing, instead of serving transfers as fast as possible
+	 * @param loop Start over from the beginning at the end of the recording, instead of
+	 *             reporting LIBUSB_ERROR_NO_DEVICE
+	 */
+	ReplayTransport(const char* filename, bool realtime, bool loop);
+	~ReplayTransport();
+
+	bool isOpen() { return file_ != 0; }
+
+	int bulkTransfer(unsigned char endpoint, unsigned char* data, int length,
+			int& transferred, unsigned int timeout_ms);
+
+	bool isPresent() { return file_ != 0 && !finished_; }
+
+	unsigned long getNumMismatches() { return mismatches_; }
+
+private:
+	FILE* file_;
+	bool realtime_;
+	bool loop_;
+	bool finished_;
+	unsigned long mismatches_;
+
+	bool started_;
+	std::chrono::steady_clock::time_point start_; ///< When the first transfer was replayed
+	uint64_t offset_ns_; ///< Duration of all completed loops through the recording
+	uint64_t last_ns_;
+
+	std::mutex mutex_;
+
+	bool readRecord(TransferRecord& record);
+};
+
+
+#endif /* USBTRANSPORT_H_ */
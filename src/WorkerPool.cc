@@ -0,0 +1,193 @@
+/**
+ * Persistent worker threads for splitting image conversions into bands.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+
+int WorkerPool::default_threads_ = 0;
+
+
+WorkerPool::WorkerPool(int threads) :
+	threads_(threads),
+	should_run_(true)
+{
+	if (threads_ <= 0)
+	{
+		threads_ = std::thread::hardware_concurrency();
+	}
+
+	if (threads_ <= 0)
+	{
+		threads_ = 1;
+	}
+
+	for (int i = 1; i < threads_; i++)
+	{
+		workers_.push_back(std::thread(&WorkerPool::workerMain, this));
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		should_run_ = false;
+	}
+	work_available_.notify_all();
+
+	for (size_t i = 0; i < workers_.size(); i++)
+	{
+		workers_[i].join();
+	}
+}
+
+
+void WorkerPool::run(int tasks, TaskFunction fn, void* context)
+{
+	if (workers_.empty() || tasks <= 1)
+	{
+		for (int task = 0; task < tasks; task++)
+		{
+			fn(context, task);
+		}
+		return;
+	}
+
+	Job job;
+	job.fn = fn;
+	job.context = context;
+	job.tasks = tasks;
+	job.next_task = 0;
+	job.done = 0;
+	job.workers = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(&job);
+	}
+	work_available_.notify_all();
+
+	int done = runTasks(job);
+
+	// Every task is picked up by now, but the workers may still be working on theirs
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+	job.done += done;
+
+	work_done_.wait(lock, [&job]() { return job.done == job.tasks && job.workers == 0; });
+}
+
+
+void WorkerPool::runBands(int rows, int min_rows, BandFunction fn, void* context)
+{
+	struct Bands {
+		BandFunction fn;
+		void* context;
+		int rows;
+		int bands;
+
+		static void runBand(void* context, int band)
+		{
+			Bands* b = static_cast<Bands*>(context);
+			b->fn(b->context, band * b->rows / b->bands, (band + 1) * b->rows / b->bands);
+		}
+	};
+
+	int bands = threads_;
+
+	if (min_rows > 0 && rows / min_rows < bands)
+	{
+		bands = rows / min_rows;
+	}
+
+	if (bands < 1)
+	{
+		bands = 1;
+	}
+
+	Bands b = { fn, context, rows, bands };
+	run(bands, Bands::runBand, &b);
+}
+
+
+int WorkerPool::runTasks(Job& job)
+{
+	int done = 0;
+
+	for (int task = job.next_task++; task < job.tasks; task = job.next_task++)
+	{
+		job.fn(job.context, task);
+		done++;
+	}
+
+	return done;
+}
+
+
+WorkerPool::Job* WorkerPool::findJob()
+{
+	for (size_t i = 0; i < jobs_.size(); i++)
+	{
+		if (jobs_[i]->next_task < jobs_[i]->tasks)
+		{
+			return jobs_[i];
+		}
+	}
+
+	return 0;
+}
+
+
+void WorkerPool::workerMain()
+{
+	while (true)
+	{
+		Job* job;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_available_.wait(lock, [this]() { return !should_run_ || findJob(); });
+
+			if (!should_run_)
+			{
+				return;
+			}
+
+			// The job stays alive until its caller sees workers drop back to 0
+			job = findJob();
+			job->workers++;
+		}
+
+		int done = runTasks(*job);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job->done += done;
+			job->workers--;
+		}
+		work_done_.notify_all();
+	}
+}
+
+
+WorkerPool& WorkerPool::getDefault()
+{
+	static WorkerPool pool(default_threads_);
+	return pool;
+}
+
+
+void WorkerPool::setDefaultThreadCount(int threads)
+{
+	default_threads_ = threads;
+}
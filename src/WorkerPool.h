@@ -0,0 +1,98 @@
+/**
+ * Persistent worker threads for splitting image conversions into bands.
+ *
+ * Original author Simon Gustafsson (www.simong.eu/projects/dlc300)
+ *
+ * Copyright (c) 2012-2015 Simon Gustafsson (www.simong.eu)
+ * Do whatever you like with this code, but please refer to me as the original author.
+ */
+
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * A fixed set of threads, started once and kept waiting for work, so splitting a frame
+ * between them costs a wake up instead of thread creation.
+ *
+ * The thread calling run() works on the tasks as well, so a pool of N threads starts
+ * N - 1 workers, and a pool of 1 thread runs everything in the caller.
+ *
+ * Several threads may call run() at the same time (the live view and the snapshot writers do).
+ * Each call is a job of its own: its caller works through its tasks without waiting for the
+ * other jobs, and idle workers help with the oldest job that still has tasks left.
+ */
+class WorkerPool {
+public:
+	typedef void (*TaskFunction)(void* context, int task);
+
+	/** Called with the rows [first_row, end_row) of one band */
+	typedef void (*BandFunction)(void* context, int first_row, int end_row);
+
+	/** @param threads Total number of threads, including the caller. 0 means one per CPU. */
+	explicit WorkerPool(int threads);
+	~WorkerPool();
+
+	/**
+	 * Calls fn(context, task) for task 0..tasks-1, spread over all threads, and returns
+	 * when all of them are done. Calls from several threads run side by side.
+	 */
+	void run(int tasks, TaskFunction fn, void* context);
+
+	/**
+	 * Splits rows into one band per thread (fewer if a band would get less than min_rows rows),
+	 * and calls fn for each of them through run(). A band reading rows outside of its own
+	 * (halo rows) just reads them from the shared source image.
+	 */
+	void runBands(int rows, int min_rows, BandFunction fn, void* context);
+
+	int getThreadCount() { return threads_; }
+
+	/** The pool used by the image conversions (ImageKernels and Demosaic) */
+	static WorkerPool& getDefault();
+
+	/**
+	 * Number of threads of the default pool (0 means one per CPU).
+	 * @note Only has effect before the first call to getDefault()
+	 */
+	static void setDefaultThreadCount(int threads);
+
+private:
+	int threads_;
+	std::vector<std::thread> workers_;
+
+	/** The tasks of one call to run() */
+	struct Job {
+		TaskFunction fn;
+		void* context;
+		int tasks;
+		std::atomic<int> next_task;
+		int done;    ///< Tasks finished
+		int workers; ///< Workers which have picked up the job and may still look at next_task
+	};
+
+	std::mutex mutex_; ///< Guards everything below, and the done and workers fields of the jobs
+	std::condition_variable work_available_;
+	std::condition_variable work_done_;
+	bool should_run_;
+	std::deque<Job*> jobs_; ///< Jobs of the run() calls in progress, oldest first
+
+	static int default_threads_;
+
+	void workerMain();
+	Job* findJob(); ///< @return the oldest job with tasks left, or NULL. Call with mutex_ locked
+	static int runTasks(Job& job); ///< Picks tasks until there are no more. @return number of tasks run
+
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+
+#endif /* WORKERPOOL_H_ */
@@ -14,13 +14,34 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <vector>
 
+#include "AsyncCapture.h"
 #include "AutoWhiteBalance.h"
+#include "CameraRig.h"
+#include "CaptureThread.h"
+#include "ColorPipeline.h"
+#include "CpuFeatures.h"
 #include "DLC300.h"
+#include "FrameStatistics.h"
+#include "SequenceFile.h"
+#include "SnapshotEncoder.h"
 #include "SnapshotHelpers.h"
+#include "SnapshotWriter.h"
 #include "GUIHelpers.h"
+#include "WorkerPool.h"
+
+
+/** One thread writing a snapshot to disk while the other one converts the next */
+enum { SNAPSHOT_THREADS = 2 };
+
+/** Frames being written by -w at once, before more are dropped */
+enum { FRAME_WRITES_IN_FLIGHT = 16 };
 
 
 template <class T>
@@ -30,26 +51,6 @@ T coerce(const T& value, const T& min, const T& max)
 }
 
 
-void saveSnapshot(unsigned char* img, int w, int h, int& saveIndex)
-{
-	saveIndex = SnapshotHelpers::getNextUnusedIndex(saveIndex);
-
-	if (saveIndex >= 0)
-	{
-		SnapshotHelpers::saveRAWSnapshot(img, w, h, saveIndex);
-		SnapshotHelpers::savePPMSnapshot(img, w, h, saveIndex);
-		SnapshotHelpers::savePPMSnapshot_demosaic_linear(img, w, h, saveIndex);
-
-		saveIndex++;
-	}
-	else
-	{
-		printf("Could not save snapshot. Image numbering exhausted\n"
-				"(i.e. all non-negative integers have been used up)\n");
-	}
-}
-
-
 void handleExposureAdjustment(int exposureDirection, int& exposure, bool should_be_verbose)
 {
 	if (exposureDirection)
@@ -71,34 +72,183 @@ void handleExposureAdjustment(int exposureDirection, int& exposure, bool should_
 
 
 /**
- * This summation is very specific to the bayer pattern generated by our camera
+ * Gathers the statistics of a frame. When viewing, the white balance region is region 0.
+ */
+void computeFrameStatistics(FrameStatistics& stats, const FrameView& frame, SDLWindow* window)
+{
+	stats.clearRegions();
+
+	if (window)
+	{
+		int left, right, top, bottom;
+		window->calculateWhitebalanceRegion(frame.width, frame.height, left, top, right, bottom);
+		stats.addRegion(left, top, right, bottom);
+	}
+
+	stats.compute(frame);
+}
+
+
+/**
+ * Lists the frames of a sequence file recorded with -w, and optionally saves one of them as a snapshot.
+ * @return exit code of the program
+ */
+int showSequence(const char* filename, int exportFrame, Demosaic::Algorithm algorithm, ColorPipeline& color,
+		bool should_be_verbose)
+{
+	SequenceReader sequence;
+
+	if (sequence.open(filename) < 0)
+	{
+		return 1;
+	}
+
+	const int num_frames = sequence.getNumFrames();
+	const time_t created = sequence.getHeader().created_ns / 1000000000u;
+
+	printf("%s: %d frames, recorded %s", filename, num_frames, ctime(&created));
+
+	if (num_frames > 1)
+	{
+		double seconds = (sequence.getIndexEntry(num_frames - 1).last_byte_ns - sequence.getIndexEntry(0).last_byte_ns) / 1e9;
+		uint64_t captured = sequence.getIndexEntry(num_frames - 1).sequence - sequence.getIndexEntry(0).sequence + 1;
+
+		printf("%.1f seconds, %.1f fps, %llu frames not recorded\n", seconds, seconds > 0 ? (num_frames - 1) / seconds : 0,
+				(unsigned long long)(captured - num_frames));
+	}
+
+	// Every frame record is read from disk, so only on request
+	for (int i = 0; should_be_verbose && i < num_frames; i++)
+	{
+		FrameMetadata meta;
+		sequence.getMetadata(i, meta);
+
+		printf("frame %d: sequence=%llu, t=%.3f s, %dx%d at %d,%d, exposure=%d, gains=%d/%d/%d\n", i,
+				(unsigned long long)meta.sequence, int64_t(meta.last_byte_ns - sequence.getHeader().monotonic_ns) / 1e9,
+				meta.width, meta.height, meta.crop_x, meta.crop_y, int(meta.exposure),
+				int(meta.red_gain), int(meta.green_gain), int(meta.blue_gain));
+	}
+
+	if (exportFrame >= num_frames)
+	{
+		printf("There is no frame %d in %s\n", exportFrame, filename);
+		return 1;
+	}
+
+	if (exportFrame >= 0)
+	{
+		FrameView frame = sequence.getFrame(exportFrame);
+
+		if (!frame.data)
+		{
+			printf("Frame %d of %s is damaged\n", exportFrame, filename);
+			return 1;
+		}
+
+		int index = SnapshotHelpers::getNextUnusedIndex();
+
+		if (index < 0)
+		{
+			printf("Could not save snapshot. Image numbering exhausted\n");
+			return 1;
+		}
+
+		SnapshotEncoder encoder(SnapshotEncoder::ALL, algorithm, &color);
+		return encoder.encode(frame, index) == 0 ? 0 : 1;
+	}
+
+	return 0;
+}
+
+
+/** 64 bit FNV-1a of size bytes at data, continuing from hash */
+static uint64_t checksum(const unsigned char* data, size_t size, uint64_t hash)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+
+/**
+ * Times the conversions of the view (binning to 32 bit pixels) and of the snapshots (demosaicing)
+ * at each resolution, on a made up frame which is the same in every run. Compare a run with -j 1
+ * to one with more threads for the speedup; the checksums of the output must be the same.
+ * @return exit code of the program
  */
-void calculateWhitebalanceRegionSums(unsigned char* buffer, unsigned bufferStride,
-		int top, int bottom, int left, int right,
-		long & sum_R, long & sum_G, long & sum_B)
+int benchmarkConversions(Demosaic::Algorithm algorithm, ColorPipeline& color)
 {
-	sum_R = 0;
-	sum_G = 0;
-	sum_B = 0;
+	enum { ITERATIONS = 20 };
+
+	typedef std::chrono::steady_clock Clock;
 
-	for (int y = top / 2; y < bottom / 2; y++)
+	printf("%d conversion thread(s), %s kernels, %s demosaicing, best of %d\n", WorkerPool::getDefault().getThreadCount(),
+			ImageKernels::getImplementationName(), Demosaic::getAlgorithmName(algorithm), int(ITERATIONS));
+	printf("resolution  binning ms  demosaic ms  checksum\n");
+
+	for (int res = DLC300::RESOLUTION_MIN; res <= DLC300::RESOLUTION_MAX; res++)
 	{
-		for (int x = left / 2; x < right / 2; x++)
+		int width, height;
+		DLC300::getDimensions(DLC300::resolutionEnum(res), width, height);
+
+		std::vector<unsigned char> bayer(size_t(width) * height);
+		uint32_t seed = 1;
+
+		for (size_t i = 0; i < bayer.size(); i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			bayer[i] = seed >> 24;
+		}
+
+		const FrameView frame(&bayer[0], width, height);
+		const ImageKernels::PixelFormat32 format = { 16, 8, 0, 0xFF000000u };
+
+		std::vector<unsigned char> view(size_t(frame.getQuadWidth()) * frame.getQuadHeight() * 4);
+		std::vector<unsigned char> snapshot(size_t(width) * height * 3);
+
+		double binning_ms = 1e9;
+		double demosaic_ms = 1e9;
+
+		for (int i = 0; i < ITERATIONS; i++)
 		{
-			uint8_t R  = buffer[(y * 2) * bufferStride     + x * 2 + 0];
-			uint8_t G1 = buffer[(y * 2) * bufferStride     + x * 2 + 1];
-			uint8_t G2 = buffer[(y * 2 + 1) * bufferStride + x * 2 + 0];
-			uint8_t B  = buffer[(y * 2 + 1) * bufferStride + x * 2 + 1];
-
-			sum_R += R;
-			sum_G += (G1 + G2) / 2;
-			sum_B += B;
+			Clock::time_point start = Clock::now();
+			ImageKernels::binBayer2x2ToRGB32(frame, &view[0], frame.getQuadWidth() * 4, format, &color);
+			Clock::time_point binned = Clock::now();
+			Demosaic::demosaic(algorithm, frame, &snapshot[0], width * 3, &color);
+			Clock::time_point demosaiced = Clock::now();
+
+			binning_ms = std::min(binning_ms, std::chrono::duration<double, std::milli>(binned - start).count());
+			demosaic_ms = std::min(demosaic_ms, std::chrono::duration<double, std::milli>(demosaiced - binned).count());
 		}
+
+		uint64_t hash = checksum(&view[0], view.size(), 14695981039346656037ull);
+		hash = checksum(&snapshot[0], snapshot.size(), hash);
+
+		printf("%4dx%-4d   %10.3f  %11.3f  %016llx\n", width, height, binning_ms, demosaic_ms, (unsigned long long)hash);
 	}
 
+	return 0;
 }
 
 
+/** Reports cameras being connected and disconnected */
+class HotplugPrinter : public DLC300::HotplugListener {
+public:
+	void cameraArrived(DLC300& /*cam*/, const std::string& location)
+	{
+		printf("Camera connected at %s\n", location.c_str());
+	}
+
+	void cameraLeft(DLC300& /*cam*/, const std::string& location)
+	{
+		printf("Camera at %s disconnected\n", location.c_str());
+	}
+};
+
+
 int main(int argc, char** argv)
 {
 	DLC300::resolutionEnum res = DLC300::RESOLUTION_2048x1536;
@@ -114,8 +264,39 @@ int main(int argc, char** argv)
 
 	bool should_center_lower_resolution = true;
 
+	int num_async_frames = 0;
+
+	bool should_keep_every_frame = false;
+
+	bool should_use_huge_pages = false;
+	bool should_use_planar_frames = false;
+
+	bool should_list_cameras = false;
+	std::string camera_selector;
+	int multi_camera_seconds = 0;
+
+	const char* record_filename = 0;
+	const char* replay_filename = 0;
+	bool should_replay_realtime = true;
+
+	int stats_interval_ms = 0;
+
+	int conversion_threads = 0;
+	bool should_benchmark = false;
+
+	int snapshot_queue_depth = 8;
+
+	const char* frame_filename = 0;
+	const char* sequence_filename = 0;
+	int sequence_export_frame = -1;
+	bool should_write_direct = false;
+
+	Demosaic::Algorithm demosaic_algorithm = Demosaic::MALVAR_HE_CUTLER;
+
+	ColorPipeline colorPipeline;
+
 	char opt;
-	while ((opt = getopt(argc, argv, "r:e:g:bchv")) != -1)
+	while ((opt = getopt(argc, argv, "r:e:g:a:kHpld:m:R:P:FS:j:Bq:w:OI:E:D:y:x:M:bchv")) != -1)
 	{
 		switch (opt)
 		{
@@ -168,6 +349,150 @@ int main(int argc, char** argv)
 		}
 		break;
 
+		case 'a':
+		{
+			int n = atoi(optarg);
+			if (n >= 1 && n <= AsyncCapture::MAX_FRAMES_IN_FLIGHT)
+			{
+				num_async_frames = n;
+			} else {
+				printf("Expected number of frames in flight within range 1-%d\n", int(AsyncCapture::MAX_FRAMES_IN_FLIGHT));
+				return 1;
+			}
+		}
+		break;
+
+		case 'k':
+			should_keep_every_frame = true;
+			break;
+
+		case 'H':
+			should_use_huge_pages = true;
+			break;
+
+		case 'p':
+			should_use_planar_frames = true;
+			break;
+
+		case 'l':
+			should_list_cameras = true;
+			break;
+
+		case 'd':
+			camera_selector = optarg;
+			break;
+
+		case 'm':
+			multi_camera_seconds = atoi(optarg);
+			if (multi_camera_seconds <= 0)
+			{
+				printf("Expected a positive number of seconds\n");
+				return 1;
+			}
+			break;
+
+		case 'R':
+			record_filename = optarg;
+			break;
+
+		case 'P':
+			replay_filename = optarg;
+			break;
+
+		case 'F':
+			should_replay_realtime = false;
+			break;
+
+		case 'S':
+			stats_interval_ms = atoi(optarg);
+			break;
+
+		case 'j':
+			conversion_threads = atoi(optarg);
+			break;
+
+		case 'B':
+			should_benchmark = true;
+			break;
+
+		case 'q':
+			snapshot_queue_depth = atoi(optarg);
+			if (snapshot_queue_depth < 1)
+			{
+				printf("Expected a positive number of snapshots\n");
+				return 1;
+			}
+			break;
+
+		case 'w':
+			frame_filename = optarg;
+			break;
+
+		case 'O':
+			should_write_direct = true;
+			break;
+
+		case 'I':
+			sequence_filename = optarg;
+			break;
+
+		case 'E':
+			sequence_export_frame = atoi(optarg);
+			if (sequence_export_frame < 0)
+			{
+				printf("Expected a frame number\n");
+				return 1;
+			}
+			break;
+
+		case 'D':
+			if (!Demosaic::parseAlgorithm(optarg, demosaic_algorithm))
+			{
+				printf("Unknown demosaicing algorithm %s\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'y':
+		{
+			double gamma = atof(optarg);
+			if (gamma > 0)
+			{
+				colorPipeline.setGamma(gamma);
+			} else {
+				printf("Expected a positive gamma\n");
+				return 1;
+			}
+		}
+		break;
+
+		case 'x':
+		{
+			double r, g, b;
+			if (sscanf(optarg, "%lf,%lf,%lf", &r, &g, &b) == 3 && r >= 0 && g >= 0 && b >= 0)
+			{
+				colorPipeline.setDigitalGains(r, g, b);
+			} else {
+				printf("Expected three non-negative gains, as in 1.2,1,1.5\n");
+				return 1;
+			}
+		}
+		break;
+
+		case 'M':
+		{
+			double m[9];
+			if (sscanf(optarg, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+					&m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6], &m[7], &m[8]) == 9)
+			{
+				colorPipeline.setColorMatrix(m);
+			} else {
+				printf("Expected nine comma separated matrix elements, row by row\n");
+				return 1;
+			}
+		}
+		break;
+
 		case 'b':
 			should_view_not_save = false;
 			break;
@@ -188,6 +513,28 @@ int main(int argc, char** argv)
 					"           the sensors native resolution is requested\n"
 					"-e 1..370  Sets exposure\n"
 					"-g 0..63   Sets gain (the same value is used for all channels)\n"
+					"-a 1..8    Asynchronous capture, keeping this many frames requested from the camera\n"
+					"-k         Keep every frame (capture waits for the viewer instead of dropping frames)\n"
+					"-H         Use huge pages for frame buffers (see /proc/sys/vm/nr_hugepages)\n"
+					"-p         Split frames into color planes in the capture thread (faster viewing and statistics)\n"
+					"-l         List connected cameras\n"
+					"-d camera  Use the camera with this location (as listed by -l) or serial number\n"
+					"-m secs    Capture from all connected cameras concurrently, reporting throughput\n"
+					"-R file    Record all USB transfers to file\n"
+					"-P file    Play back a recording made with -R instead of using a camera\n"
+					"-F         Play back as fast as possible, instead of at the recorded speed\n"
+					"-S ms      Print USB transfer statistics every ms milliseconds\n"
+					"-j threads Number of threads converting images for viewing and snapshots (default one per CPU)\n"
+					"-B         Time the image conversions at each resolution with these threads, and exit\n"
+					"-q frames  Snapshots which may wait to be written before more are dropped (default 8)\n"
+					"-w file    Record every captured frame with its settings to one sequence file, without waiting for the disk\n"
+					"-O         Write the sequence file with O_DIRECT, bypassing the page cache\n"
+					"-I file    Show a sequence file recorded with -w (and every frame in it with -v)\n"
+					"-E frame   With -I, save this frame (counting from 0) of the sequence as a snapshot\n"
+					"-D method  Demosaicing of snapshots: linear, malvar (default) or edge\n"
+					"-y gamma   Gamma applied to the view and snapshots, e.g. 2.2 (default 1, linear)\n"
+					"-x r,g,b   Digital gains applied to the view and snapshots (default 1,1,1)\n"
+					"-M m00,..  Color correction matrix, 9 elements row by row (default identity)\n"
 					"-b         \"Blind mode\", no visual imaging. It saves a few image before exiting\n"
 					"-c         DO NOT Center cropped area in low resolution modes (possibly needed for compatibility with other cameras)\n"
 					"-v         Verbose debug output (for developers)\n"
@@ -201,6 +548,10 @@ int main(int argc, char** argv)
 					"F3  Set the white balance (something grey should be in the center of the view)\n"
 					"F4  to cycle the cameras resolution\n"
 					"ESC to quit the program\n"
+					"\n"
+					"The image kernels use the best instruction set the CPU supports. Setting the\n"
+					"environment variable DLC300_KERNELS to scalar, sse2, avx2 or avx512 limits them\n"
+					"to that one, e.g. to compare their speed.\n"
 					);
 			return 0;
 			break;
@@ -211,15 +562,122 @@ int main(int argc, char** argv)
 		}
 	}
 
-	DLC300 myCam;
+	WorkerPool::setDefaultThreadCount(conversion_threads);
+
+	if (should_list_cameras)
+	{
+		std::vector<DLC300::DeviceInfo> devices = DLC300::listDevices();
+
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			printf("%-12s serial: %s\n", devices[i].location.c_str(),
+					devices[i].serial.empty() ? "(unknown)" : devices[i].serial.c_str());
+		}
+
+		printf("%d camera(s) found\n", int(devices.size()));
+		return 0;
+	}
+
+	if (should_benchmark)
+	{
+		return benchmarkConversions(demosaic_algorithm, colorPipeline);
+	}
+
+	if (sequence_filename)
+	{
+		return showSequence(sequence_filename, sequence_export_frame, demosaic_algorithm, colorPipeline, should_be_verbose);
+	}
+
+	if (multi_camera_seconds > 0)
+	{
+		std::vector<DLC300::DeviceInfo> devices = DLC300::listDevices();
+		std::vector<std::string> selectors;
+
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			selectors.push_back(devices[i].location);
+		}
+
+		if (selectors.empty())
+		{
+			printf("Could not find any DLC300 camera\n");
+			return 1;
+		}
+
+		CameraRig rig(selectors, num_async_frames, should_use_huge_pages);
+
+		for (int i = 0; i < rig.getNumCameras(); i++)
+		{
+			DLC300& cam = rig.getCamera(i);
+
+			cam.setDebugLevel(should_be_verbose ? 10 : 0);
+			cam.setShouldCenterLowResolution(should_center_lower_resolution);
+			cam.setResolution(res);
+			cam.setExposure(exposure);
+			cam.setGains(gain_red, gain_green, gain_blue);
+			cam.getStats().setDumpInterval(stats_interval_ms);
+		}
+
+		return rig.run(multi_camera_seconds) == 0 ? 0 : 1;
+	}
+
+	if ((record_filename || replay_filename) && num_async_frames > 0)
+	{
+		printf("Asynchronous capture can not be recorded or played back\n");
+		return 1;
+	}
+
+	std::unique_ptr<ReplayTransport> replay;
+
+	if (replay_filename)
+	{
+		// The live view keeps looping the recording, while blind mode stops at its end
+		replay.reset(new ReplayTransport(replay_filename, should_replay_realtime, should_view_not_save));
+
+		if (!replay->isOpen())
+		{
+			return 1;
+		}
+	}
+
+	HotplugPrinter hotplugPrinter; // Outlives the camera reporting to it
+
+	std::unique_ptr<DLC300> camera(replay.get() ? new DLC300(replay.get()) : new DLC300(camera_selector));
+	DLC300& myCam = *camera;
+
+	std::unique_ptr<RecordingTransport> recorder;
+
+	if (record_filename)
+	{
+		recorder.reset(new RecordingTransport(myCam.getLibusbTransport(), record_filename));
+
+		if (!recorder->isOpen())
+		{
+			return 1;
+		}
+
+		myCam.setTransport(recorder.get());
+	}
 
 	if (should_be_verbose) {
 		myCam.setDebugLevel(10);
+		printf("Image kernels: %s (CPU supports %s, %s limits it)\n",
+				CpuFeatures::getLevelName(CpuFeatures::getLevel()),
+				CpuFeatures::getLevelName(CpuFeatures::detectLevel()), CpuFeatures::OVERRIDE_VARIABLE);
 	} else {
 		myCam.setDebugLevel(0);
 	}
 	
 	myCam.setShouldCenterLowResolution(should_center_lower_resolution);
+	myCam.getStats().setDumpInterval(stats_interval_ms);
+
+	myCam.setHotplugListener(&hotplugPrinter);
+
+	if (!myCam.isPresent() && !replay_filename)
+	{
+		printf("Waiting for a DLC300 camera to be connected (Ctrl-C to quit)\n");
+		myCam.waitUntilPresent(-1);
+	}
 
 	if (myCam.isPresent())
 	{
@@ -229,115 +687,227 @@ int main(int argc, char** argv)
 
 		AutoWhiteBalance whiteBalbance(gain_red, gain_green, gain_blue);
 
-		unsigned char buffer[2048*1536];
-
 		std::auto_ptr<SDLWindow> myWindow(0);
 
 		std::auto_ptr<SDLEventHandler> input(0);
 
+		const int queue_depth = 2;
+
+		// Transfer straight into usbfs memory when possible, avoiding the kernel's copy of each frame
+		DLC300DeviceMemory deviceMemory(myCam);
+
+		// Frames in the queue, in flight on the bus, a few shared by the main loop, the one being split into planes,
+		// those waiting for or being written by the snapshot writer, and those being written by -w
+		const int frame_writes = frame_filename ? int(FRAME_WRITES_IN_FLIGHT) : 0;
+		FramePool pool(queue_depth + num_async_frames + 4 + (should_use_planar_frames ? 1 : 0) +
+				snapshot_queue_depth + SNAPSHOT_THREADS + frame_writes,
+				DLC300::MAX_FRAME_SIZE + DLC300::TRAILER_SIZE, should_use_huge_pages, &deviceMemory);
+
+		if (should_be_verbose)
+		{
+			printf("%d of %d frame buffers in device memory\n", pool.getNumAllocatedFrames(), pool.getNumFrames());
+		}
+
+		std::unique_ptr<AsyncCapture> asyncCapture;
+
+		if (num_async_frames > 0)
+		{
+			asyncCapture.reset(new AsyncCapture(myCam, pool, num_async_frames));
+
+			if (asyncCapture->start() < 0)
+			{
+				printf("Could not start asynchronous capture\n");
+				return 1;
+			}
+		}
+
 		if (should_view_not_save)
 		{
 			myWindow.reset(new SDLWindow());
+			myWindow->setColorPipeline(&colorPipeline);
 			input.reset(new SDLEventHandler());
 		}
 
-		int save_no = SnapshotHelpers::getNextUnusedIndex();
+		// Blind mode should save every frame, while the live view only cares about the latest one
+		SpscQueue<Frame*>::OverflowPolicy policy = SpscQueue<Frame*>::NEWEST_WINS;
+
+		if (should_keep_every_frame || !should_view_not_save)
+		{
+			policy = SpscQueue<Frame*>::BLOCK;
+		}
+
+		CaptureThread capture(myCam, asyncCapture.get(), pool, queue_depth, policy);
+
+		if (should_use_planar_frames)
+		{
+			capture.setLayout(FrameView::PLANAR);
+		}
+
+		capture.start();
+
+		// Blind mode waits for room in the queue, so it saves every frame it set out to save
+		SnapshotWriter snapshots(snapshot_queue_depth, SNAPSHOT_THREADS, demosaic_algorithm, &colorPipeline);
+		const int snapshot_timeout_ms = should_view_not_save ? 0 : -1;
+
+		snapshots.start();
+
+		SequenceWriter frameWriter(FRAME_WRITES_IN_FLIGHT);
+
+		if (frame_filename && frameWriter.open(frame_filename, should_write_direct, &pool) < 0)
+		{
+			return 1;
+		}
+
+		if (should_be_verbose && frameWriter.isOpen())
+		{
+			printf("Writing frames to %s with %s\n", frame_filename, frameWriter.getWriter().usesIoUring() ? "io_uring" : "pwrite()");
+		}
+
+		// Shared by the white balancing and the verbose output, so each frame is only walked once
+		FrameStatistics frameStats;
+		frameStats.setLevels(0, 255);
 
 		for (int i = 0; should_view_not_save || (i < 10); i++)
 		{
-			unsigned w = myCam.getWidth();
-			unsigned h = myCam.getHeight();
+			FrameRef frame = capture.getFrame(4000);
 
-			if (w*h <= sizeof(buffer))
+			if (!frame)
 			{
-				if (myCam.getResolution() != DLC300::RESOLUTION_800x600)
-				{
-					myCam.getFrame(buffer, w*h);
-				}
-				else
-				{
-					//
-					// For unknown reasons, the 800x600 pixel mode had to be handled differently
-					//
-					assert(sizeof(buffer) >= w*h + 256);
-					myCam.getFrame(buffer, w*h + 256);
-				}
-
-				if (should_view_not_save)
-				{
-					input->refresh();
+				printf("No frame received from the capture thread\n");
+				continue;
+			}
 
-					// Should set white balance?
-					if (input->shouldSetGreyPoint() && ! whiteBalbance.isRunning())
-					{
-						whiteBalbance.start();
-					}
+			FrameView view = frame->getView();
 
-					// Should change exposure?
-					int exposureDirection = input->getExposureDirection();
-					handleExposureAdjustment(exposureDirection, exposure, should_be_verbose);
+			if (frameWriter.isOpen())
+			{
+				// The writer holds on to the frame until it is on disk, and never waits for it
+				frameWriter.append(frame);
+				frameWriter.poll();
+			}
 
-					myWindow->setShowWhitebalanceRegion(whiteBalbance.isRunning());
-					myWindow->drawBayerAsRGB(buffer, w, h);
+			bool have_statistics = false;
 
-					if (whiteBalbance.isRunning())
-					{
-						int left, right, top, bottom;
-						myWindow->calculateWhitebalanceRegion(w, h, left, top, right, bottom);
+			if (should_be_verbose)
+			{
+				computeFrameStatistics(frameStats, view, myWindow.get());
+				have_statistics = true;
 
-						long sum_R, sum_G, sum_B, mean;
+				printf("frame %llu: exposure=%d, gains=%d/%d/%d, queue depth=%d, captured=%lu, dropped=%lu\n",
+						(unsigned long long)frame->meta.sequence, int(frame->meta.exposure),
+						int(frame->meta.red_gain), int(frame->meta.green_gain), int(frame->meta.blue_gain),
+						capture.getQueueDepth(), capture.getCapturedFrames(), capture.getDroppedFrames());
 
-						calculateWhitebalanceRegionSums(buffer, w, top, bottom, left, right, sum_R, sum_G, sum_B);
+				printf("snapshots: queue depth=%d, written=%lu, dropped=%lu\n", snapshots.getQueueDepth(),
+						snapshots.getWrittenFrames(), snapshots.getDroppedFrames());
 
-						mean = (sum_R + sum_G + sum_B) / 3;
+				if (frameWriter.isOpen())
+				{
+					UringWriter& writer = frameWriter.getWriter();
+					printf("frame writes: pending=%d, recorded=%lu, dropped=%lu, %.1f MB/s\n", writer.getPending(),
+							frameWriter.getFrames(), frameWriter.getDroppedFrames(), writer.getThroughput() / 1e6);
+				}
 
-						printf("R=%ld, G=%ld, B=%ld, mean=%ld\n", sum_R, sum_G, sum_B, mean);
+				printf("mean R/G/B=%.1f/%.1f/%.1f, clipped R/G/B=%lu/%lu/%lu, black R/G/B=%lu/%lu/%lu\n",
+						frameStats.getMean(FrameStatistics::RED), frameStats.getMean(FrameStatistics::GREEN),
+						frameStats.getMean(FrameStatistics::BLUE), frameStats.getClipped(FrameStatistics::RED),
+						frameStats.getClipped(FrameStatistics::GREEN), frameStats.getClipped(FrameStatistics::BLUE),
+						frameStats.getBlack(FrameStatistics::RED), frameStats.getBlack(FrameStatistics::GREEN),
+						frameStats.getBlack(FrameStatistics::BLUE));
+			}
 
-						whiteBalbance.processCurrentSums(sum_R, sum_G, sum_B);
-						whiteBalbance.getCurrentGains(gain_red, gain_green, gain_blue);
+			if (should_view_not_save)
+			{
+				input->refresh();
 
-						printf("gain_R=%d, gain_G=%d, gain_B=%d\n", gain_red, gain_green, gain_blue);
+				// Should set white balance?
+				if (input->shouldSetGreyPoint() && ! whiteBalbance.isRunning())
+				{
+					whiteBalbance.start();
+				}
 
-						//TODO: Maybe we should automatically adjust exposure as well, so the user can't force white balancing to fail...
-					}
+				// Should change exposure?
+				int exposureDirection = input->getExposureDirection();
+				handleExposureAdjustment(exposureDirection, exposure, should_be_verbose);
 
-					myCam.setGains(gain_red, gain_green, gain_blue);
-					myCam.setExposure(exposure);
+				myWindow->setShowWhitebalanceRegion(whiteBalbance.isRunning());
+				myWindow->drawBayerAsRGB(view);
 
-					if (input->shouldTakeSnapshot())
+				if (whiteBalbance.isRunning())
+				{
+					if (!have_statistics)
 					{
-						saveSnapshot(buffer, w, h, save_no);
+						computeFrameStatistics(frameStats, view, myWindow.get());
 					}
 
-					if (input->shouldQuit())
-					{
-						break;
-					}
+					long sum_R, sum_G, sum_B, mean;
 
-					if (input->shouldCycleResolution())
-					{
-						int nextMode = myCam.getResolution() + 1;
+					frameStats.getRegionSums(0, sum_R, sum_G, sum_B);
 
-						if (nextMode > DLC300::RESOLUTION_MAX) {
-							nextMode = DLC300::RESOLUTION_MIN;
-						}
+					mean = (sum_R + sum_G + sum_B) / 3;
 
-						myCam.setResolution(DLC300::resolutionEnum(nextMode));
-						myWindow->clear();
-					}
+					printf("R=%ld, G=%ld, B=%ld, mean=%ld\n", sum_R, sum_G, sum_B, mean);
 
+					whiteBalbance.processCurrentSums(sum_R, sum_G, sum_B);
+					whiteBalbance.getCurrentGains(gain_red, gain_green, gain_blue);
+
+					printf("gain_R=%d, gain_G=%d, gain_B=%d\n", gain_red, gain_green, gain_blue);
+
+					//TODO: Maybe we should automatically adjust exposure as well, so the user can't force white balancing to fail...
 				}
-				else
+
+				myCam.setGains(gain_red, gain_green, gain_blue);
+				myCam.setExposure(exposure);
+
+				if (input->shouldTakeSnapshot() && !snapshots.submit(frame, snapshot_timeout_ms))
 				{
-					saveSnapshot(buffer, w, h, save_no);
+					printf("Snapshot of frame %llu dropped, %d waiting to be written\n",
+							(unsigned long long)frame->meta.sequence, snapshots.getQueueDepth());
 				}
+
+				if (input->shouldQuit())
+				{
+					break;
+				}
+
+				if (input->shouldCycleResolution())
+				{
+					int nextMode = myCam.getResolution() + 1;
+
+					if (nextMode > DLC300::RESOLUTION_MAX) {
+						nextMode = DLC300::RESOLUTION_MIN;
+					}
+
+					myCam.setResolution(DLC300::resolutionEnum(nextMode));
+					myWindow->clear();
+				}
+
 			}
 			else
 			{
-				printf("Something is wrong\n");
-				return 1;
+				snapshots.submit(frame, snapshot_timeout_ms);
 			}
 		}
+
+		capture.stop();
+
+		// Everything queued gets written before quitting
+		snapshots.flush();
+		snapshots.stop();
+
+		if (frameWriter.isOpen())
+		{
+			frameWriter.close();
+			frameWriter.print(stdout);
+		}
+
+		printf("Captured %lu frames, dropped %lu frames\n", capture.getCapturedFrames(), capture.getDroppedFrames());
+		printf("Wrote %lu snapshots, dropped %lu snapshots\n", snapshots.getWrittenFrames(), snapshots.getDroppedFrames());
+
+		if (should_be_verbose || stats_interval_ms > 0)
+		{
+			myCam.getStats().print(stdout);
+		}
 	}
 
 	return 0;